@@ -0,0 +1,93 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+
+#include "ClientClass.h"
+
+ClientClassifier::ClientClassifier() : m_bEmpty(true)
+{
+    m_vTrie.push_back(TRIENODE({ {}, -1 }));    // root node
+}
+
+bool ClientClassifier::AddRule(const string& strMatch, const string& strValue, int nClass)
+{
+    MATCH nMatch;
+    if (strMatch == "82.1") nMatch = CIRCUIT_ID;
+    else if (strMatch == "82.2") nMatch = REMOTE_ID;
+    else if (strMatch == "77") nMatch = USER_CLASS;
+    else if (strMatch == "60") nMatch = VENDOR_CLASS;
+    else if (strMatch == "60*") nMatch = VENDOR_CLASS_PREFIX;
+    else
+        return false;
+
+    if (nMatch != VENDOR_CLASS_PREFIX)
+        m_maExact[nMatch].emplace(strValue, nClass);  // the first rule wins
+    else
+    {
+        uint32_t nNode = 0;
+        for (const auto c : strValue)
+        {
+            auto& vChilds = m_vTrie[nNode].vChilds;
+            auto itChild = lower_bound(begin(vChilds), end(vChilds), static_cast<uint8_t>(c), [](const pair<uint8_t, uint32_t>& p, uint8_t ch) { return p.first < ch; });
+            if (itChild != end(vChilds) && itChild->first == static_cast<uint8_t>(c))
+                nNode = itChild->second;
+            else
+            {
+                const uint32_t nNew = static_cast<uint32_t>(m_vTrie.size());
+                vChilds.insert(itChild, make_pair(static_cast<uint8_t>(c), nNew));
+                m_vTrie.push_back(TRIENODE({ {}, -1 }));   // vChilds is invalid from here on
+                nNode = nNew;
+            }
+        }
+        if (m_vTrie[nNode].nClass == -1)
+            m_vTrie[nNode].nClass = nClass;
+    }
+
+    m_bEmpty = false;
+    return true;
+}
+
+int ClientClassifier::Classify(const string& strCircuitId, const string& strRemoteId, const string& strUserClass, const string& strVendorClass) const
+{
+    if (m_bEmpty == true)
+        return -1;
+
+    const string* pValues[VENDOR_CLASS_PREFIX] = { &strCircuitId, &strRemoteId, &strUserClass, &strVendorClass };
+    for (int n = 0; n < VENDOR_CLASS_PREFIX; ++n)
+    {
+        if (pValues[n]->empty() == false && m_maExact[n].empty() == false)
+        {
+            const auto itFound = m_maExact[n].find(*pValues[n]);
+            if (itFound != end(m_maExact[n]))
+                return itFound->second;
+        }
+    }
+
+    return strVendorClass.empty() == false ? FindPrefix(strVendorClass) : -1;
+}
+
+int ClientClassifier::FindPrefix(const string& strValue) const
+{
+    int nClass = m_vTrie[0].nClass;
+    uint32_t nNode = 0;
+    for (const auto c : strValue)
+    {
+        const auto& vChilds = m_vTrie[nNode].vChilds;
+        const auto itChild = lower_bound(begin(vChilds), end(vChilds), static_cast<uint8_t>(c), [](const pair<uint8_t, uint32_t>& p, uint8_t ch) { return p.first < ch; });
+        if (itChild == end(vChilds) || itChild->first != static_cast<uint8_t>(c))
+            break;
+        nNode = itChild->second;
+        if (m_vTrie[nNode].nClass != -1)
+            nClass = m_vTrie[nNode].nClass;  // longest prefix so far
+    }
+    return nClass;
+}
@@ -0,0 +1,59 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Classification of a request by option 60 (Vendor class), 77 (User class) and
+// 82 (Relay agent information). The rules from the config are compiled into hash
+// tables for the exact matches and a prefix trie for the vendor class prefixes.
+// A request is matched in the order: Circuit-ID, Remote-ID, User class,
+// Vendor class, longest Vendor class prefix.
+class ClientClassifier
+{
+public:
+    enum MATCH : uint8_t
+    {
+        CIRCUIT_ID = 0,         // 82.1
+        REMOTE_ID,              // 82.2
+        USER_CLASS,             // 77
+        VENDOR_CLASS,           // 60
+        VENDOR_CLASS_PREFIX,    // 60*
+        MATCH_COUNT
+    };
+
+    ClientClassifier();
+
+    // strMatch = "60", "60*", "77", "82.1" or "82.2"
+    bool AddRule(const string& strMatch, const string& strValue, int nClass);
+    int Classify(const string& strCircuitId, const string& strRemoteId, const string& strUserClass, const string& strVendorClass) const;
+    bool IsEmpty() const { return m_bEmpty; }
+
+private:
+    typedef struct
+    {
+        vector<pair<uint8_t, uint32_t>> vChilds; // sorted by character
+        int nClass;                              // -1 if no prefix ends here
+    }TRIENODE;
+
+    int FindPrefix(const string& strValue) const;
+
+private:
+    bool m_bEmpty;
+    unordered_map<string, int> m_maExact[VENDOR_CLASS_PREFIX];
+    vector<TRIENODE> m_vTrie;
+};
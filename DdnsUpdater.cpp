@@ -0,0 +1,506 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <ctime>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+
+#include "DdnsUpdater.h"
+#include "Trace.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Ws2tcpip.h>
+#define poll WSAPoll
+#define close closesocket
+#define INVALID_FD INVALID_SOCKET
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#define INVALID_FD -1
+#endif
+
+namespace
+{
+    enum : uint16_t
+    {
+        TYPE_A = 1,
+        TYPE_SOA = 6,
+        TYPE_PTR = 12,
+        TYPE_DHCID = 49,
+        TYPE_TSIG = 250,
+        TYPE_ANY = 255,
+        CLASS_IN = 1,
+        CLASS_NONE = 254,
+        CLASS_ANY = 255
+    };
+
+    enum : int
+    {
+        RCODE_NOERROR = 0,
+        RCODE_YXDOMAIN = 6,
+        RCODE_NXRRSET = 8
+    };
+
+    const size_t   s_nNamesPerMessage = 16;
+    const uint32_t s_nMaxTries = 8;
+    const int      s_nReplyTimeoutMs = 2000;
+    const auto     s_tCollectDelay = chrono::milliseconds(200);    // changes of this time are send in one message
+
+    void PutUInt(vector<uint8_t>& vBuf, uint64_t nValue, int nBytes)
+    {
+        for (int n = nBytes - 1; n >= 0; --n)
+            vBuf.push_back(static_cast<uint8_t>(nValue >> (n * 8)));
+    }
+
+    void PutName(vector<uint8_t>& vBuf, const string& strName)
+    {
+        size_t nStart = 0;
+        while (nStart < strName.size())
+        {
+            size_t nEnd = strName.find('.', nStart);
+            if (nEnd == string::npos)
+                nEnd = strName.size();
+            const size_t nLen = min<size_t>(nEnd - nStart, 63);
+            if (nLen > 0)
+            {
+                vBuf.push_back(static_cast<uint8_t>(nLen));
+                vBuf.insert(end(vBuf), begin(strName) + nStart, begin(strName) + nStart + nLen);
+            }
+            nStart = nEnd + 1;
+        }
+        vBuf.push_back(0);
+    }
+
+    const EVP_MD* TsigDigest(const string& strAlgorithm)
+    {
+        if (strAlgorithm == "hmac-md5.sig-alg.reg.int")
+            return EVP_md5();
+        if (strAlgorithm == "hmac-sha1")
+            return EVP_sha1();
+        if (strAlgorithm == "hmac-sha256")
+            return EVP_sha256();
+        if (strAlgorithm == "hmac-sha512")
+            return EVP_sha512();
+        return nullptr;
+    }
+}
+
+DdnsUpdater::DdnsUpdater(const string& strServer, uint32_t nTtl, uint8_t nReversePrefix)
+    : m_strServer(strServer), m_nTtl(nTtl), m_nReversePrefix(nReversePrefix), m_bStop(false), m_nSerial(0), m_nMessageId(static_cast<uint16_t>(time(nullptr))), m_nSent(0), m_nFailed(0), m_nConflicts(0)
+{
+}
+
+DdnsUpdater::~DdnsUpdater()
+{
+    Stop();
+}
+
+bool DdnsUpdater::SetKey(const string& strKeyName, const string& strAlgorithm, const string& strSecret)
+{
+    m_strAlgorithm = strAlgorithm.empty() == true ? "hmac-sha256" : strAlgorithm;
+    transform(begin(m_strAlgorithm), end(m_strAlgorithm), begin(m_strAlgorithm), ::tolower);
+    if (m_strAlgorithm == "hmac-md5")
+        m_strAlgorithm = "hmac-md5.sig-alg.reg.int";
+    if (TsigDigest(m_strAlgorithm) == nullptr || strSecret.empty() == true || strSecret.size() % 4 != 0)
+    {
+        MyTrace("Error: invalid TSIG key \'", strKeyName, "\'");
+        return false;
+    }
+
+    m_vSecret.resize(strSecret.size() / 4 * 3);
+    const int nLen = EVP_DecodeBlock(m_vSecret.data(), reinterpret_cast<const unsigned char*>(strSecret.c_str()), static_cast<int>(strSecret.size()));
+    if (nLen < 0)
+    {
+        MyTrace("Error: invalid TSIG key \'", strKeyName, "\'");
+        m_vSecret.clear();
+        return false;
+    }
+    m_vSecret.resize(nLen - count(end(strSecret) - 2, end(strSecret), '='));   // EVP_DecodeBlock counts the padding
+
+    m_strKeyName = strKeyName;
+    transform(begin(m_strKeyName), end(m_strKeyName), begin(m_strKeyName), ::tolower);
+    return true;
+}
+
+bool DdnsUpdater::Start()
+{
+    m_bStop = false;
+    m_thUpdate = thread(&DdnsUpdater::UpdateThread, this);
+    return true;
+}
+
+void DdnsUpdater::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_mtxJobs);
+        m_bStop = true;
+    }
+    m_cvJobs.notify_all();
+    if (m_thUpdate.joinable() == true)
+        m_thUpdate.join();
+}
+
+void DdnsUpdater::Register(const string& strFqdn, const string& strIpAddr, const string& strClientId, const uint8_t* pHwAddr)
+{
+    lock_guard<mutex> lock(m_mtxJobs);
+    const auto itRegistered = m_maRegistered.find(strFqdn);
+    if (itRegistered != end(m_maRegistered) && itRegistered->second == strIpAddr && m_maJobs.find(strFqdn) == end(m_maJobs))
+        return;     // allready in the DNS, a renew changes nothing
+    Queue(strFqdn, true, strIpAddr, MakeDhcid(strClientId, pHwAddr, strFqdn));
+}
+
+void DdnsUpdater::Unregister(const string& strFqdn, const string& strIpAddr, const string& strClientId, const uint8_t* pHwAddr)
+{
+    lock_guard<mutex> lock(m_mtxJobs);
+    Queue(strFqdn, false, strIpAddr, MakeDhcid(strClientId, pHwAddr, strFqdn));
+}
+
+void DdnsUpdater::Queue(const string& strFqdn, bool bAdd, const string& strIpAddr, vector<uint8_t>&& vDhcid)
+{
+    m_maJobs[strFqdn] = JOB({ bAdd, strIpAddr, false, false, 0, ++m_nSerial, chrono::steady_clock::now() + s_tCollectDelay, move(vDhcid), false });
+    m_cvJobs.notify_all();
+}
+
+vector<uint8_t> DdnsUpdater::MakeDhcid(const string& strClientId, const uint8_t* pHwAddr, const string& strFqdn)
+{
+    // RFC 4701, 3.3: identifier type, digest type 1 (SHA-256), SHA-256 of the identifier and the name in wire format
+    vector<uint8_t> vInput;
+    if (strClientId.empty() == false)
+        vInput.assign(begin(strClientId), end(strClientId));    // type 1: the data of option 61
+    else
+    {   // type 0: htype and chaddr
+        vInput.push_back(1);
+        vInput.insert(end(vInput), pHwAddr, pHwAddr + 6);
+    }
+    PutName(vInput, strFqdn);
+
+    vector<uint8_t> vDhcid;
+    PutUInt(vDhcid, strClientId.empty() == false ? 1 : 0, 2);
+    vDhcid.push_back(1);
+    vDhcid.resize(3 + SHA256_DIGEST_LENGTH);
+    SHA256(vInput.data(), vInput.size(), vDhcid.data() + 3);
+    return vDhcid;
+}
+
+size_t DdnsUpdater::GetPending()
+{
+    lock_guard<mutex> lock(m_mtxJobs);
+    return m_maJobs.size();
+}
+
+string DdnsUpdater::MakeFqdn(const string& strName, const string& strDomain)
+{
+    auto fnClean = [](const string& strIn) -> string
+    {
+        string strOut;
+        for (const char c : strIn)
+        {
+            if (isalnum(static_cast<unsigned char>(c)) != 0 || c == '-' || c == '.')
+                strOut += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            else if (c == ' ' || c == '_')
+                strOut += '-';
+        }
+        strOut.erase(strOut.find_last_not_of('.') + 1);
+        strOut.erase(0, strOut.find_first_not_of('.'));
+        return strOut;
+    };
+
+    const string strHost = fnClean(strName);
+    if (strHost.empty() == true || strHost.find('.') != string::npos)
+        return strHost;     // the client send a fully qualified name
+
+    const string strZone = fnClean(strDomain);
+    return strZone.empty() == true ? string() : strHost + "." + strZone;
+}
+
+string DdnsUpdater::ReverseName(const string& strIpAddr) const
+{
+    uint8_t caAddr[4];
+    if (::inet_pton(AF_INET, strIpAddr.c_str(), caAddr) != 1)
+        return string();
+    return to_string(caAddr[3]) + "." + to_string(caAddr[2]) + "." + to_string(caAddr[1]) + "." + to_string(caAddr[0]) + ".in-addr.arpa";
+}
+
+string DdnsUpdater::ReverseZone(const string& strIpAddr) const
+{
+    const string strName = ReverseName(strIpAddr);
+    size_t nPos = 0;
+    for (int n = (32 - m_nReversePrefix) / 8; n > 0; --n)
+        nPos = strName.find('.', nPos) + 1;
+    return strName.empty() == true ? string() : strName.substr(nPos);
+}
+
+void DdnsUpdater::UpdateThread()
+{
+    unique_lock<mutex> lock(m_mtxJobs);
+    while (m_bStop == false)
+    {
+        const auto tNow = chrono::steady_clock::now();
+        auto tWakeUp = tNow + chrono::seconds(60);
+        vector<pair<string, JOB>> vDue;
+        for (const auto& itJob : m_maJobs)
+        {
+            if (itJob.second.tNext <= tNow)
+                vDue.push_back(itJob);
+            else
+                tWakeUp = min(tWakeUp, itJob.second.tNext);
+        }
+        if (vDue.empty() == true)
+        {
+            m_cvJobs.wait_until(lock, tWakeUp);
+            continue;
+        }
+        lock.unlock();
+
+        // The forward name with one message per name, the prerequisites are valid for the whole message
+        for (auto& itDue : vDue)
+        {
+            JOB& stJob = itDue.second;
+            const size_t nDot = itDue.first.find('.');
+            if (stJob.bForwardDone == false && nDot != string::npos)
+                stJob.bForwardDone = UpdateForward(itDue.first.substr(nDot + 1), itDue.first, stJob);
+            else
+                stJob.bForwardDone = true;
+        }
+
+        // the reverse names: one message per zone with up to s_nNamesPerMessage names
+        map<string, vector<size_t>> maReverse;
+        for (size_t n = 0; n < vDue.size(); ++n)
+        {
+            JOB& stJob = vDue[n].second;
+            const string strZone = m_nReversePrefix != 0 && stJob.bConflict == false ? ReverseZone(stJob.strIpAddr) : string();
+            if (stJob.bReverseDone == false && strZone.empty() == false)
+                maReverse[strZone].push_back(n);
+            else
+                stJob.bReverseDone = true;
+        }
+
+        auto fnSend = [&](map<string, vector<size_t>>& maZones)
+        {
+            for (const auto& itZone : maZones)
+            {
+                for (size_t nFirst = 0; nFirst < itZone.second.size(); nFirst += s_nNamesPerMessage)
+                {
+                    vector<RECORD> vRecords;
+                    const size_t nLast = min(nFirst + s_nNamesPerMessage, itZone.second.size());
+                    for (size_t n = nFirst; n < nLast; ++n)
+                    {
+                        const string& strFqdn = vDue[itZone.second[n]].first;
+                        const JOB& stJob = vDue[itZone.second[n]].second;
+                        vector<uint8_t> vAddr(4), vTarget;
+                        ::inet_pton(AF_INET, stJob.strIpAddr.c_str(), vAddr.data());
+                        PutName(vTarget, strFqdn);
+
+                        // the address is leased by us, the PTR record is ours
+                        if (stJob.bAdd == true)
+                        {
+                            vRecords.push_back(RECORD({ ReverseName(stJob.strIpAddr), TYPE_PTR, CLASS_ANY, 0, {} }));
+                            vRecords.push_back(RECORD({ ReverseName(stJob.strIpAddr), TYPE_PTR, CLASS_IN, m_nTtl, vTarget }));
+                        }
+                        else
+                            vRecords.push_back(RECORD({ ReverseName(stJob.strIpAddr), TYPE_PTR, CLASS_NONE, 0, vTarget }));
+                    }
+
+                    if (SendUpdate(itZone.first, {}, vRecords) == RCODE_NOERROR)
+                    {
+                        for (size_t n = nFirst; n < nLast; ++n)
+                            vDue[itZone.second[n]].second.bReverseDone = true;
+                    }
+                }
+            }
+        };
+        fnSend(maReverse);
+
+        lock.lock();
+        for (const auto& itDue : vDue)
+        {
+            const auto itJob = m_maJobs.find(itDue.first);
+            if (itJob == end(m_maJobs) || itJob->second.nSerial != itDue.second.nSerial)
+                continue;   // the name was changed in the meantime, the new job does the work
+
+            if (itDue.second.bForwardDone == true && itDue.second.bReverseDone == true)
+            {
+                if (itDue.second.bAdd == true && itDue.second.bConflict == false)
+                    m_maRegistered[itDue.first] = itDue.second.strIpAddr;
+                else
+                    m_maRegistered.erase(itDue.first);
+                m_maJobs.erase(itJob);
+            }
+            else if (itDue.second.nTries + 1 >= s_nMaxTries)
+            {
+                MyTrace("Error: DNS update of \'", itDue.first, "\' failed");
+                ++m_nFailed;
+                m_maJobs.erase(itJob);
+            }
+            else
+            {   // 2, 4, 8 ... seconds, max. 5 minutes
+                itJob->second = itDue.second;
+                ++itJob->second.nTries;
+                itJob->second.tNext = chrono::steady_clock::now() + chrono::seconds(min(1u << itJob->second.nTries, 300u));
+            }
+        }
+    }
+}
+
+bool DdnsUpdater::UpdateForward(const string& strZone, const string& strFqdn, JOB& stJob)
+{
+    vector<uint8_t> vAddr(4);
+    ::inet_pton(AF_INET, stJob.strIpAddr.c_str(), vAddr.data());
+
+    if (stJob.bAdd == true)
+    {
+        // RFC 4703, 5.3.1: the name is not in use, it gets our address and the DHCID of the client
+        int nRcode = SendUpdate(strZone, { RECORD({ strFqdn, TYPE_ANY, CLASS_NONE, 0, {} }) },
+            { RECORD({ strFqdn, TYPE_A, CLASS_IN, m_nTtl, vAddr }), RECORD({ strFqdn, TYPE_DHCID, CLASS_IN, m_nTtl, stJob.vDhcid }) });
+        if (nRcode != RCODE_YXDOMAIN)
+            return nRcode == RCODE_NOERROR;
+
+        // 5.3.2: the name exists, it is only changed if it has the DHCID of the client
+        nRcode = SendUpdate(strZone, { RECORD({ strFqdn, TYPE_DHCID, CLASS_IN, 0, stJob.vDhcid }) },
+            { RECORD({ strFqdn, TYPE_A, CLASS_ANY, 0, {} }), RECORD({ strFqdn, TYPE_A, CLASS_IN, m_nTtl, vAddr }) });
+        if (nRcode == RCODE_NXRRSET)
+        {
+            MyTrace("Warnung: DNS name '", strFqdn, "' belongs to an other client, not updated");
+            ++m_nConflicts;
+            stJob.bConflict = true;
+            return true;
+        }
+        return nRcode == RCODE_NOERROR;
+    }
+
+    // 5.5: our address is only deleted if the DHCID matches, the DHCID goes with the last address
+    const int nRcode = SendUpdate(strZone, { RECORD({ strFqdn, TYPE_DHCID, CLASS_IN, 0, stJob.vDhcid }) }, { RECORD({ strFqdn, TYPE_A, CLASS_NONE, 0, vAddr }) });
+    if (nRcode == RCODE_NOERROR)
+        SendUpdate(strZone, { RECORD({ strFqdn, TYPE_DHCID, CLASS_IN, 0, stJob.vDhcid }), RECORD({ strFqdn, TYPE_A, CLASS_NONE, 0, {} }) }, { RECORD({ strFqdn, TYPE_DHCID, CLASS_ANY, 0, {} }) });
+    return nRcode == RCODE_NOERROR || nRcode == RCODE_NXRRSET;     // NXRRSET: the name is not ours
+}
+
+int DdnsUpdater::SendUpdate(const string& strZone, const vector<RECORD>& vPrereqs, const vector<RECORD>& vRecords)
+{
+    // Header: ID, opcode UPDATE, ZOCOUNT 1, PRCOUNT, UPCOUNT, ADCOUNT 0
+    const uint16_t nId = ++m_nMessageId;
+    vector<uint8_t> vMessage;
+    PutUInt(vMessage, nId, 2);
+    PutUInt(vMessage, 5 << 11, 2);
+    PutUInt(vMessage, 1, 2);
+    PutUInt(vMessage, vPrereqs.size(), 2);
+    PutUInt(vMessage, vRecords.size(), 2);
+    PutUInt(vMessage, 0, 2);
+
+    PutName(vMessage, strZone);
+    PutUInt(vMessage, TYPE_SOA, 2);
+    PutUInt(vMessage, CLASS_IN, 2);
+
+    for (const auto& vSection : { &vPrereqs, &vRecords })
+    {
+        for (const auto& stRecord : *vSection)
+        {
+            PutName(vMessage, stRecord.strName);
+            PutUInt(vMessage, stRecord.nType, 2);
+            PutUInt(vMessage, stRecord.nClass, 2);
+            PutUInt(vMessage, stRecord.nTtl, 4);
+            PutUInt(vMessage, stRecord.vRdata.size(), 2);
+            vMessage.insert(end(vMessage), begin(stRecord.vRdata), end(stRecord.vRdata));
+        }
+    }
+
+    if (m_vSecret.empty() == false)
+        AppendTsig(vMessage);
+
+    // Server address "IP[:Port]"
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    const size_t nColon = m_strServer.find(':');
+    addr.sin_port = htons(nColon != string::npos ? static_cast<uint16_t>(stoi(m_strServer.substr(nColon + 1))) : 53);
+    if (::inet_pton(AF_INET, m_strServer.substr(0, nColon).c_str(), &addr.sin_addr) != 1)
+        return -1;
+
+    auto fdSocket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fdSocket == INVALID_FD)
+        return -1;
+
+    int nReturn = -1;
+    if (::connect(fdSocket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0
+        && ::send(fdSocket, reinterpret_cast<const char*>(vMessage.data()), static_cast<int>(vMessage.size()), 0) == static_cast<int>(vMessage.size()))
+    {
+        ++m_nSent;
+        const auto tDeadline = chrono::steady_clock::now() + chrono::milliseconds(s_nReplyTimeoutMs);
+        struct pollfd pfd = { fdSocket, POLLIN, 0 };
+        for (auto tNow = chrono::steady_clock::now(); tNow < tDeadline; tNow = chrono::steady_clock::now())
+        {
+            if (::poll(&pfd, 1, static_cast<int>(chrono::duration_cast<chrono::milliseconds>(tDeadline - tNow).count())) <= 0)
+                break;
+            uint8_t caReply[512];
+            const int nBytes = static_cast<int>(::recv(fdSocket, reinterpret_cast<char*>(caReply), sizeof(caReply), 0));
+            if (nBytes < 0)
+                break;
+            if (nBytes < 12 || (caReply[0] << 8 | caReply[1]) != nId || (caReply[2] & 0x80) == 0)
+                continue;   // not the answer to our message
+
+            nReturn = caReply[3] & 0x0f;
+            if (nReturn != RCODE_NOERROR && vPrereqs.empty() == true)
+                MyTrace("Warnung: DNS update of zone \'", strZone, "\' returned rcode ", nReturn);
+            break;
+        }
+    }
+
+    ::close(fdSocket);
+    return nReturn;
+}
+
+void DdnsUpdater::AppendTsig(vector<uint8_t>& vMessage) const
+{
+    const uint64_t tSigned = static_cast<uint64_t>(time(nullptr));
+    const uint16_t nFudge = 300;
+
+    // RFC 8945, 4.3.3: the message, followed by the TSIG variables
+    vector<uint8_t> vSign(vMessage);
+    PutName(vSign, m_strKeyName);
+    PutUInt(vSign, CLASS_ANY, 2);
+    PutUInt(vSign, 0, 4);
+    PutName(vSign, m_strAlgorithm);
+    PutUInt(vSign, tSigned, 6);
+    PutUInt(vSign, nFudge, 2);
+    PutUInt(vSign, 0, 2);       // Error
+    PutUInt(vSign, 0, 2);       // Other Len
+
+    uint8_t caMac[EVP_MAX_MD_SIZE];
+    unsigned int nMacLen = 0;
+    HMAC(TsigDigest(m_strAlgorithm), m_vSecret.data(), static_cast<int>(m_vSecret.size()), vSign.data(), vSign.size(), caMac, &nMacLen);
+
+    vector<uint8_t> vRdata;
+    PutName(vRdata, m_strAlgorithm);
+    PutUInt(vRdata, tSigned, 6);
+    PutUInt(vRdata, nFudge, 2);
+    PutUInt(vRdata, nMacLen, 2);
+    vRdata.insert(end(vRdata), caMac, caMac + nMacLen);
+    vRdata.push_back(vMessage[0]);  // Original ID
+    vRdata.push_back(vMessage[1]);
+    PutUInt(vRdata, 0, 2);      // Error
+    PutUInt(vRdata, 0, 2);      // Other Len
+
+    PutName(vMessage, m_strKeyName);
+    PutUInt(vMessage, TYPE_TSIG, 2);
+    PutUInt(vMessage, CLASS_ANY, 2);
+    PutUInt(vMessage, 0, 4);
+    PutUInt(vMessage, vRdata.size(), 2);
+    vMessage.insert(end(vMessage), begin(vRdata), end(vRdata));
+
+    vMessage[11] = 1;   // ADCOUNT
+}
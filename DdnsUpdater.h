@@ -0,0 +1,105 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Dynamic DNS updates (RFC 2136) for the A and PTR records of the clients. The
+// caller only queues the change, the changes are collected per name and send by a
+// thread, the forward names one per message, the PTR records as one message per zone. Messages are signed with TSIG (RFC 8945)
+// if a key is configured. A failed update is repeated with increasing delay.
+// The forward name is protected by a DHCID record (RFC 4701, 4703): a name is only
+// added if it is not in use or has the DHCID of the client, and only removed if the
+// DHCID matches. Names of other hosts are never overwritten.
+class DdnsUpdater
+{
+public:
+    DdnsUpdater(const string& strServer, uint32_t nTtl, uint8_t nReversePrefix);
+    ~DdnsUpdater();
+
+    bool SetKey(const string& strKeyName, const string& strAlgorithm, const string& strSecret);    // Secret in base64
+    bool Start();
+    void Stop();
+
+    // strClientId = option 61, empty = the hardware address (6 byte ethernet) identifies the client
+    void Register(const string& strFqdn, const string& strIpAddr, const string& strClientId, const uint8_t* pHwAddr);
+    void Unregister(const string& strFqdn, const string& strIpAddr, const string& strClientId, const uint8_t* pHwAddr);
+
+    static string MakeFqdn(const string& strName, const string& strDomain);
+
+    uint64_t GetSent() const { return m_nSent; }
+    uint64_t GetFailed() const { return m_nFailed; }
+    uint64_t GetConflicts() const { return m_nConflicts; }
+    size_t GetPending();
+
+private:
+    typedef struct
+    {
+        bool     bAdd;
+        string   strIpAddr;
+        bool     bForwardDone;
+        bool     bReverseDone;
+        uint32_t nTries;
+        uint64_t nSerial;       // a newer change of the name has a higher number
+        chrono::steady_clock::time_point tNext;
+        vector<uint8_t> vDhcid; // RDATA of the DHCID record of the client
+        bool     bConflict;     // the name belongs to an other client
+    }JOB;
+
+    typedef struct
+    {
+        string strName;
+        uint16_t nType;
+        uint16_t nClass;
+        uint32_t nTtl;
+        vector<uint8_t> vRdata;
+    }RECORD;
+
+    void UpdateThread();
+    void Queue(const string& strFqdn, bool bAdd, const string& strIpAddr, vector<uint8_t>&& vDhcid);
+    bool UpdateForward(const string& strZone, const string& strFqdn, JOB& stJob);
+    int SendUpdate(const string& strZone, const vector<RECORD>& vPrereqs, const vector<RECORD>& vRecords);  // rcode, -1 = no answer
+    static vector<uint8_t> MakeDhcid(const string& strClientId, const uint8_t* pHwAddr, const string& strFqdn);
+    void AppendTsig(vector<uint8_t>& vMessage) const;
+    string ReverseName(const string& strIpAddr) const;
+    string ReverseZone(const string& strIpAddr) const;
+
+private:
+    string   m_strServer;
+    uint32_t m_nTtl;
+    uint8_t  m_nReversePrefix;     // 8, 16 or 24 bit network of the reverse zone, 0 = no PTR records
+    string   m_strKeyName;
+    string   m_strAlgorithm;
+    vector<uint8_t> m_vSecret;
+
+    thread   m_thUpdate;
+    mutex    m_mtxJobs;
+    condition_variable m_cvJobs;
+    bool     m_bStop;
+    map<string, JOB>    m_maJobs;           // FQDN, the last change of a name replaces the older
+    map<string, string> m_maRegistered;     // FQDN, IP address in the DNS
+    uint64_t m_nSerial;
+    uint16_t m_nMessageId;
+    atomic<uint64_t> m_nSent;
+    atomic<uint64_t> m_nFailed;
+    atomic<uint64_t> m_nConflicts;
+};
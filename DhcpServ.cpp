@@ -3,6 +3,9 @@
 
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <list>
 #include <map>
 #include <memory>
 #include <string>
@@ -12,9 +15,30 @@
 #include <codecvt>
 #include <regex>
 #include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <tuple>
 
 #include "socketlib/SocketLib.h"
 #include "ConfFile.h"
+#include "HwAddrTable.h"
+#include "IpPool.h"
+#include "ClientClass.h"
+#include "PeerLink.h"
+#include "PacketPeek.h"
+#include "RateLimit.h"
+#include "ReplyCache.h"
+#include "IngressQueue.h"
+#include "IcmpProbe.h"
+#include "DdnsUpdater.h"
+#include "HotRestart.h"
+#include "LeaseQuery.h"
+#include "LeaseHistory.h"
+#include "LeaseView.h"
+#include "FlightRecorder.h"
+#include "RequestTable.h"
+#include "LeaseImport.h"
 
 #if defined(_WIN32) || defined(_WIN64)
 #include <Ws2tcpip.h>
@@ -43,6 +67,9 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <ifaddrs.h>
+#include <poll.h>
+#include <sys/socket.h>
+#define closesocket close
 #define FN_STR(x) wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(x).c_str()
 #endif
 
@@ -100,10 +127,10 @@ public:
     };
 
 public:
-    DhcpProtokol() : m_DhcpHeader({ 0 }), m_cDhcpType(0)
+    DhcpProtokol() : m_DhcpHeader({ 0 }), m_cDhcpType(0), m_nFqdnFlags(-1), m_bRapidCommit(false)
     {
     };
-    DhcpProtokol(uint8_t* szBuffer, size_t nBytInBuf)
+    DhcpProtokol(uint8_t* szBuffer, size_t nBytInBuf) : m_nFqdnFlags(-1), m_bRapidCommit(false)
     {
         copy(&szBuffer[0], &szBuffer[sizeof(DHCPHEADER)], reinterpret_cast<unsigned char*>(&m_DhcpHeader));
 
@@ -144,7 +171,39 @@ public:
             case 61:    //Client-identifier
                 m_strClientIdent = string(reinterpret_cast<const char*>(pOtionCode), cLen);
                 break;
-            case 81:    // Client FQDN Option (RFC 4702)
+            case 77:    // User Class (RFC 3004), the length byte of a single instance is not part of the value
+                if (cLen > 1 && pOtionCode[0] == cLen - 1)
+                    m_strUserClass = string(reinterpret_cast<const char*>(pOtionCode) + 1, cLen - 1);
+                else
+                    m_strUserClass = string(reinterpret_cast<const char*>(pOtionCode), cLen);
+                break;
+            case 82:    // Relay Agent Information (RFC 3046), the relay wants it back in the reply
+                m_strRelayInfo = string(reinterpret_cast<const char*>(pOtionCode), cLen);
+                for (uint8_t* pSubOpt = pOtionCode; pSubOpt + 2 <= pOtionCode + cLen && pSubOpt + 2 + pSubOpt[1] <= pOtionCode + cLen; pSubOpt += 2 + pSubOpt[1])
+                {
+                    if (pSubOpt[0] == 1)        // Agent Circuit ID
+                        m_strCircuitId = string(reinterpret_cast<const char*>(pSubOpt) + 2, pSubOpt[1]);
+                    else if (pSubOpt[0] == 2)   // Agent Remote ID
+                        m_strRemoteId = string(reinterpret_cast<const char*>(pSubOpt) + 2, pSubOpt[1]);
+                    else if (pSubOpt[0] == 12)  // Relay Agent Identifier (RFC 6925)
+                        m_strRelayId = string(reinterpret_cast<const char*>(pSubOpt) + 2, pSubOpt[1]);
+                }
+                break;
+            case 80:    // Rapid Commit (RFC 4039), no data
+                m_bRapidCommit = true;
+                break;
+            case 81:    // Client FQDN Option (RFC 4702): flags, rcode1, rcode2, domain name
+                if (cLen >= 3)
+                {
+                    m_nFqdnFlags = pOtionCode[0];
+                    if ((pOtionCode[0] & 0x04) != 0)    // E flag, canonical wire format
+                    {
+                        for (uint8_t* pLabel = pOtionCode + 3; pLabel < pOtionCode + cLen && *pLabel != 0 && pLabel + 1 + *pLabel <= pOtionCode + cLen; pLabel += 1 + *pLabel)
+                            m_strFqdn += (m_strFqdn.empty() == true ? "" : ".") + string(reinterpret_cast<const char*>(pLabel) + 1, *pLabel);
+                    }
+                    else
+                        m_strFqdn = string(reinterpret_cast<const char*>(pOtionCode) + 3, cLen - 3);
+                }
                 break;
             default:
                 OutputDebugString(L"Unhandled option code\r\n");
@@ -165,8 +224,16 @@ public:
     vector<uint8_t> m_vOptionRequest;
     string      m_strClassIdent;
     string      m_strClientIdent;
+    string      m_strUserClass;
+    string      m_strCircuitId;
+    string      m_strRemoteId;
+    string      m_strRelayId;
+    string      m_strRelayInfo;     // option 82 as received
     string      m_strRequestIp;
     string      m_strServerIdent;
+    string      m_strFqdn;
+    int16_t     m_nFqdnFlags;   // -1 = option 81 not send
+    bool        m_bRapidCommit; // option 80 in the DHCPDISCOVER
 };
 
 class DhcpServer
@@ -175,6 +242,8 @@ class DhcpServer
     typedef struct
     {
         uint32_t nLeaseTime;    // = 3600
+        uint32_t nLeaseTimeMin; // = 900, with LeaseTimeMax the lease time follows the use of the pool: Max when empty, Min when full
+        uint32_t nLeaseTimeMax; // = 86400
         string strIP_From;      // = 192.168.214.100
         string strIP_To;        // = 192.168.214.120
         string strSubnet;       // = 255.255.255.0
@@ -182,7 +251,14 @@ class DhcpServer
         string strRouter_IP;    // = 192.168.16.1
         string strDNS_IP;       // = 192.168.16.1 [,192.168.16.254]
         string strDomainName;   // = "benzinger.local"
-        strlist vstrHW_Blocked; // = Komma getrennte Liste mit MAC Adressen die nicht bedient werden sollen
+        string strClass;        // Name of the client class, empty for the scope
+        HwAddrTable tabHwAddr;  // HW_Blocked = Komma getrennte Liste mit MAC Adressen die nicht bedient werden sollen, HW_BlockedFile, Reservation, ReservationFile
+        string strNextServer;   // = 192.168.214.246 (PXE TFTP Server, option 66 and siaddr)
+        string strBootFile;     // = "pxelinux.0" (option 67 and file)
+        ClientClassifier Classifier;    // Class = Name, 60 | 60* | 77 | 82.1 | 82.2, "Value"  the settings of the class are in the section [Scope:Name]
+        shared_ptr<IpPool> spPool;      // build from IP_From, IP_To and IP_Blocked
+        bool bRapidCommit;      // = 1, a DHCPDISCOVER with option 80 gets the DHCPACK at once (RFC 4039)
+        uint32_t nRenewJitter;  // = 20, T1 and T2 (option 58, 59) are moved by up to +-10% of the lease time, depending on the hardware address
     }CONFIG;
 
     typedef struct
@@ -190,6 +266,8 @@ class DhcpServer
         int    iAddrFamily;
         string strIpAddr;
         int    nInterfaceIndex;
+        UdpSocket* pUdpSocket;  // nullptr = descriptor taken over from the previous process
+        int    fdSocket;
     }SOCKET_ENTRY;
 
     enum IP_FLAGS : uint32_t
@@ -206,10 +284,14 @@ class DhcpServer
         string strIP;
         IP_FLAGS nFlag;
         chrono::system_clock::time_point tLeaseTime;
+        string strHostName;     // FQDN registered in the DNS
+        uint32_t nLeaseTime;    // given with the DHCPACK, 0 = the lease time of the scope
+        string strRemoteId;     // option 82.2 of the relay, for the bulk leasequery
+        string strRelayId;      // option 82.12 of the relay, for the bulk leasequery
     }IP_ENTRY;
 
 public:
-    DhcpServer()
+    DhcpServer() : m_RateLimit(5, 10, 0), m_IngressQueue(1024, 10), m_Requests(m_IngressQueue, 1024, chrono::seconds(10)), m_tQuarantine(600), m_arRenewals(), m_nRenewMinute(0), m_bStop(false), m_bStopAdopted(false), m_bFrozen(false)
     {
         m_strModulePath = wstring(FILENAME_MAX, 0);
 #if defined(_WIN32) || defined(_WIN64)
@@ -233,53 +315,148 @@ public:
         vector<wstring> vSections = conf.get();
         for (const auto& strSection : vSections)
         {
+            uint32_t nSectionIp;   // Only sections with the address of an interface are scopes. Client classes [Scope:Name] are loaded with the scope
+            if (::inet_pton(AF_INET, wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strSection).c_str(), &nSectionIp) != 1)
+                continue;
+
             vector<wstring> vKeys = conf.get(strSection);
             if (vKeys.size() > 0)
             {
                 auto itRet = m_maConfig.emplace(wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strSection), CONFIG());
                 if (itRet.second == true)
                 {
-                    for (const auto& strKey : vKeys)
+                    CONFIG& stScope = itRet.first->second;
+                    LoadConfigSection(conf, strSection, stScope);
+                    stScope.spPool = CreatePool(stScope, stScope);
+
+                    // Client classes: Class = Name, Match, "Value"
+                    vector<CONFIG>& vClasses = m_maClasses[itRet.first->first];
+                    for (const auto& strRule : conf.get(strSection, L"Class"))
                     {
-                        wstring strItem = conf.getUnique(strSection, strKey);
-                        if (strItem.empty() == false)
+                        string strClass = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strRule);
+                        size_t nPos1 = strClass.find(','), nPos2 = nPos1 != string::npos ? strClass.find(',', nPos1 + 1) : string::npos;
+                        if (nPos2 == string::npos)
                         {
-                            const static regex SpaceSeperator(",");
-
-                            if (strKey == L"LeaseTime")
-                                itRet.first->second.nLeaseTime = stoi(strItem);
-                            if (strKey == L"IP_From")
-                                itRet.first->second.strIP_From = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
-                            if (strKey == L"IP_To")
-                                itRet.first->second.strIP_To = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
-                            if (strKey == L"Subnet")
-                                itRet.first->second.strSubnet = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
-                            if (strKey == L"IP_Blocked")
-                            {
-                                string strIpBlocked = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
-                                sregex_token_iterator token(begin(strIpBlocked), end(strIpBlocked), SpaceSeperator, -1);
-                                while (token != sregex_token_iterator())
-                                    itRet.first->second.vstrIP_Blocked.push_back(*token++);
-                            }
-                            if (strKey == L"Router_IP")
-                                itRet.first->second.strRouter_IP = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
-                            if (strKey == L"DNS_IP")
-                                itRet.first->second.strDNS_IP = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
-                            if (strKey == L"DomainName")
-                                itRet.first->second.strDomainName = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
-                            if (strKey == L"HW_Blocked")
-                            {
-                                string strHwBlocked = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
-                                sregex_token_iterator token(begin(strHwBlocked), end(strHwBlocked), SpaceSeperator, -1);
-                                while (token != sregex_token_iterator())
-                                    itRet.first->second.vstrHW_Blocked.push_back(*token++);
-                            }
+                            wcout << L"Invalid class rule: " << strRule << endl;
+                            continue;
                         }
+                        auto fnTrim = [](string strVal) -> string
+                        {
+                            strVal.erase(strVal.find_last_not_of(" \t") + 1);
+                            strVal.erase(0, strVal.find_first_not_of(" \t"));
+                            if (strVal.size() >= 2 && strVal.front() == '"' && strVal.back() == '"')
+                                strVal = strVal.substr(1, strVal.size() - 2);
+                            return strVal;
+                        };
+                        const string strName = fnTrim(strClass.substr(0, nPos1));
+                        auto itClass = find_if(begin(vClasses), end(vClasses), [&](const CONFIG& stClass) { return stClass.strClass == strName; });
+                        if (itClass == end(vClasses))
+                        {
+                            CONFIG stClass(stScope);
+                            stClass.strClass = strName;
+                            stClass.tabHwAddr = HwAddrTable();
+                            stClass.Classifier = ClientClassifier();
+                            LoadConfigSection(conf, strSection + L":" + wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().from_bytes(strName), stClass);
+                            if (stClass.strIP_From != stScope.strIP_From || stClass.strIP_To != stScope.strIP_To)
+                                stClass.spPool = CreatePool(stClass, stScope);
+                            vClasses.push_back(move(stClass));
+                            itClass = end(vClasses) - 1;
+                        }
+                        if (stScope.Classifier.AddRule(fnTrim(strClass.substr(nPos1 + 1, nPos2 - nPos1 - 1)), fnTrim(strClass.substr(nPos2 + 1)), static_cast<int>(distance(begin(vClasses), itClass))) == false)
+                            wcout << L"Invalid class rule: " << strRule << endl;
                     }
                 }
             }
         }
 
+        // Two server mode: [Peer] Role = Primary | Secondary, Listen = IP:Port, Address = IP:Port of the partner, Split = 128, Timeout = 10, Key = shared secret
+        if (conf.get(L"Peer").empty() == false)
+        {
+            auto fnPeerValue = [&](const wstring& strKey, const wstring& strDefault) -> string
+            {
+                const wstring& strValue = conf.getUnique(L"Peer", strKey);
+                return wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strValue.empty() == false ? strValue : strDefault);
+            };
+            m_pPeer = make_unique<PeerLink>(fnPeerValue(L"Role", L"Primary") != "Secondary", fnPeerValue(L"Listen", L""), fnPeerValue(L"Address", L""), static_cast<uint8_t>(stoi(fnPeerValue(L"Split", L"128"))), stoi(fnPeerValue(L"Timeout", L"10")));
+            m_pPeer->SetKey(fnPeerValue(L"Key", L""));
+        }
+
+        // Storm protection: [RateLimit] PerClient = 5 packets/s, Burst = 10, Global = 0 packets/s (0 = no limit)
+        if (conf.get(L"RateLimit").empty() == false)
+        {
+            auto fnLimit = [&](const wstring& strKey, uint32_t nDefault) -> uint32_t
+            {
+                const wstring& strValue = conf.getUnique(L"RateLimit", strKey);
+                return strValue.empty() == false ? static_cast<uint32_t>(stoul(strValue)) : nDefault;
+            };
+            m_RateLimit.SetLimits(fnLimit(L"PerClient", 5), fnLimit(L"Burst", 10), fnLimit(L"Global", 0));
+        }
+
+        // Admission control: [Queue] Size = 1024 packets, RetrySecs = 10 (secs field from which a DISCOVER counts as retry), Parked = 1024 requests waiting for the ping
+        if (conf.get(L"Queue").empty() == false)
+        {
+            const wstring& strSize = conf.getUnique(L"Queue", L"Size");
+            const wstring& strRetrySecs = conf.getUnique(L"Queue", L"RetrySecs");
+            const wstring& strParked = conf.getUnique(L"Queue", L"Parked");
+            m_IngressQueue.SetLimits(strSize.empty() == false ? stoul(strSize) : 1024, static_cast<uint16_t>(strRetrySecs.empty() == false ? stoul(strRetrySecs) : 10));
+            m_Requests.SetLimit(strParked.empty() == false ? stoul(strParked) : 1024);
+        }
+
+        // Conflict detection: [Probe] Timeout = 500 ms, CacheTime = 60 s, Quarantine = 600 s (an address that answers the ping is not offered)
+        if (conf.get(L"Probe").empty() == false)
+        {
+            auto fnProbeValue = [&](const wstring& strKey, uint32_t nDefault) -> uint32_t
+            {
+                const wstring& strValue = conf.getUnique(L"Probe", strKey);
+                return strValue.empty() == false ? static_cast<uint32_t>(stoul(strValue)) : nDefault;
+            };
+            m_pProbe = make_unique<IcmpProbe>(fnProbeValue(L"Timeout", 500), fnProbeValue(L"CacheTime", 60));
+            m_tQuarantine = chrono::seconds(fnProbeValue(L"Quarantine", 600));
+        }
+
+        // Dynamic DNS: [DDNS] Server = 192.168.16.1[:53], TTL = 300, ReversePrefix = 24 (0 = no PTR), KeyName, KeyAlgorithm = hmac-sha256, KeySecret (base64)
+        if (conf.get(L"DDNS").empty() == false)
+        {
+            auto fnDdnsValue = [&](const wstring& strKey, const wstring& strDefault) -> string
+            {
+                const wstring& strValue = conf.getUnique(L"DDNS", strKey);
+                return wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strValue.empty() == false ? strValue : strDefault);
+            };
+            m_pDdns = make_unique<DdnsUpdater>(fnDdnsValue(L"Server", L"127.0.0.1"), stoul(fnDdnsValue(L"TTL", L"300")), static_cast<uint8_t>(stoul(fnDdnsValue(L"ReversePrefix", L"24"))));
+            if (fnDdnsValue(L"KeyName", L"").empty() == false && m_pDdns->SetKey(fnDdnsValue(L"KeyName", L""), fnDdnsValue(L"KeyAlgorithm", L""), fnDdnsValue(L"KeySecret", L"")) == false)
+                wcout << L"Error: invalid TSIG key in section DDNS" << endl;
+        }
+
+        // Bulk leasequery (RFC 6926): [LeaseQuery] Listen = 192.168.16.1:67, TCP
+        if (conf.get(L"LeaseQuery").empty() == false)
+            m_pLeaseQuery = make_unique<LeaseQuery>(wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(conf.getUnique(L"LeaseQuery", L"Listen")), [&](const LeaseQuery::QUERY& stQuery, LeaseQuery::SNAPSHOT& stSnapshot) { LeaseQuerySnapshot(stQuery, stSnapshot); });
+
+        // Lease history: [History] File = DhcpServ.hist, BlockSize = 4096 events per block
+        if (conf.get(L"History").empty() == false)
+        {
+            const wstring& strFile = conf.getUnique(L"History", L"File");
+            const wstring& strBlockSize = conf.getUnique(L"History", L"BlockSize");
+            m_pHistory = make_unique<LeaseHistory>(wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(m_strModulePath + (strFile.empty() == false ? strFile : L"DhcpServ.hist")), strBlockSize.empty() == false ? stoul(strBlockSize) : 4096);
+        }
+
+        // Lease table in shared memory: [LeaseView] Name = /DhcpServ.leases, Slots = 65536
+        if (conf.get(L"LeaseView").empty() == false)
+        {
+            const wstring& strName = conf.getUnique(L"LeaseView", L"Name");
+            const wstring& strSlots = conf.getUnique(L"LeaseView", L"Slots");
+            m_pLeaseView = make_unique<LeaseView>(strName.empty() == false ? wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strName) : "/DhcpServ.leases", strSlots.empty() == false ? stoul(strSlots) : 65536);
+        }
+
+        // The last packets for Wireshark, always on: [FlightRecorder] Packets = 1024 (0 = off), File = DhcpServ.pcap
+        const wstring& strPackets = conf.getUnique(L"FlightRecorder", L"Packets");
+        const wstring& strPcapFile = conf.getUnique(L"FlightRecorder", L"File");
+        if (strPackets.empty() == true || stoul(strPackets) > 0)
+            m_pRecorder = make_unique<FlightRecorder>(wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(m_strModulePath + (strPcapFile.empty() == false ? strPcapFile : L"DhcpServ.pcap")), strPackets.empty() == false ? stoul(strPackets) : 1024);
+
+        // Hot restart: [HotRestart] Path = /run/DhcpServ.sock, a new process started with --takeover gets the sockets and the leases
+        if (conf.get(L"HotRestart").empty() == false)
+            m_strHotRestart = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(conf.getUnique(L"HotRestart", L"Path"));
+
         ifstream fin;
         fin.open(FN_STR(wstring(m_strModulePath + L"DhcpServ.ini")), ios::in | ios::binary);
         if (fin.is_open() == true)
@@ -304,7 +481,7 @@ public:
                         vTmp.back().erase(vTmp.back().find_last_not_of("\" \t") + 1);   // Trim Whitespace and " character on the right
                         vTmp.back().erase(0, vTmp.back().find_first_not_of("\" \t"));   // Trim Whitespace and " character on the left
                     }
-                    if (vTmp.size() == 5)
+                    if (vTmp.size() == 5 || vTmp.size() == 6)
                     {
                         uint8_t chaddr[16] = { 0 };
                         for (uint8_t n = 0, i = 0; n < vTmp[0].size(); ++n)
@@ -327,7 +504,9 @@ public:
                             vTmp[1].resize(i);
                         }
                         array<uint8_t, 16> arHwAddr({ to_array(chaddr) });
-                        m_maIpLeases.emplace(arHwAddr, IP_ENTRY({ vTmp[1], vTmp[2], static_cast<IP_FLAGS>(stoul(vTmp[3])), chrono::system_clock::from_time_t(stoi(vTmp[4])) }));
+                        auto itNew = m_maIpLeases.emplace(arHwAddr, IP_ENTRY({ vTmp[1], vTmp[2], static_cast<IP_FLAGS>(stoul(vTmp[3])), chrono::system_clock::from_time_t(stoi(vTmp[4])), vTmp.size() == 6 ? vTmp[5] : string() }));
+                        if (itNew.second == true)
+                            MarkIpUsed(itNew.first->second.strIP, itNew.first->second.nFlag == IP_RELEASE);
                     }
                 }
             }
@@ -339,11 +518,11 @@ public:
     ~DhcpServer()
     {
         ofstream fout;
-        fout.open(FN_STR(wstring(m_strModulePath + L"DhcpServ.ini")), ios::in | ios::binary);
+        fout.open(FN_STR(wstring(m_strModulePath + L"DhcpServ.ini")), ios::out | ios::trunc | ios::binary);
         if (fout.is_open() == true)
         {
             fout.imbue(std::locale(fout.getloc(), new codecvt_utf8<wchar_t>));
-            fout.write("# HW Addr , \"Client IDent\", Ip Address, Flag, Time\r\n", 52);
+            fout.write("# HW Addr , \"Client IDent\", Ip Address, Flag, Time [, Host Name]\r\n", 66);
             for (auto iter : m_maIpLeases)
             {
                 stringstream ssCI;
@@ -354,15 +533,503 @@ public:
                 stringstream ssOut;
                 for (uint8_t n = 0; n < 6; ++n)
                     ssOut << (n > 0 ? ":" : "") << setfill('0') << hex << setw(2) << static_cast<unsigned int>(iter.first[n]);
-                ssOut << ", \"" << ssCI.str() << "\", " << iter.second.strIP << ", " << dec << iter.second.nFlag << ", " << chrono::system_clock::to_time_t(iter.second.tLeaseTime) << "\r\n";
+                ssOut << ", \"" << ssCI.str() << "\", " << iter.second.strIP << ", " << dec << iter.second.nFlag << ", " << chrono::system_clock::to_time_t(iter.second.tLeaseTime) << (iter.second.strHostName.empty() == false ? ", " + iter.second.strHostName : string()) << "\r\n";
                 fout.write(ssOut.str().c_str(), ssOut.str().size());
             }
             fout.close();
         }
     }
 
+    void LoadConfigSection(const ConfFile& conf, const wstring& strSection, CONFIG& stConfig)
+    {
+        vector<wstring> vKeys = conf.get(strSection);
+        for (const auto& strKey : vKeys)
+        {
+            wstring strItem = conf.getUnique(strSection, strKey);
+            if (strItem.empty() == false)
+            {
+                const static regex SpaceSeperator(",");
+
+                if (strKey == L"LeaseTime")
+                    stConfig.nLeaseTime = stoi(strItem);
+                if (strKey == L"LeaseTimeMin")
+                    stConfig.nLeaseTimeMin = stoi(strItem);
+                if (strKey == L"LeaseTimeMax")
+                    stConfig.nLeaseTimeMax = stoi(strItem);
+                if (strKey == L"IP_From")
+                    stConfig.strIP_From = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
+                if (strKey == L"IP_To")
+                    stConfig.strIP_To = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
+                if (strKey == L"Subnet")
+                    stConfig.strSubnet = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
+                if (strKey == L"IP_Blocked")
+                {
+                    string strIpBlocked = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
+                    sregex_token_iterator token(begin(strIpBlocked), end(strIpBlocked), SpaceSeperator, -1);
+                    while (token != sregex_token_iterator())
+                    {
+                        stConfig.vstrIP_Blocked.push_back(*token++);
+                        stConfig.vstrIP_Blocked.back().erase(stConfig.vstrIP_Blocked.back().find_last_not_of(" \t") + 1);
+                        stConfig.vstrIP_Blocked.back().erase(0, stConfig.vstrIP_Blocked.back().find_first_not_of(" \t"));
+                    }
+                }
+                if (strKey == L"Router_IP")
+                    stConfig.strRouter_IP = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
+                if (strKey == L"DNS_IP")
+                    stConfig.strDNS_IP = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
+                if (strKey == L"DomainName")
+                    stConfig.strDomainName = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
+                if (strKey == L"HW_Blocked")
+                    stConfig.tabHwAddr.AddBlocked(wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem));
+                if (strKey == L"HW_BlockedFile")
+                    stConfig.tabHwAddr.LoadBlockedFile(m_strModulePath + strItem);
+                if (strKey == L"Reservation")
+                {   // the key can exist more than once
+                    for (const auto& strReserv : conf.get(strSection, strKey))
+                    {
+                        if (stConfig.tabHwAddr.AddReservation(wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strReserv)) == false)
+                            wcout << L"Invalid reservation: " << strReserv << endl;
+                    }
+                }
+                if (strKey == L"ReservationFile")
+                    stConfig.tabHwAddr.LoadReservationFile(m_strModulePath + strItem);
+                if (strKey == L"NextServer")
+                    stConfig.strNextServer = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
+                if (strKey == L"RenewJitter")
+                    stConfig.nRenewJitter = min(stoi(strItem), 50);
+                if (strKey == L"RapidCommit")
+                    stConfig.bRapidCommit = stoi(strItem) != 0;
+                if (strKey == L"BootFile")
+                {
+                    stConfig.strBootFile = wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(strItem);
+                    stConfig.strBootFile.erase(stConfig.strBootFile.find_last_not_of("\"") + 1);
+                    stConfig.strBootFile.erase(0, stConfig.strBootFile.find_first_not_of("\""));
+                }
+            }
+        }
+    }
+
+    shared_ptr<IpPool> CreatePool(const CONFIG& stConfig, const CONFIG& stScope)
+    {
+        if (stConfig.strIP_From.empty() == true || stConfig.strIP_To.empty() == true)
+            return nullptr;
+
+        auto spPool = make_shared<IpPool>(stConfig.strIP_From, stConfig.strIP_To);
+        for (const auto& strIp : stConfig.vstrIP_Blocked)
+            spPool->Exclude(strIp);
+        for (const auto& strIp : stScope.tabHwAddr.GetReservedIps())   // reserved addresses are never given to other clients
+            spPool->Exclude(strIp);
+        return spPool;
+    }
+
+    // Every pool once. A class without its own range uses the pool of the scope
+    vector<IpPool*> DistinctPools()
+    {
+        vector<IpPool*> vPools;
+        auto fnAdd = [&](const shared_ptr<IpPool>& spPool)
+        {
+            if (spPool != nullptr && find(begin(vPools), end(vPools), spPool.get()) == end(vPools))
+                vPools.push_back(spPool.get());
+        };
+        for (const auto& itConfig : m_maConfig)
+            fnAdd(itConfig.second.spPool);
+        for (const auto& itClasses : m_maClasses)
+        {
+            for (const auto& stClass : itClasses.second)
+                fnAdd(stClass.spPool);
+        }
+        return vPools;
+    }
+
+    // bReleased = the lease is released, the address is kept for the client but not counted as used
+    void MarkIpUsed(const string& strIpAddr, bool bReleased = false)
+    {
+        for (IpPool* pPool : DistinctPools())
+        {
+            pPool->MarkUsed(strIpAddr);
+            if (bReleased == true)
+                pPool->MarkReleased(strIpAddr);
+        }
+    }
+
+    void MarkIpReleased(const string& strIpAddr)
+    {
+        for (IpPool* pPool : DistinctPools())
+            pPool->MarkReleased(strIpAddr);
+    }
+
+    // The client of a released lease comes back. False if the address was given to an other client in the meantime,
+    // the pools that were reclaimed already get the address back as released
+    bool ReclaimIp(const string& strIpAddr)
+    {
+        const vector<IpPool*> vPools = DistinctPools();
+        for (size_t n = 0; n < vPools.size(); ++n)
+        {
+            if (vPools[n]->Reclaim(strIpAddr) == false)
+            {
+                while (n-- > 0)
+                    vPools[n]->MarkReleased(strIpAddr);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void ReleaseIp(const string& strIpAddr)
+    {
+        for (auto& itConfig : m_maConfig)
+        {
+            if (itConfig.second.tabHwAddr.IsReservedIp(strIpAddr) == true)
+                return;
+        }
+        for (IpPool* pPool : DistinctPools())
+            pPool->Release(strIpAddr);
+    }
+
+    void QuarantineIp(const string& strIpAddr)
+    {
+        for (IpPool* pPool : DistinctPools())
+            pPool->Quarantine(strIpAddr, m_tQuarantine);
+    }
+
+    // bFromPeer = the change came from the partner, it is not send back
+    void LeaseChanged(const array<uint8_t, 16>& arHwAddr, const IP_ENTRY& stEntry, bool bRemoved = false, bool bFromPeer = false)
+    {
+        // the DNS update is only queued, the updater thread sends it
+        if (m_pDdns != nullptr && stEntry.strHostName.empty() == false)
+        {
+            if (bRemoved == false && stEntry.nFlag == IP_LEASE)
+                m_pDdns->Register(stEntry.strHostName, stEntry.strIP, stEntry.strClientId, arHwAddr.data());
+            else if (bRemoved == true || stEntry.nFlag == IP_RELEASE || stEntry.nFlag == IP_DECLINE)
+                m_pDdns->Unregister(stEntry.strHostName, stEntry.strIP, stEntry.strClientId, arHwAddr.data());
+        }
+
+        if (m_pLeaseView != nullptr)
+            m_pLeaseView->Changed();
+
+        if (m_pHistory != nullptr)
+        {
+            uint32_t nIpAddr = 0;
+            ::inet_pton(AF_INET, stEntry.strIP.c_str(), &nIpAddr);
+            m_pHistory->Record(LeaseHistory::EVENT({ static_cast<int64_t>(chrono::system_clock::to_time_t(chrono::system_clock::now())), arHwAddr, stEntry.strClientId, ntohl(nIpAddr), static_cast<uint8_t>(bRemoved == true ? static_cast<uint32_t>(LeaseHistory::EVENT_REMOVED) : static_cast<uint32_t>(stEntry.nFlag)), ScopeOf(stEntry.strIP) }));
+        }
+
+        if (m_pPeer != nullptr && bFromPeer == false)
+            m_pPeer->Queue(PeerLink::LEASE_UPDATE({ arHwAddr, stEntry.strClientId, stEntry.strIP, bRemoved == true ? 0 : static_cast<uint32_t>(stEntry.nFlag), static_cast<int64_t>(chrono::system_clock::to_time_t(bRemoved == true ? chrono::system_clock::now() : stEntry.tLeaseTime)),
+                stEntry.strHostName, stEntry.nLeaseTime, stEntry.strRemoteId, stEntry.strRelayId }));
+    }
+
+    // address of the scope with the address in its pools, host byte order
+    uint32_t ScopeOf(const string& strIpAddr)
+    {
+        for (const auto& itConfig : m_maConfig)
+        {
+            bool bFound = itConfig.second.spPool != nullptr && itConfig.second.spPool->Contains(strIpAddr) == true;
+            const auto itClasses = m_maClasses.find(itConfig.first);
+            for (size_t n = 0; bFound == false && itClasses != end(m_maClasses) && n < itClasses->second.size(); ++n)
+                bFound = itClasses->second[n].spPool != nullptr && itClasses->second[n].spPool->Contains(strIpAddr) == true;
+            uint32_t nScope = 0;
+            if (bFound == true && ::inet_pton(AF_INET, itConfig.first.c_str(), &nScope) == 1)
+                return ntohl(nScope);
+        }
+        return 0;
+    }
+
+    uint32_t LeaseTimeOf(const IP_ENTRY& stEntry)
+    {
+        if (stEntry.nLeaseTime != 0)
+            return stEntry.nLeaseTime;
+        for (const auto& itClasses : m_maClasses)
+        {
+            for (const auto& stClass : itClasses.second)
+            {
+                if (stClass.spPool != nullptr && stClass.spPool->Contains(stEntry.strIP) == true)
+                    return stClass.nLeaseTime;
+            }
+        }
+        for (const auto& itConfig : m_maConfig)
+        {
+            if (itConfig.second.spPool != nullptr && itConfig.second.spPool->Contains(stEntry.strIP) == true)
+                return itConfig.second.nLeaseTime;
+        }
+        return 0;
+    }
+
+    // The lease time of a new or renewed lease. The pool counts its used addresses, no search in the leases
+    static uint32_t LeaseTimeFor(const CONFIG& stConfig)
+    {
+        if (stConfig.nLeaseTimeMin == 0 || stConfig.nLeaseTimeMax <= stConfig.nLeaseTimeMin || stConfig.spPool == nullptr || stConfig.spPool->Size() == 0)
+            return stConfig.nLeaseTime;
+        const uint64_t nRange = stConfig.nLeaseTimeMax - stConfig.nLeaseTimeMin;
+        return stConfig.nLeaseTimeMax - static_cast<uint32_t>(nRange * min(stConfig.spPool->InUse(), stConfig.spPool->Size()) / stConfig.spPool->Size());
+    }
+
+    // T1 and T2 of a client. The same client gets always the same times, all clients together are spread over the window
+    static uint8_t* PutRenewTimes(uint8_t* pOptions, uint32_t nLeaseTime, uint32_t nJitter, uint64_t nHwKey)
+    {
+        if (nJitter == 0 || nLeaseTime < 60)
+            return pOptions;
+
+        nHwKey ^= nHwKey >> 33; nHwKey *= 0xff51afd7ed558ccdULL; nHwKey ^= nHwKey >> 33;    // mix the bits of the address
+        const uint64_t nWindow = static_cast<uint64_t>(nLeaseTime) * nJitter / 100;
+        const int64_t nOffset = static_cast<int64_t>(nWindow != 0 ? nHwKey % (nWindow + 1) : 0) - static_cast<int64_t>(nWindow / 2);
+        const uint32_t nT1 = static_cast<uint32_t>(static_cast<int64_t>(nLeaseTime / 2) + nOffset);
+        const uint32_t nT2 = static_cast<uint32_t>(min(static_cast<int64_t>(nLeaseTime) * 7 / 8 + nOffset / 2, static_cast<int64_t>(nLeaseTime) - 1));
+
+        *pOptions++ = 58; *pOptions++ = 4; *((long*)pOptions) = htonl(nT1); pOptions += 4;
+        *pOptions++ = 59; *pOptions++ = 4; *((long*)pOptions) = htonl(nT2); pOptions += 4;
+        return pOptions;
+    }
+
+    // called with m_mtxLeases locked
+    void CountRenewal()
+    {
+        const int64_t nMinute = chrono::duration_cast<chrono::minutes>(chrono::steady_clock::now().time_since_epoch()).count();
+        if (nMinute - m_nRenewMinute >= static_cast<int64_t>(m_arRenewals.size()))
+            m_arRenewals.fill(0);
+        else
+        {
+            while (m_nRenewMinute < nMinute)
+                m_arRenewals[++m_nRenewMinute % m_arRenewals.size()] = 0;
+        }
+        m_nRenewMinute = nMinute;
+        ++m_arRenewals[nMinute % m_arRenewals.size()];
+    }
+
+    void HousekeepingThread()
+    {
+        unique_lock<mutex> lock(m_mtxHousekeeping);
+        while (m_cvHousekeeping.wait_for(lock, chrono::seconds(10), [&]() { return m_bStop; }) == false)
+        {
+            m_Requests.Expire();
+            if (m_bFrozen == true)
+                continue;   // the leases belong to the new process
+            lock_guard<mutex> lockLeases(m_mtxLeases);
+            const auto tNow = chrono::system_clock::now();
+            for (auto& itLease : m_maIpLeases)
+            {
+                const uint32_t nLeaseTime = itLease.second.nFlag == IP_LEASE ? LeaseTimeOf(itLease.second) : 0;
+                if (nLeaseTime != 0 && itLease.second.tLeaseTime + chrono::seconds(nLeaseTime) < tNow)
+                {   // the client did not renew, the lease expired
+                    itLease.second.nFlag = IP_RELEASE;
+                    itLease.second.tLeaseTime = tNow;
+                    MarkIpReleased(itLease.second.strIP);
+                    LeaseChanged(itLease.first, itLease.second);
+                }
+            }
+        }
+    }
+
+    void ApplyPeerUpdate(const PeerLink::LEASE_UPDATE& stUpdate)
+    {
+        lock_guard<mutex> lock(m_mtxLeases);
+
+        const auto tLeaseTime = chrono::system_clock::from_time_t(static_cast<time_t>(stUpdate.tLeaseTime));
+        auto itIp = m_maIpLeases.find(stUpdate.arHwAddr);
+        if (itIp != end(m_maIpLeases) && itIp->second.tLeaseTime > tLeaseTime)
+            return;     // our entry is newer
+
+        if (itIp != end(m_maIpLeases) && (stUpdate.nFlag == 0 || itIp->second.strIP != stUpdate.strIP))
+        {
+            ReleaseIp(itIp->second.strIP);
+            LeaseChanged(itIp->first, itIp->second, true, true);
+            m_maIpLeases.erase(itIp);
+        }
+
+        // a cached reply of ours is not valid any more
+        m_ReplyCache.Invalidate(HwAddrTable::MakeKey(stUpdate.arHwAddr.data()));
+
+        if (stUpdate.nFlag != 0)
+        {
+            IP_ENTRY& stEntry = m_maIpLeases[stUpdate.arHwAddr];
+            stEntry = IP_ENTRY({ stUpdate.strClientId, stUpdate.strIP, static_cast<IP_FLAGS>(stUpdate.nFlag), tLeaseTime, stUpdate.strHostName, stUpdate.nLeaseTime, stUpdate.strRemoteId, stUpdate.strRelayId });
+            MarkIpUsed(stUpdate.strIP, stUpdate.nFlag == IP_RELEASE);
+            LeaseChanged(stUpdate.arHwAddr, stEntry, false, true);
+        }
+    }
+
+    void PeerSnapshot(vector<PeerLink::LEASE_UPDATE>& vUpdates)
+    {
+        lock_guard<mutex> lock(m_mtxLeases);
+        for (const auto& iter : m_maIpLeases)
+            vUpdates.push_back(PeerLink::LEASE_UPDATE({ iter.first, iter.second.strClientId, iter.second.strIP, static_cast<uint32_t>(iter.second.nFlag), static_cast<int64_t>(chrono::system_clock::to_time_t(iter.second.tLeaseTime)),
+                iter.second.strHostName, iter.second.nLeaseTime, iter.second.strRemoteId, iter.second.strRelayId }));
+    }
+
+    // The content of the shared memory, the publish thread of the view calls it when the leases have changed.
+    // Under the lock the leases are only copied, the slots are build after it
+    void LeaseViewSnapshot(vector<LeaseView::SLOT>& vSlots, vector<LeaseView::POOL>& vPools)
+    {
+        auto fnAddPool = [&](const string& strScope, const CONFIG& stConfig)
+        {
+            LeaseView::POOL stPool = { 0 };
+            ::inet_pton(AF_INET, strScope.c_str(), &stPool.nScope);
+            stPool.nScope = ntohl(stPool.nScope);
+            stPool.nSize = static_cast<uint32_t>(stConfig.spPool->Size());
+            stPool.nInUse = static_cast<uint32_t>(stConfig.spPool->InUse());
+            strncpy(stPool.szClass, stConfig.strClass.c_str(), sizeof(stPool.szClass) - 1);
+            vPools.push_back(stPool);
+        };
+
+        // first, last address (host byte order), lease time. The classes first, like in LeaseTimeOf
+        vector<tuple<uint32_t, uint32_t, uint32_t>> vRanges;
+        auto fnAddRange = [&](const CONFIG& stConfig)
+        {
+            uint32_t nFrom = 0, nTo = 0;
+            if (stConfig.spPool != nullptr && ::inet_pton(AF_INET, stConfig.strIP_From.c_str(), &nFrom) == 1 && ::inet_pton(AF_INET, stConfig.strIP_To.c_str(), &nTo) == 1)
+                vRanges.emplace_back(ntohl(nFrom), ntohl(nTo), stConfig.nLeaseTime);
+        };
+
+        vector<pair<array<uint8_t, 16>, IP_ENTRY>> vLeases;
+        {
+            lock_guard<mutex> lock(m_mtxLeases);
+            for (const auto& itConfig : m_maConfig)
+            {
+                if (itConfig.second.spPool != nullptr)
+                    fnAddPool(itConfig.first, itConfig.second);
+                const auto itClasses = m_maClasses.find(itConfig.first);
+                for (size_t n = 0; itClasses != end(m_maClasses) && n < itClasses->second.size(); ++n)
+                {
+                    if (itClasses->second[n].spPool != nullptr && itClasses->second[n].spPool != itConfig.second.spPool)
+                        fnAddPool(itConfig.first, itClasses->second[n]);
+                }
+            }
+            for (const auto& itClasses : m_maClasses)
+            {
+                for (const auto& stClass : itClasses.second)
+                    fnAddRange(stClass);
+            }
+            for (const auto& itConfig : m_maConfig)
+                fnAddRange(itConfig.second);
+
+            vLeases.reserve(m_maIpLeases.size());
+            vLeases.assign(begin(m_maIpLeases), end(m_maIpLeases));
+        }
+
+        vSlots.reserve(vLeases.size());
+        for (const auto& iter : vLeases)
+        {
+            LeaseView::SLOT stSlot = { { 0 } };
+            copy(begin(iter.first), end(iter.first), stSlot.arHwAddr);
+            ::inet_pton(AF_INET, iter.second.strIP.c_str(), &stSlot.nIpAddr);
+            stSlot.nIpAddr = ntohl(stSlot.nIpAddr);
+            stSlot.nFlag = iter.second.nFlag;
+            stSlot.tLeaseTime = chrono::system_clock::to_time_t(iter.second.tLeaseTime);
+            if (iter.second.nFlag == IP_LEASE)
+            {
+                stSlot.nLeaseTime = iter.second.nLeaseTime;
+                for (size_t n = 0; stSlot.nLeaseTime == 0 && n < vRanges.size(); ++n)
+                {
+                    if (stSlot.nIpAddr >= get<0>(vRanges[n]) && stSlot.nIpAddr <= get<1>(vRanges[n]))
+                        stSlot.nLeaseTime = get<2>(vRanges[n]);
+                }
+            }
+            stSlot.nClientIdLen = static_cast<uint8_t>(min(iter.second.strClientId.size(), sizeof(stSlot.arClientId)));
+            memcpy(stSlot.arClientId, iter.second.strClientId.data(), stSlot.nClientIdLen);
+            stSlot.nHostNameLen = static_cast<uint8_t>(min(iter.second.strHostName.size(), sizeof(stSlot.szHostName) - 1));
+            memcpy(stSlot.szHostName, iter.second.strHostName.data(), stSlot.nHostNameLen);
+            vSlots.push_back(stSlot);
+        }
+    }
+
+    // The leases of a bulk leasequery, copied with the lock. The TCP stream is written from the copy
+    void LeaseQuerySnapshot(const LeaseQuery::QUERY& stQuery, LeaseQuery::SNAPSHOT& stSnapshot)
+    {
+        shared_ptr<IpPool> spScope;
+        if (stQuery.nType == LeaseQuery::QUERY_SCOPE)
+        {
+            char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 };
+            const string strScope = inet_ntop(AF_INET, &stQuery.nScope, caAddrBuf, sizeof(caAddrBuf));
+            for (const auto& itConfig : m_maConfig)
+            {
+                if (itConfig.second.spPool != nullptr && itConfig.second.spPool->Contains(strScope) == true)
+                    spScope = itConfig.second.spPool;
+            }
+            for (const auto& itClasses : m_maClasses)
+            {
+                for (const auto& stClass : itClasses.second)
+                {
+                    if (stClass.spPool != nullptr && stClass.spPool->Contains(strScope) == true)
+                        spScope = stClass.spPool;
+                }
+            }
+            if (spScope == nullptr)
+                return;
+        }
+
+        lock_guard<mutex> lock(m_mtxLeases);
+        if (stQuery.nType == LeaseQuery::QUERY_ALL || stQuery.nType == LeaseQuery::QUERY_SCOPE)
+            stSnapshot.vLeases.reserve(m_maIpLeases.size());
+        for (const auto& iter : m_maIpLeases)
+        {
+            if (iter.second.nFlag != IP_LEASE)
+                continue;
+            bool bMatch = false;
+            switch (stQuery.nType)
+            {
+            case LeaseQuery::QUERY_ALL:       bMatch = true; break;
+            case LeaseQuery::QUERY_CHADDR:    bMatch = iter.first == stQuery.arHwAddr; break;
+            case LeaseQuery::QUERY_CLIENT_ID: bMatch = iter.second.strClientId == stQuery.strValue; break;
+            case LeaseQuery::QUERY_RELAY_ID:  bMatch = iter.second.strRelayId == stQuery.strValue; break;
+            case LeaseQuery::QUERY_REMOTE_ID: bMatch = iter.second.strRemoteId == stQuery.strValue; break;
+            case LeaseQuery::QUERY_SCOPE:     bMatch = spScope->Contains(iter.second.strIP); break;
+            }
+            if (bMatch == false)
+                continue;
+
+            LeaseQuery::LEASE stLease;
+            stLease.arHwAddr = iter.first;
+            stLease.nIpAddr = 0;
+            ::inet_pton(AF_INET, iter.second.strIP.c_str(), &stLease.nIpAddr);
+            stLease.tLastTransaction = chrono::system_clock::to_time_t(iter.second.tLeaseTime);
+            stLease.tLeaseEnd = stLease.tLastTransaction + LeaseTimeOf(iter.second);
+            stLease.nClientId = static_cast<uint32_t>(stSnapshot.strPool.size());
+            stLease.nClientIdLen = static_cast<uint8_t>(min<size_t>(iter.second.strClientId.size(), 255));
+            stSnapshot.strPool.append(iter.second.strClientId, 0, stLease.nClientIdLen);
+            stSnapshot.vLeases.push_back(stLease);
+        }
+    }
+
     void Start()
     {
+        if (m_pRecorder != nullptr)
+            m_pRecorder->Start();
+
+        m_thWorker = thread(&DhcpServer::WorkerThread, this);
+        m_thHousekeeping = thread(&DhcpServer::HousekeepingThread, this);
+
+        if (m_pDdns != nullptr)
+            m_pDdns->Start();
+
+        if (m_pHistory != nullptr && m_pHistory->Start() == false)
+        {
+            wcout << L"Error opening the lease history" << endl;
+            m_pHistory.reset();
+        }
+
+        if (m_pLeaseView != nullptr && m_pLeaseView->Start([&](vector<LeaseView::SLOT>& vSlots, vector<LeaseView::POOL>& vPools) { LeaseViewSnapshot(vSlots, vPools); }) == false)
+        {
+            wcout << L"Error creating the shared memory of the lease view" << endl;
+            m_pLeaseView.reset();
+        }
+
+        if (m_strHotRestart.empty() == false)
+        {
+            m_pHotRestart = make_unique<HotRestart>();
+            if (m_pHotRestart->Listen(m_strHotRestart, [&](HotRestart::SOCKETLIST& vSockets, vector<uint8_t>& vLeases) { FreezeForHandOver(vSockets, vLeases); },
+                [&]() { ResumeAfterHandOver(); }, [&](HotRestart::PACKETLIST& vPackets) { FinishHandOver(vPackets); }) == false)
+                wcout << L"Error creating hot restart socket" << endl;
+        }
+
+        if (m_pProbe != nullptr && m_pProbe->Start() == false)
+            m_pProbe.reset();   // without the ICMP socket the addresses are offered without ping
+
+        if (m_pLeaseQuery != nullptr && m_pLeaseQuery->Start() == false)
+            wcout << L"Error creating leasequery socket" << endl;
+
+        if (m_pPeer != nullptr && m_pPeer->Start([&](const PeerLink::LEASE_UPDATE& stUpdate) { ApplyPeerUpdate(stUpdate); }, [&](vector<PeerLink::LEASE_UPDATE>& vUpdates) { PeerSnapshot(vUpdates); }) == false)
+            wcout << L"Error creating peer socket" << endl;
+
 /*        BaseSocket::EnumIpAddresses([&](int adrFamily, const string& strIpAddr, int nInterfaceIndex, void*) -> int
         {
             wcout << strIpAddr.c_str() << endl;//OutputDebugStringA(strIpAddr.c_str()); OutputDebugStringA("\r\n");
@@ -396,9 +1063,14 @@ public:
 
         if (m_maConfig.find(strIpAddr) != end(m_maConfig))   // IP found in the config
         {
-            if (bDelAdd == true)    // and the address is new
+            lock_guard<mutex> lock(m_mtxSockets);
+            auto itAdopted = find_if(begin(m_lstAdopted), end(m_lstAdopted), [&](const SOCKET_ENTRY& stEntry) { return stEntry.strIpAddr == strIpAddr; });
+            if (bDelAdd == true && itAdopted != end(m_lstAdopted))
+                ;   // we have the socket of the previous process
+            else if (bDelAdd == true)    // and the address is new
             {
-                pair<map<UdpSocket*, SOCKET_ENTRY>::iterator, bool>paRet = m_maSockets.emplace(new UdpSocket(), SOCKET_ENTRY({ adrFamily, strIpAddr, nInterfaceIndex }));
+                UdpSocket* pUdpSocket = new UdpSocket();
+                pair<map<UdpSocket*, SOCKET_ENTRY>::iterator, bool>paRet = m_maSockets.emplace(pUdpSocket, SOCKET_ENTRY({ adrFamily, strIpAddr, nInterfaceIndex, pUdpSocket, -1 }));
                 if (paRet.second == true)
                 {
                     paRet.first->first->BindErrorFunction([&](BaseSocket* pBaseSocket) { SocketError(pBaseSocket); });
@@ -409,6 +1081,11 @@ public:
                         wcout << L"Error creating Socket: " << strIpAddr.c_str() << endl;
                 }
             }
+            else if (itAdopted != end(m_lstAdopted))
+            {
+                ::closesocket(itAdopted->fdSocket);
+                m_lstAdopted.erase(itAdopted);
+            }
             else // IP is removed, close the socket how is listing on it
             {
                 for (auto itFound : m_maSockets)
@@ -427,12 +1104,389 @@ public:
 
     void Stop()
     {
+        if (m_pHotRestart != nullptr)
+            m_pHotRestart->Stop();
+        if (m_pLeaseQuery != nullptr)
+            m_pLeaseQuery->Stop();
+        if (m_pProbe != nullptr)
+            m_pProbe->Stop();
+        m_IngressQueue.Stop();
+        if (m_thWorker.joinable() == true)
+            m_thWorker.join();
+
+        {
+            lock_guard<mutex> lock(m_mtxHousekeeping);
+            m_bStop = true;
+        }
+        m_cvHousekeeping.notify_all();
+        if (m_thHousekeeping.joinable() == true)
+            m_thHousekeeping.join();
+
+        if (m_pDdns != nullptr)
+            m_pDdns->Stop();
+
+        if (m_pHistory != nullptr)
+            m_pHistory->Stop();     // writes the last block
+
+        if (m_pLeaseView != nullptr)
+            m_pLeaseView->Stop();
+
+        if (m_pPeer != nullptr)
+            m_pPeer->Stop();
+
+        CloseSockets();
+
+        if (m_pRecorder != nullptr)
+            m_pRecorder->Stop();
+    }
+
+    void CloseSockets()
+    {
+        m_bStopAdopted = true;
+        if (m_thAdopted.joinable() == true)
+            m_thAdopted.join();
+
+        lock_guard<mutex> lock(m_mtxSockets);
         while (m_maSockets.size())
         {
             m_maSockets.begin()->first->Close();
             delete m_maSockets.begin()->first;
             m_maSockets.erase(m_maSockets.begin());
         }
+        for (const auto& stEntry : m_lstAdopted)
+            ::closesocket(stEntry.fdSocket);
+        m_lstAdopted.clear();
+    }
+
+    bool IsHandedOver() const
+    {
+        return m_pHotRestart != nullptr && m_pHotRestart->IsHandedOver() == true;
+    }
+
+    // New process: take the sockets and the leases from the running server
+    bool TakeOver()
+    {
+        if (m_strHotRestart.empty() == true)
+        {
+            wcout << L"Error: no Path in section HotRestart" << endl;
+            return false;
+        }
+
+        const auto tStart = chrono::steady_clock::now();
+        const bool bReturn = HotRestart::TakeOver(m_strHotRestart, [&](HotRestart::SOCKETLIST& vSockets, vector<uint8_t>& vLeases)
+        {
+            ImportLeases(vLeases);
+
+            lock_guard<mutex> lock(m_mtxSockets);
+            for (const auto& itSocket : vSockets)
+                m_lstAdopted.push_back(SOCKET_ENTRY({ AF_INET, itSocket.second, 0, nullptr, itSocket.first }));
+            m_bStopAdopted = false;
+            m_thAdopted = thread(&DhcpServer::AdoptedThread, this);
+        }, [&](const string& strIpAddr, vector<uint8_t>& vData)
+        {   // the packets the old process had not processed
+            lock_guard<mutex> lock(m_mtxSockets);
+            const auto itAdopted = find_if(begin(m_lstAdopted), end(m_lstAdopted), [&](const SOCKET_ENTRY& stEntry) { return stEntry.strIpAddr == strIpAddr; });
+            PACKETPEEK stPeek;
+            if (itAdopted != end(m_lstAdopted) && PeekPacket(vData.data(), vData.size(), stPeek) == true)
+                m_IngressQueue.Push(IngressQueue::ITEM({ &*itAdopted, stPeek, move(vData) }));
+        });
+
+        if (bReturn == true)
+            wcout << L"Takeover of " << m_lstAdopted.size() << L" sockets and " << m_maIpLeases.size() << L" leases in " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - tStart).count() << L" ms" << endl;
+        return bReturn;
+    }
+
+    // Old process: no more packets are processed, the new process gets the sockets and the leases
+    void FreezeForHandOver(HotRestart::SOCKETLIST& vSockets, vector<uint8_t>& vLeases)
+    {
+        m_bFrozen = true;
+
+        // The new process writes the lease view and the history, two writers would mix them up. Stopped
+        // before the locks are taken, the publish thread of the view locks the leases
+        if (m_pHistory != nullptr)
+            m_pHistory->Stop();     // writes the last block
+        if (m_pLeaseView != nullptr)
+            m_pLeaseView->Stop();
+
+        lock_guard<mutex> lock(m_mtxSockets);   // the worker has finished its packet
+        for (const auto& itSocket : m_maSockets)
+        {
+            const int fdSocket = HotRestart::FindBoundSocket(itSocket.second.strIpAddr, 67);
+            if (fdSocket >= 0)
+                vSockets.emplace_back(fdSocket, itSocket.second.strIpAddr);
+        }
+        for (const auto& stEntry : m_lstAdopted)
+            vSockets.emplace_back(stEntry.fdSocket, stEntry.strIpAddr);
+
+        lock_guard<mutex> lockLeases(m_mtxLeases);
+        ExportLeases(vLeases);
+    }
+
+    void ResumeAfterHandOver()
+    {
+        {
+            lock_guard<mutex> lock(m_mtxLeases);    // LeaseChanged of the housekeeping uses both
+            if (m_pHistory != nullptr && m_pHistory->Start() == false)
+                m_pHistory.reset();
+            if (m_pLeaseView != nullptr && m_pLeaseView->Start([&](vector<LeaseView::SLOT>& vSlots, vector<LeaseView::POOL>& vPools) { LeaseViewSnapshot(vSlots, vPools); }) == false)
+                m_pLeaseView.reset();
+            if (m_pLeaseView != nullptr)
+                m_pLeaseView->Changed();
+        }
+
+        m_bFrozen = false;
+        lock_guard<mutex> lock(m_mtxHandOver);
+        for (auto& stItem : m_vHandOver)
+            m_IngressQueue.Push(move(stItem));
+        m_vHandOver.clear();
+    }
+
+    void FinishHandOver(HotRestart::PACKETLIST& vPackets)
+    {
+        map<const void*, string> maSocketIp;
+        {
+            lock_guard<mutex> lock(m_mtxSockets);
+            for (const auto& itSocket : m_maSockets)
+                maSocketIp[itSocket.first] = itSocket.second.strIpAddr;
+            for (const auto& stEntry : m_lstAdopted)
+                maSocketIp[&stEntry] = stEntry.strIpAddr;
+        }
+
+        // our copies of the sockets are closed, the new process keeps them open
+        if (m_pPeer != nullptr)
+            m_pPeer->Stop();    // the new process needs the port
+        if (m_pLeaseQuery != nullptr)
+            m_pLeaseQuery->Stop();
+        CloseSockets();
+
+        vector<IngressQueue::ITEM> vItems;
+        m_IngressQueue.Drain(vItems);
+        m_IngressQueue.Stop();
+        if (m_thWorker.joinable() == true)
+            m_thWorker.join();
+
+        lock_guard<mutex> lock(m_mtxHandOver);
+        m_vHandOver.insert(end(m_vHandOver), make_move_iterator(begin(vItems)), make_move_iterator(end(vItems)));
+        for (auto& stItem : m_vHandOver)
+        {
+            const auto itIp = maSocketIp.find(stItem.pSocket);
+            if (itIp != end(maSocketIp))
+                vPackets.emplace_back(itIp->second, move(stItem.vData));
+        }
+        m_vHandOver.clear();
+    }
+
+    // true if the address is blocked in a scope or class, or reserved for an other client than nHwKey
+    bool IsExcludedIp(const string& strIpAddr, uint64_t nHwKey)
+    {
+        for (const auto& itConfig : m_maConfig)
+        {
+            if (find(begin(itConfig.second.vstrIP_Blocked), end(itConfig.second.vstrIP_Blocked), strIpAddr) != end(itConfig.second.vstrIP_Blocked))
+                return true;
+            if (itConfig.second.tabHwAddr.IsReservedIp(strIpAddr) == true)
+            {
+                const HwAddrTable::RESERVATION* pReserv = itConfig.second.tabHwAddr.GetReservation(nHwKey);
+                if (pReserv == nullptr || pReserv->strIP != strIpAddr)
+                    return true;
+            }
+            const auto itClasses = m_maClasses.find(itConfig.first);
+            for (size_t n = 0; itClasses != end(m_maClasses) && n < itClasses->second.size(); ++n)
+            {
+                if (find(begin(itClasses->second[n].vstrIP_Blocked), end(itClasses->second[n].vstrIP_Blocked), strIpAddr) != end(itClasses->second[n].vstrIP_Blocked))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // Leases of an other server, ISC dhcpd.leases or CSV in the format of DhcpServ.ini. A later record of an address replaces the older.
+    // An active lease of this server is not replaced by a record of an other client, blocked and reserved addresses are not imported.
+    // Only with the server stopped: the leases reach DhcpServ.ini when this object ends, a running server would overwrite them
+    // when it ends. For the same reason m_mtxLeases is held for the whole file, a running server would wait that long.
+    bool ImportLeaseFile(const string& strFile, LeaseImport::FORMAT nFormat)
+    {
+        if ((m_strHotRestart.empty() == false && HotRestart::IsRunning(m_strHotRestart) == true)
+            || (m_pLeaseView != nullptr && LeaseView::WriterPid(m_pLeaseView->Name()) != 0))
+        {
+            wcout << L"Error: the server is running, stop it before the import" << endl;
+            return false;
+        }
+
+        size_t nRecords = 0, nErrors = 0, nImported = 0, nOutside = 0, nExcluded = 0, nReplaced = 0, nConflicts = 0;
+        map<uint32_t, pair<array<uint8_t, 16>, bool>> maIpOwner;   // address, client, true = from the file
+        const int64_t tNow = chrono::system_clock::to_time_t(chrono::system_clock::now());
+        const auto tStart = chrono::steady_clock::now();
+
+        lock_guard<mutex> lock(m_mtxLeases);
+        for (const auto& iter : m_maIpLeases)
+        {
+            uint32_t nIpAddr = 0;
+            if (::inet_pton(AF_INET, iter.second.strIP.c_str(), &nIpAddr) == 1)
+                maIpOwner[nIpAddr] = make_pair(iter.first, false);
+        }
+
+        const bool bReturn = LeaseImport::Parse(strFile, nFormat, [&](const LeaseImport::RECORD& stRecord)
+        {
+            char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 };
+            const string strIp = inet_ntop(AF_INET, &stRecord.nIpAddr, caAddrBuf, sizeof(caAddrBuf));
+            if (ScopeOf(strIp) == 0)
+            {   // the address is not in a pool of our scopes
+                ++nOutside;
+                return;
+            }
+
+            array<uint8_t, 16> arHwAddr = { { 0 } };
+            copy(stRecord.arHwAddr, stRecord.arHwAddr + stRecord.nHwAddrLen, begin(arHwAddr));
+            if (IsExcludedIp(strIp, HwAddrTable::MakeKey(arHwAddr.data())) == true)
+            {
+                ++nExcluded;
+                return;
+            }
+
+            auto itOwner = maIpOwner.find(stRecord.nIpAddr);
+            if (itOwner != end(maIpOwner) && itOwner->second.first != arHwAddr)
+            {   // the address has now an other client
+                const auto itOld = m_maIpLeases.find(itOwner->second.first);
+                if (itOld != end(m_maIpLeases) && itOld->second.strIP == strIp)
+                {
+                    if (itOwner->second.second == false && itOld->second.nFlag == IP_LEASE)
+                    {   // the client has the address from us
+                        ++nConflicts;
+                        return;
+                    }
+                    m_maIpLeases.erase(itOld);
+                    ++nReplaced;
+                }
+            }
+            maIpOwner[stRecord.nIpAddr] = make_pair(arHwAddr, true);
+
+            auto itIp = m_maIpLeases.find(arHwAddr);
+            uint32_t nOldIp = 0;
+            if (itIp != end(m_maIpLeases) && itIp->second.strIP != strIp && ::inet_pton(AF_INET, itIp->second.strIP.c_str(), &nOldIp) == 1)
+            {   // the client had an other address before, if nobody else has it now it is free
+                itOwner = maIpOwner.find(nOldIp);
+                if (itOwner == end(maIpOwner) || itOwner->second.first == arHwAddr)
+                {
+                    ReleaseIp(itIp->second.strIP);
+                    maIpOwner.erase(nOldIp);
+                }
+            }
+
+            IP_ENTRY stEntry;
+            stEntry.strClientId = string(reinterpret_cast<const char*>(stRecord.arClientId), stRecord.nClientIdLen);
+            stEntry.strIP = strIp;
+            stEntry.nFlag = stRecord.nFlag == IP_LEASE && stRecord.tEnd > 0 && stRecord.tEnd < tNow ? IP_RELEASE : static_cast<IP_FLAGS>(stRecord.nFlag);
+            stEntry.tLeaseTime = chrono::system_clock::from_time_t(static_cast<time_t>(stRecord.tStart > 0 ? stRecord.tStart : tNow));
+            stEntry.strHostName = string(stRecord.pHostName != nullptr ? stRecord.pHostName : "", stRecord.nHostNameLen);
+            stEntry.nLeaseTime = stRecord.tEnd == -1 ? UINT32_MAX : stRecord.tEnd > stRecord.tStart && stRecord.tStart > 0 ? static_cast<uint32_t>(min<int64_t>(stRecord.tEnd - stRecord.tStart, UINT32_MAX)) : 0;
+            MarkIpUsed(strIp, stEntry.nFlag == IP_RELEASE);
+            m_maIpLeases[arHwAddr] = move(stEntry);
+            ++nImported;
+        }, nRecords, nErrors);
+
+        if (bReturn == false)
+        {
+            wcout << L"Error opening " << strFile.c_str() << endl;
+            return false;
+        }
+        const auto nMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - tStart).count();
+        wcout << nRecords << L" records in " << nMs << L" ms, imported: " << nImported << L", outside of the scopes: " << nOutside << L", blocked or reserved: " << nExcluded
+            << L", replaced: " << nReplaced << L", conflicts with active leases: " << nConflicts << L", invalid: " << nErrors << endl;
+        return true;
+    }
+
+    // chaddr(16) flag(4) time(8) lease time(4) client id(1+n) ip(1+n) host name(1+n) remote id(1+n) relay id(1+n)
+    void ExportLeases(vector<uint8_t>& vLeases)
+    {
+        auto fnPut = [&](uint64_t nValue, int nBytes) { for (int n = nBytes - 1; n >= 0; --n) vLeases.push_back(static_cast<uint8_t>(nValue >> (n * 8))); };
+        auto fnPutString = [&](const string& strValue) { fnPut(min<size_t>(strValue.size(), 255), 1); vLeases.insert(end(vLeases), begin(strValue), begin(strValue) + min<size_t>(strValue.size(), 255)); };
+
+        for (const auto& iter : m_maIpLeases)
+        {
+            vLeases.insert(end(vLeases), begin(iter.first), end(iter.first));
+            fnPut(iter.second.nFlag, 4);
+            fnPut(static_cast<uint64_t>(chrono::system_clock::to_time_t(iter.second.tLeaseTime)), 8);
+            fnPut(iter.second.nLeaseTime, 4);
+            fnPutString(iter.second.strClientId);
+            fnPutString(iter.second.strIP);
+            fnPutString(iter.second.strHostName);
+            fnPutString(iter.second.strRemoteId);
+            fnPutString(iter.second.strRelayId);
+        }
+    }
+
+    void ImportLeases(const vector<uint8_t>& vLeases)
+    {
+        lock_guard<mutex> lock(m_mtxLeases);
+        for (const auto& iter : m_maIpLeases)   // the leases of DhcpServ.ini are older
+            ReleaseIp(iter.second.strIP);
+        m_maIpLeases.clear();
+
+        const uint8_t* pPos = vLeases.data();
+        const uint8_t* pEnd = pPos + vLeases.size();
+        auto fnGet = [&](int nBytes) -> uint64_t { uint64_t nValue = 0; for (int n = 0; n < nBytes; ++n) nValue = (nValue << 8) | *pPos++; return nValue; };
+        auto fnGetString = [&](string& strValue) -> bool
+        {
+            if (pPos >= pEnd || pPos + 1 + *pPos > pEnd)
+                return false;
+            strValue = string(reinterpret_cast<const char*>(pPos) + 1, *pPos);
+            pPos += 1 + strValue.size();
+            return true;
+        };
+
+        while (pPos + 32 <= pEnd)
+        {
+            array<uint8_t, 16> arHwAddr;
+            copy(pPos, pPos + 16, begin(arHwAddr));
+            pPos += 16;
+            IP_ENTRY stEntry;
+            stEntry.nFlag = static_cast<IP_FLAGS>(fnGet(4));
+            stEntry.tLeaseTime = chrono::system_clock::from_time_t(static_cast<time_t>(fnGet(8)));
+            stEntry.nLeaseTime = static_cast<uint32_t>(fnGet(4));
+            if (fnGetString(stEntry.strClientId) == false || fnGetString(stEntry.strIP) == false || fnGetString(stEntry.strHostName) == false
+                || fnGetString(stEntry.strRemoteId) == false || fnGetString(stEntry.strRelayId) == false)
+                break;
+            MarkIpUsed(stEntry.strIP, stEntry.nFlag == IP_RELEASE);
+            m_maIpLeases.emplace(arHwAddr, move(stEntry));
+        }
+    }
+
+    void PrintStatistics()
+    {
+        wcout << L"Rate limit - passed: " << m_RateLimit.GetPassed() << L", dropped per client: " << m_RateLimit.GetDroppedClient() << L", dropped global: " << m_RateLimit.GetDroppedGlobal() << endl;
+        wcout << L"Reply cache - hits: " << m_ReplyCache.GetHits() << L", misses: " << m_ReplyCache.GetMisses() << endl;
+        const wchar_t* szPrio[IngressQueue::PRIO_COUNT] = { L"bound", L"retry", L"new" };
+        for (int n = 0; n < IngressQueue::PRIO_COUNT; ++n)
+            wcout << L"Queue " << szPrio[n] << L" - depth: " << m_IngressQueue.GetDepth(static_cast<IngressQueue::PRIORITY>(n)) << L", shed: " << m_IngressQueue.GetShed(static_cast<IngressQueue::PRIORITY>(n)) << endl;
+        wcout << L"Parked requests - waiting: " << m_Requests.GetParked() << L", resumed: " << m_Requests.GetResumed() << L", absorbed: " << m_Requests.GetAbsorbed() << L", expired: " << m_Requests.GetExpired() << endl;
+        if (m_pProbe != nullptr)
+            wcout << L"Ping probe - sent: " << m_pProbe->GetSent() << L", in use: " << m_pProbe->GetInUse() << L", cache hits: " << m_pProbe->GetCacheHits() << endl;
+        if (m_pDdns != nullptr)
+            wcout << L"DNS update - sent: " << m_pDdns->GetSent() << L", failed: " << m_pDdns->GetFailed() << L", pending: " << m_pDdns->GetPending() << L", name conflicts: " << m_pDdns->GetConflicts() << endl;
+        {
+            lock_guard<mutex> lock(m_mtxLeases);
+            wcout << L"Renewals per minute (newest first):";
+            for (size_t n = 0; n < m_arRenewals.size(); ++n)
+                wcout << L" " << m_arRenewals[(m_nRenewMinute + m_arRenewals.size() - n) % m_arRenewals.size()];
+            wcout << endl;
+        }
+        if (m_pHistory != nullptr)
+            wcout << L"Lease history - blocks written: " << m_pHistory->GetBlocks() << endl;
+        if (m_pLeaseQuery != nullptr)
+            wcout << L"Leasequery - queries: " << m_pLeaseQuery->GetQueries() << L", leases sent: " << m_pLeaseQuery->GetLeasesSent() << endl;
+        if (m_pRecorder != nullptr)
+            wcout << L"Flight recorder - packets: " << m_pRecorder->GetRecorded() << L", lost: " << m_pRecorder->GetLost() << endl;
+    }
+
+    void DumpFlightRecorder()
+    {
+        if (m_pRecorder == nullptr)
+            return;
+        const int nPackets = m_pRecorder->Dump();
+        if (nPackets < 0)
+            wcout << L"Error writing " << m_pRecorder->GetFile().c_str() << endl;
+        else
+            wcout << nPackets << L" packets written to " << m_pRecorder->GetFile().c_str() << endl;
     }
 
     void SocketError(BaseSocket* pBaseSocket)
@@ -450,21 +1504,170 @@ public:
     {
         size_t nAvalible = pUdpSocket->GetBytesAvailable();
 
-        auto spBuffer = make_unique<unsigned char[]>(nAvalible + 1);
+        vector<uint8_t> vBuffer(nAvalible + 1);
 
         string strFrom;
-        size_t nRead = pUdpSocket->Read(spBuffer.get(), nAvalible, strFrom);
+        size_t nRead = pUdpSocket->Read(vBuffer.data(), nAvalible, strFrom);
+
+        if (m_pRecorder != nullptr)
+            m_pRecorder->Record(FlightRecorder::DIR_IN, vBuffer.data(), nRead, strFrom, string());
+
+        PacketReceived(pUdpSocket, vBuffer, nRead, [&](const uint8_t* pReply, size_t nLen, const string& strAddr)
+        {
+            if (m_pRecorder != nullptr)
+                m_pRecorder->Record(FlightRecorder::DIR_OUT, pReply, nLen, strAddr, string());
+            pUdpSocket->Write(pReply, nLen, strAddr);
+        });
+    }
+
+    void PacketReceived(const void* pSocket, vector<uint8_t>& vBuffer, size_t nRead, const ReplyCache::FN_SEND& fnSend)
+    {
+        // Early drop of floods, only the fixed header is read
+        PACKETPEEK stPeek;
+        if (PeekPacket(vBuffer.data(), nRead, stPeek) == false || stPeek.nOp != DhcpProtokol::BOOTREQUEST)
+            return;
+        if (m_RateLimit.Admit(stPeek.nHwKey) == false)
+            return;
+
+        // A retransmission of the client gets the same answer again
+        if (m_ReplyCache.Replay(stPeek.nHwKey, stPeek.nXid, stPeek.nMsgType, pSocket, fnSend) == true)
+            return;
+
+        // The worker thread processes the packets, clients with a lease first
+        vBuffer.resize(nRead);
+        m_IngressQueue.Push(IngressQueue::ITEM({ pSocket, stPeek, move(vBuffer) }));
+    }
+
+    // The SocketLib sockets are identified by their pointer, the sockets of a hot restart by their entry
+    const SOCKET_ENTRY* FindSocket(const void* pSocket) const
+    {
+        for (const auto& itSocket : m_maSockets)
+        {
+            if (itSocket.first == pSocket)
+                return &itSocket.second;
+        }
+        for (const auto& stEntry : m_lstAdopted)
+        {
+            if (&stEntry == pSocket)
+                return &stEntry;
+        }
+        return nullptr;
+    }
+
+    void SendTo(const SOCKET_ENTRY& stSocket, const uint8_t* pData, size_t nLen, const string& strAddr)
+    {
+        if (m_pRecorder != nullptr)
+            m_pRecorder->Record(FlightRecorder::DIR_OUT, pData, nLen, strAddr, stSocket.strIpAddr);
+
+        if (stSocket.pUdpSocket != nullptr)
+        {
+            stSocket.pUdpSocket->Write(pData, nLen, strAddr);
+            return;
+        }
+#if !defined(_WIN32) && !defined(_WIN64)
+        struct sockaddr_in addr = { 0 };
+        addr.sin_family = AF_INET;
+        const size_t nColon = strAddr.find(':');
+        addr.sin_port = htons(nColon != string::npos ? static_cast<uint16_t>(stoi(strAddr.substr(nColon + 1))) : 68);
+        if (::inet_pton(AF_INET, strAddr.substr(0, nColon).c_str(), &addr.sin_addr) == 1)
+            ::sendto(stSocket.fdSocket, pData, nLen, 0, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+#endif
+    }
+
+    // Receive on the sockets of the previous process, SocketLib can not take a descriptor
+    void AdoptedThread()
+    {
+#if !defined(_WIN32) && !defined(_WIN64)
+        vector<uint8_t> vBuffer;
+        while (m_bStopAdopted == false)
+        {
+            vector<struct pollfd> vPoll;
+            vector<const SOCKET_ENTRY*> vEntries;
+            {
+                lock_guard<mutex> lock(m_mtxSockets);
+                for (const auto& stEntry : m_lstAdopted)
+                {
+                    vPoll.push_back({ stEntry.fdSocket, POLLIN, 0 });
+                    vEntries.push_back(&stEntry);
+                }
+            }
+            if (::poll(vPoll.data(), vPoll.size(), 100) <= 0)
+                continue;
+
+            for (size_t n = 0; n < vPoll.size(); ++n)
+            {
+                if ((vPoll[n].revents & POLLIN) == 0)
+                    continue;
+                vBuffer.resize(4096);
+                const ssize_t nRead = ::recv(vPoll[n].fd, vBuffer.data(), vBuffer.size(), MSG_DONTWAIT);
+                if (nRead <= 0)
+                    continue;
+                const int fdSocket = vPoll[n].fd;
+                if (m_pRecorder != nullptr)
+                    m_pRecorder->Record(FlightRecorder::DIR_IN, vBuffer.data(), static_cast<size_t>(nRead), string(), vEntries[n]->strIpAddr);
+                PacketReceived(vEntries[n], vBuffer, static_cast<size_t>(nRead), [&](const uint8_t* pReply, size_t nLen, const string& strAddr)
+                {
+                    lock_guard<mutex> lock(m_mtxSockets);
+                    const SOCKET_ENTRY* pEntry = FindSocket(vEntries[n]);
+                    if (pEntry != nullptr && pEntry->fdSocket == fdSocket)
+                        SendTo(*pEntry, pReply, nLen, strAddr);
+                });
+            }
+        }
+#endif
+    }
+
+    // Threads and the lease table
+    // - The socket callbacks (SocketLib, AdoptedThread) only read the fixed header, limit the rate, answer
+    //   retransmissions from the reply cache and queue the packet. They never use m_maIpLeases.
+    // - The worker thread is the only one that processes requests, it is the event loop of the server.
+    //   Nothing in ProcessPacket waits: a step that has to wait (the ping) parks the request in m_Requests
+    //   and returns, the completion puts it into the queue again and the worker continues it.
+    // - m_maIpLeases and the pools are only used with m_mtxLeases held: by the worker, the housekeeping,
+    //   the peer updates, the snapshots of leasequery and lease view, the import and the hot restart.
+    // - Completions and callbacks of the other parts (ping, DNS update, peer, leasequery) come on their
+    //   own threads. A completion only resumes the request, the lease is changed by the worker.
+    // - LeaseChanged is called with m_mtxLeases held. DNS update, history, lease view and peer only
+    //   queue the change there, they never call back into the server from it.
+    // - Lock order: m_mtxSockets (held by the worker while it processes a packet), then m_mtxLeases, then the
+    //   stripe locks of m_ReplyCache (Store, Invalidate). ReplyCache::Replay calls its send function without
+    //   its lock, the send on an adopted socket takes m_mtxSockets.
+    void WorkerThread()
+    {
+        IngressQueue::ITEM stItem;
+        while (m_IngressQueue.Pop(stItem) == true)
+        {
+            lock_guard<mutex> lock(m_mtxSockets);   // the socket is not deleted while we use it
+            if (m_bFrozen == true)
+            {   // a new process takes over, it gets the packet
+                lock_guard<mutex> lockHandOver(m_mtxHandOver);
+                m_vHandOver.push_back(move(stItem));
+                continue;
+            }
+            // a retransmission of the client while its request waits
+            if (stItem.nStep == RequestTable::STEP_RECEIVED && m_Requests.Absorb(stItem.stPeek) == true)
+                continue;
+            ProcessPacket(stItem);
+        }
+    }
+
+    void ProcessPacket(IngressQueue::ITEM& stItem)
+    {
+        const void* pSocket = stItem.pSocket;
+        uint8_t* pData = stItem.vData.data();
+        const size_t nRead = stItem.vData.size();
+        const PACKETPEEK& stPeek = stItem.stPeek;
 
         if (nRead > 0)
         {
-            DhcpProtokol dhcpProto(spBuffer.get(), nRead);
+            DhcpProtokol dhcpProto(pData, nRead);
 
             if (dhcpProto.m_DhcpHeader.htype == 1 && dhcpProto.m_DhcpHeader.hlen == 6)   // ethernet = 1 , MAC address 6 byt long
             {
                 wstringstream ss;
-                auto itSocket = m_maSockets.find(pUdpSocket);
-                if (itSocket != end(m_maSockets))
-                    ss << setfill(L' ') << std::left << setw(15) << itSocket->second.strIpAddr.c_str() << L" - ";
+                const SOCKET_ENTRY* pSocketEntry = FindSocket(pSocket);
+                if (pSocketEntry != nullptr)
+                    ss << setfill(L' ') << std::left << setw(15) << pSocketEntry->strIpAddr.c_str() << L" - ";
 
                 ss << setfill(L'0') << std::right << hex << setw(2) << dhcpProto.m_DhcpHeader.chaddr[0];
                 for (uint8_t i = 1; i < dhcpProto.m_DhcpHeader.hlen; ++i)
@@ -485,12 +1688,29 @@ public:
                 ss << L"\r\n";
                 OutputDebugString(ss.str().c_str());
 
-                if (itSocket != end(m_maSockets))
+                if (pSocketEntry != nullptr)
                 {
-                    auto itConfig = m_maConfig.find(itSocket->second.strIpAddr);
+                    auto itConfig = m_maConfig.find(pSocketEntry->strIpAddr);
 
                     if (itConfig != end(m_maConfig))
                     {
+                        lock_guard<mutex> lock(m_mtxLeases);
+
+                        // construct our hardware address variable
+                        array<uint8_t, 16> arHwAddr({ to_array(dhcpProto.m_DhcpHeader.chaddr) });
+                        const uint64_t nHwKey = HwAddrTable::MakeKey(dhcpProto.m_DhcpHeader.chaddr);
+
+                        // the client class selects the pool and the options
+                        const int nClass = itConfig->second.Classifier.Classify(dhcpProto.m_strCircuitId, dhcpProto.m_strRemoteId, dhcpProto.m_strUserClass, dhcpProto.m_strClassIdent);
+                        const CONFIG& stConfig = nClass >= 0 ? m_maClasses[itConfig->first][nClass] : itConfig->second;
+
+                        // a static reservation overrides the address and the options of the scope
+                        const HwAddrTable::RESERVATION* pReserv = itConfig->second.tabHwAddr.GetReservation(nHwKey);
+                        const string& strRouter_IP = pReserv != nullptr && pReserv->strRouter_IP.empty() == false ? pReserv->strRouter_IP : stConfig.strRouter_IP;
+                        const string& strDNS_IP = pReserv != nullptr && pReserv->strDNS_IP.empty() == false ? pReserv->strDNS_IP : stConfig.strDNS_IP;
+                        const string& strDomainName = pReserv != nullptr && pReserv->strDomainName.empty() == false ? pReserv->strDomainName : stConfig.strDomainName;
+                        const uint32_t nLeaseTime = LeaseTimeFor(stConfig);
+
                         function<uint8_t*(uint8_t*, vector<uint8_t>&)> fnSetOptionFromRequestList = [&](uint8_t* pOptions, vector<uint8_t>& vOptionRequest) -> uint8_t*
                         {
                             for (size_t i = 0; i < vOptionRequest.size(); ++i)
@@ -499,92 +1719,278 @@ public:
                                 {
                                 case 1: // Subnet Mask
                                     //*pOptions++ = 1; *pOptions++ = 4; *((long*)pOptions) = ::inet_addr(itConfig->second.strSubnet.c_str()); pOptions += 4;
-                                    *pOptions++ = 1; *pOptions++ = 4; ::inet_pton(AF_INET, itConfig->second.strSubnet.c_str(), (long*)pOptions); pOptions += 4;
+                                    *pOptions++ = 1; *pOptions++ = 4; ::inet_pton(AF_INET, stConfig.strSubnet.c_str(), (long*)pOptions); pOptions += 4;
+                                    break;
+                                case 66:// TFTP Server Name
+                                    if (stConfig.strNextServer.empty() == false)
+                                    {
+                                        *pOptions++ = 66; *pOptions++ = static_cast<uint8_t>(stConfig.strNextServer.size());  memcpy(pOptions, stConfig.strNextServer.c_str(), stConfig.strNextServer.size()); pOptions += stConfig.strNextServer.size();
+                                    }
+                                    break;
+                                case 67:// Bootfile Name
+                                    if (stConfig.strBootFile.empty() == false)
+                                    {
+                                        *pOptions++ = 67; *pOptions++ = static_cast<uint8_t>(stConfig.strBootFile.size());  memcpy(pOptions, stConfig.strBootFile.c_str(), stConfig.strBootFile.size()); pOptions += stConfig.strBootFile.size();
+                                    }
                                     break;
                                 case 15:// Domain Name
-                                    *pOptions++ = 15; *pOptions++ = static_cast<uint8_t>(itConfig->second.strDomainName.size());  memcpy(pOptions, &itConfig->second.strDomainName[0], 15); pOptions += itConfig->second.strDomainName.size();
+                                    *pOptions++ = 15; *pOptions++ = static_cast<uint8_t>(strDomainName.size());  memcpy(pOptions, strDomainName.c_str(), strDomainName.size()); pOptions += strDomainName.size();
                                     break;
                                 case 3: // Router
                                     //*pOptions++ = 3; *pOptions++ = 4;  *((long*)pOptions) = ::inet_addr(itConfig->second.strRouter_IP.c_str()); pOptions += 4;
-                                    *pOptions++ = 3; *pOptions++ = 4;  ::inet_pton(AF_INET, itConfig->second.strRouter_IP.c_str(), (long*)pOptions); pOptions += 4;
+                                    *pOptions++ = 3; *pOptions++ = 4;  ::inet_pton(AF_INET, strRouter_IP.c_str(), (long*)pOptions); pOptions += 4;
                                     break;
                                 case 6: // Domain Name Server (DNS)
                                     //*pOptions++ = 6; *pOptions++ = 4;  *((long*)pOptions) = ::inet_addr(itConfig->second.strDNS_IP.c_str()); pOptions += 4;
-                                    *pOptions++ = 6; *pOptions++ = 4;  ::inet_pton(AF_INET, itConfig->second.strDNS_IP.c_str(), (long*)pOptions); pOptions += 4;
+                                    *pOptions++ = 6; *pOptions++ = 4;  ::inet_pton(AF_INET, strDNS_IP.c_str(), (long*)pOptions); pOptions += 4;
                                     break;
                                 }
                             }
                             return pOptions;
                         };
 
-                        // IP pool for now
-                        static uint8_t nextIp = 100;
-
-                        // construct our hardware address variable
-                        array<uint8_t, 16> arHwAddr({ to_array(dhcpProto.m_DhcpHeader.chaddr) });
-                        stringstream ssHw;
-                        for (uint8_t n = 0; n < dhcpProto.m_DhcpHeader.hlen; ++n)
-                            ssHw << (n > 0 ? ":" : "") << setfill('0') << hex << setw(2) << dhcpProto.m_DhcpHeader.chaddr[n];
+                        // In peer mode the partner answers the clients of the other hash buckets (RFC 3074), unless the client selected us
+                        bool bOurClient = true;
+                        if (m_pPeer != nullptr && dhcpProto.m_strServerIdent.empty() == true && (dhcpProto.m_cDhcpType == DhcpProtokol::DHCPDISCOVER || dhcpProto.m_cDhcpType == DhcpProtokol::DHCPREQUEST))
+                        {
+                            const uint8_t nBucket = dhcpProto.m_strClientIdent.empty() == false ? PeerLink::HashBucket(reinterpret_cast<const uint8_t*>(dhcpProto.m_strClientIdent.data()), dhcpProto.m_strClientIdent.size()) : PeerLink::HashBucket(dhcpProto.m_DhcpHeader.chaddr, dhcpProto.m_DhcpHeader.hlen);
+                            bOurClient = m_pPeer->IsResponsible(nBucket);
+                        }
 
-                        if (find_if(begin(itConfig->second.vstrHW_Blocked), end(itConfig->second.vstrHW_Blocked), [&](auto& strHwAddr) { return strHwAddr == ssHw.str() ? true : false; }) == end(itConfig->second.vstrHW_Blocked))
+                        if (itConfig->second.tabHwAddr.IsBlocked(nHwKey) == false && bOurClient == true)
                         {
                             // look if we have the hardware address allready in our pool with asigned addresses
                             auto itIp = m_maIpLeases.find(arHwAddr);
                             if (itIp != end(m_maIpLeases) && itIp->second.nFlag == IP_DECLINE)
                                 itIp = end(m_maIpLeases);
+                            // a lease with a different address than the reservation, or outside the pool of the client class is given up
+                            if (itIp != end(m_maIpLeases) && dhcpProto.m_cDhcpType == DhcpProtokol::DHCPDISCOVER
+                                && (pReserv != nullptr ? itIp->second.strIP != pReserv->strIP : stConfig.spPool != nullptr && stConfig.spPool->Contains(itIp->second.strIP) == false))
+                            {
+                                ReleaseIp(itIp->second.strIP);
+                                LeaseChanged(itIp->first, itIp->second, true);
+                                m_maIpLeases.erase(itIp);
+                                itIp = end(m_maIpLeases);
+                            }
 
-                            // Last Dot from the interface IP the request came in (used later)
-                            size_t nPos = itSocket->second.strIpAddr.find_last_of(".");
+                            // The reserved address, or the next free address of the pool
+                            auto fnNextIp = [&](string& strIp) -> bool
+                            {
+                                if (pReserv != nullptr)
+                                {
+                                    strIp = pReserv->strIP;
+                                    return true;
+                                }
+                                size_t nPart = 0, nParts = 1;
+                                if (m_pPeer != nullptr)
+                                    m_pPeer->GetPoolShare(nPart, nParts);
+                                bool bReused = false;
+                                if (stConfig.spPool == nullptr || stConfig.spPool->Allocate(strIp, nPart, nParts, &bReused) == false)
+                                    return false;
+                                if (bReused == true)
+                                {   // no free address left, the released lease of an other client is given up
+                                    MarkIpUsed(strIp);
+                                    for (auto itOld = begin(m_maIpLeases); itOld != end(m_maIpLeases); ++itOld)
+                                    {
+                                        if (itOld->second.nFlag == IP_RELEASE && itOld->second.strIP == strIp && itOld->first != arHwAddr)
+                                        {
+                                            LeaseChanged(itOld->first, itOld->second, true);
+                                            m_maIpLeases.erase(itOld);
+                                            break;
+                                        }
+                                    }
+                                }
+                                return true;
+                            };
+
+                            // A released lease is offered again to its client, if nobody else got the address in the meantime
+                            if (itIp != end(m_maIpLeases) && itIp->second.nFlag == IP_RELEASE && (dhcpProto.m_cDhcpType == DhcpProtokol::DHCPDISCOVER || dhcpProto.m_cDhcpType == DhcpProtokol::DHCPREQUEST))
+                            {
+                                if (ReclaimIp(itIp->second.strIP) == true)
+                                {
+                                    itIp->second.nFlag = IP_OFFERT;
+                                    LeaseChanged(itIp->first, itIp->second);
+                                }
+                                else
+                                {
+                                    LeaseChanged(itIp->first, itIp->second, true);
+                                    m_maIpLeases.erase(itIp);
+                                    itIp = end(m_maIpLeases);
+                                }
+                            }
 
                             // make a buffer for the respons
                             unique_ptr<uint8_t[]> pBuffer = make_unique<uint8_t[]>(500);
                             DhcpProtokol::DHCPHEADER& DhcpHeader = reinterpret_cast<DhcpProtokol::DHCPHEADER&>(*pBuffer.get());
                             uint8_t* pOptions = pBuffer.get() + sizeof(DhcpProtokol::DHCPHEADER);
 
+                            // send the reply and keep it for retransmissions of the client. pOptions is behind the end option.
+                            // A relayed request is answered to the relay (RFC 2131, 4.1) with its option 82 as the last option (RFC 3046, 2.2)
+                            auto fnSendReply = [&](size_t iLen, const string& strAddr)
+                            {
+                                string strSendTo = strAddr;
+                                if (dhcpProto.m_DhcpHeader.giaddr != 0)
+                                {
+                                    char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 };
+                                    strSendTo = inet_ntop(AF_INET, &dhcpProto.m_DhcpHeader.giaddr, caAddrBuf, sizeof(caAddrBuf)) + string(":67");
+                                    const string& strInfo = dhcpProto.m_strRelayInfo;
+                                    if (strInfo.empty() == false && pOptions[-1] == 255 && pOptions + 1 + strInfo.size() < pBuffer.get() + 500)
+                                    {
+                                        pOptions[-1] = 82;
+                                        *pOptions++ = static_cast<uint8_t>(strInfo.size());
+                                        pOptions = copy(begin(strInfo), end(strInfo), pOptions);
+                                        *pOptions++ = 255;
+                                        iLen = max<size_t>(iLen, pOptions - pBuffer.get());
+                                    }
+                                }
+                                SendTo(*pSocketEntry, pBuffer.get(), iLen, strSendTo);
+                                m_ReplyCache.Store(stPeek.nHwKey, stPeek.nXid, stPeek.nMsgType, pSocket, pBuffer.get(), iLen, strSendTo);
+                            };
+
+                            // The lease is given to the client: DHCPREQUEST, or DHCPDISCOVER with rapid commit
+                            auto fnCommitLease = [&]()
+                            {
+                                // The name in the DNS: option 81, or option 12 in the domain of the scope. With the N flag the client wants no update from us
+                                if (m_pDdns != nullptr)
+                                {
+                                    const string strFqdn = dhcpProto.m_nFqdnFlags >= 0 && (dhcpProto.m_nFqdnFlags & 0x08) != 0 ? string() : DdnsUpdater::MakeFqdn(dhcpProto.m_strFqdn.empty() == false ? dhcpProto.m_strFqdn : dhcpProto.m_strHostName, strDomainName);
+                                    if (itIp->second.strHostName.empty() == false && itIp->second.strHostName != strFqdn)
+                                        m_pDdns->Unregister(itIp->second.strHostName, itIp->second.strIP, itIp->second.strClientId, itIp->first.data());
+                                    itIp->second.strHostName = strFqdn;
+                                }
+
+                                itIp->second.nFlag = IP_LEASE;
+                                itIp->second.tLeaseTime = chrono::system_clock::now();
+                                itIp->second.nLeaseTime = nLeaseTime;
+                                itIp->second.strRemoteId = dhcpProto.m_strRemoteId;
+                                itIp->second.strRelayId = dhcpProto.m_strRelayId;
+                                LeaseChanged(itIp->first, itIp->second);
+
+                                *pOptions++ = 51; *pOptions++ = 4; *((long*)pOptions) = htonl(nLeaseTime); pOptions += 4;
+                                pOptions = PutRenewTimes(pOptions, nLeaseTime, stConfig.nRenewJitter, nHwKey);
+                                *pOptions++ = 53; *pOptions++ = 1; *pOptions++ = DhcpProtokol::DHCPACK;
+                                if (m_pDdns != nullptr && dhcpProto.m_nFqdnFlags >= 0 && itIp->second.strHostName.size() < 200)
+                                {   // RFC 4702: S = we update the A record, O = we override the wish of the client, E = name in wire format
+                                    uint8_t* pLen = pOptions + 1;
+                                    *pOptions++ = 81; pOptions++;
+                                    *pOptions++ = static_cast<uint8_t>((dhcpProto.m_nFqdnFlags & 0x04) | ((dhcpProto.m_nFqdnFlags & 0x08) != 0 ? 0x08 : (dhcpProto.m_nFqdnFlags & 0x01) == 0 ? 0x03 : 0x01));
+                                    *pOptions++ = 255; *pOptions++ = 255;
+                                    const string& strFqdn = itIp->second.strHostName;
+                                    if ((dhcpProto.m_nFqdnFlags & 0x04) != 0)
+                                    {
+                                        for (size_t nStart = 0, nEnd; nStart < strFqdn.size(); nStart = nEnd + 1)
+                                        {
+                                            nEnd = min(strFqdn.find('.', nStart), strFqdn.size());
+                                            *pOptions++ = static_cast<uint8_t>(nEnd - nStart); memcpy(pOptions, strFqdn.c_str() + nStart, nEnd - nStart); pOptions += nEnd - nStart;
+                                        }
+                                        *pOptions++ = 0;
+                                    }
+                                    else
+                                    {
+                                        memcpy(pOptions, strFqdn.c_str(), strFqdn.size()); pOptions += strFqdn.size();
+                                    }
+                                    *pLen = static_cast<uint8_t>(pOptions - pLen - 1);
+                                }
+                            };
+
                             DhcpHeader.op = DhcpProtokol::BOOTREPLY;
                             DhcpHeader.htype = dhcpProto.m_DhcpHeader.htype;
                             DhcpHeader.hlen = dhcpProto.m_DhcpHeader.hlen;
                             DhcpHeader.xid = dhcpProto.m_DhcpHeader.xid;
                             DhcpHeader.flags = dhcpProto.m_DhcpHeader.flags;
-                            //DhcpHeader.siaddr = ::inet_addr(itSocket->second.strIpAddr.c_str());
-                            ::inet_pton(AF_INET, itSocket->second.strIpAddr.c_str(), &DhcpHeader.siaddr);
+                            //DhcpHeader.siaddr = ::inet_addr(pSocketEntry->strIpAddr.c_str());
+                            ::inet_pton(AF_INET, stConfig.strNextServer.empty() == false ? stConfig.strNextServer.c_str() : pSocketEntry->strIpAddr.c_str(), &DhcpHeader.siaddr);
                             DhcpHeader.giaddr = dhcpProto.m_DhcpHeader.giaddr;
                             copy(dhcpProto.m_DhcpHeader.chaddr, dhcpProto.m_DhcpHeader.chaddr + dhcpProto.m_DhcpHeader.hlen, DhcpHeader.chaddr);
                             memcpy(DhcpHeader.sname, "lap-88", 6);
+                            memcpy(DhcpHeader.file, stConfig.strBootFile.c_str(), min(stConfig.strBootFile.size(), sizeof(DhcpHeader.file) - 1));
                             copy(dhcpProto.m_DhcpHeader.option, dhcpProto.m_DhcpHeader.option + 4, DhcpHeader.option);  // Magic cookie
 
                             // Server Ident send allways as option
-                            //*pOptions++ = 54; *pOptions++ = 4; *((long*)pOptions) = ::inet_addr(itSocket->second.strIpAddr.c_str()); pOptions += 4;
-                            *pOptions++ = 54; *pOptions++ = 4; ::inet_pton(AF_INET, itSocket->second.strIpAddr.c_str(), (long*)pOptions); pOptions += 4;
+                            //*pOptions++ = 54; *pOptions++ = 4; *((long*)pOptions) = ::inet_addr(pSocketEntry->strIpAddr.c_str()); pOptions += 4;
+                            *pOptions++ = 54; *pOptions++ = 4; ::inet_pton(AF_INET, pSocketEntry->strIpAddr.c_str(), (long*)pOptions); pOptions += 4;
 
                             if (dhcpProto.m_cDhcpType == DhcpProtokol::DHCPDISCOVER)
                             {
-                                if (itIp == end(m_maIpLeases))
+                                string strNewIp;
+                                if (itIp == end(m_maIpLeases) && fnNextIp(strNewIp) == true)
                                 {
-                                    auto res = m_maIpLeases.emplace(arHwAddr, IP_ENTRY({ dhcpProto.m_strClientIdent, itSocket->second.strIpAddr.substr(0, nPos + 1) + to_string(nextIp++), IP_OFFERT, chrono::system_clock::now() }));
+                                    auto res = m_maIpLeases.emplace(arHwAddr, IP_ENTRY({ dhcpProto.m_strClientIdent, strNewIp, IP_OFFERT, chrono::system_clock::now() }));
                                     if (res.second == true)
+                                    {
                                         itIp = res.first;
+                                        LeaseChanged(itIp->first, itIp->second);
+                                    }
+                                    else
+                                        ReleaseIp(strNewIp);
+                                }
+
+                                // Ping the address before it is offered. The request is parked until the answer comes, then it is processed again with the result of the ping
+                                while (m_pProbe != nullptr && pReserv == nullptr && itIp != end(m_maIpLeases) && (itIp->second.nFlag == IP_OFFERT || itIp->second.nFlag == IP_RELEASE))
+                                {
+                                    IcmpProbe::RESULT nResult;
+                                    if (stItem.nStep == RequestTable::STEP_PROBE && stItem.strProbeIp == itIp->second.strIP)
+                                    {   // resumed, the address was pinged already
+                                        nResult = stItem.bInUse == true ? IcmpProbe::PROBE_IN_USE : IcmpProbe::PROBE_FREE;
+                                        stItem.nStep = RequestTable::STEP_RECEIVED;
+                                    }
+                                    else
+                                    {
+                                        nResult = m_pProbe->Check(itIp->second.strIP, [this, stPeek](const string& strIpAddr, bool bInUse)
+                                        {
+                                            m_Requests.Resume(stPeek, RequestTable::STEP_PROBE, strIpAddr, bInUse);
+                                        });
+                                    }
+                                    if (nResult != IcmpProbe::PROBE_IN_USE)
+                                    {
+                                        if (nResult == IcmpProbe::PROBE_PENDING)
+                                        {
+                                            m_Requests.Park(IngressQueue::ITEM({ pSocket, stPeek, vector<uint8_t>(pData, pData + nRead), RequestTable::STEP_RECEIVED, string(), false }), RequestTable::STEP_PROBE);
+                                            return;
+                                        }
+                                        break;
+                                    }
+
+                                    // somebody else uses the address, we try the next one
+                                    QuarantineIp(itIp->second.strIP);
+                                    LeaseChanged(itIp->first, itIp->second, true);
+                                    m_maIpLeases.erase(itIp);
+                                    itIp = end(m_maIpLeases);
+                                    if (fnNextIp(strNewIp) == true)
+                                    {
+                                        itIp = m_maIpLeases.emplace(arHwAddr, IP_ENTRY({ dhcpProto.m_strClientIdent, strNewIp, IP_OFFERT, chrono::system_clock::now() })).first;
+                                        LeaseChanged(itIp->first, itIp->second);
+                                    }
                                 }
 
                                 if (itIp != end(m_maIpLeases))
                                 {
                                     //DhcpHeader.yiaddr = ::inet_addr(itIp->second.strIP.c_str());
                                     ::inet_pton(AF_INET, itIp->second.strIP.c_str(), &DhcpHeader.yiaddr);
-                                    *pOptions++ = 51; *pOptions++ = 4; *((long*)pOptions) = htonl(itConfig->second.nLeaseTime); pOptions += 4;
-                                    *pOptions++ = 53; *pOptions++ = 1; *pOptions++ = DhcpProtokol::DHCPOFFER;
+                                    if (dhcpProto.m_bRapidCommit == true && stConfig.bRapidCommit == true)
+                                    {   // two message exchange, the DHCPACK must have option 80
+                                        fnCommitLease();
+                                        *pOptions++ = 80; *pOptions++ = 0;
+                                    }
+                                    else
+                                    {
+                                        *pOptions++ = 51; *pOptions++ = 4; *((long*)pOptions) = htonl(nLeaseTime); pOptions += 4;
+                                        pOptions = PutRenewTimes(pOptions, nLeaseTime, stConfig.nRenewJitter, nHwKey);
+                                        *pOptions++ = 53; *pOptions++ = 1; *pOptions++ = DhcpProtokol::DHCPOFFER;
+                                    }
                                     pOptions = fnSetOptionFromRequestList(pOptions, dhcpProto.m_vOptionRequest);
                                     *pOptions++ = 255;    // End of options
 
                                     size_t iLen = pOptions - pBuffer.get();
                                     if (iLen < 300) iLen = 300;
-                                    pUdpSocket->Write(pBuffer.get(), iLen, "255.255.255.255:68");
+                                    fnSendReply(iLen, "255.255.255.255:68");
                                 }
                             }
                             else if (dhcpProto.m_cDhcpType == DhcpProtokol::DHCPREQUEST)
                             {
                                 uint8_t nMode = 0;
                                 // DHCPREQUEST after DHCPOFFER
-                                if (dhcpProto.m_strServerIdent == itSocket->second.strIpAddr && dhcpProto.m_DhcpHeader.ciaddr == 0 && dhcpProto.m_strRequestIp.empty() == false)
+                                if (dhcpProto.m_strServerIdent == pSocketEntry->strIpAddr && dhcpProto.m_DhcpHeader.ciaddr == 0 && dhcpProto.m_strRequestIp.empty() == false)
                                     nMode = 1;
                                 // during INIT-REBOOT
                                 if (dhcpProto.m_strServerIdent.empty() == true && dhcpProto.m_DhcpHeader.ciaddr == 0 && dhcpProto.m_strRequestIp.empty() == false)
@@ -606,40 +2012,44 @@ public:
 
                                     if (nMode == 1 && itIp != end(m_maIpLeases) && itIp->second.strIP != dhcpProto.m_strRequestIp)
                                     {
+                                        ReleaseIp(itIp->second.strIP);
+                                        LeaseChanged(itIp->first, itIp->second, true);
                                         m_maIpLeases.erase(arHwAddr);
                                         itIp = end(m_maIpLeases);
                                     }
 
-                                    if (nMode == 1 && itIp == end(m_maIpLeases))
+                                    string strNewIp;
+                                    if (nMode == 1 && itIp == end(m_maIpLeases) && fnNextIp(strNewIp) == true)
                                     {
-                                        auto res = m_maIpLeases.emplace(arHwAddr, IP_ENTRY({ dhcpProto.m_strClientIdent, itSocket->second.strIpAddr.substr(0, nPos + 1) + to_string(nextIp++), IP_OFFERT, chrono::system_clock::now() }));
+                                        auto res = m_maIpLeases.emplace(arHwAddr, IP_ENTRY({ dhcpProto.m_strClientIdent, strNewIp, IP_OFFERT, chrono::system_clock::now() }));
                                         if (res.second == true)
                                             itIp = res.first;
+                                        else
+                                            ReleaseIp(strNewIp);
                                     }
 
                                     if (itIp != end(m_maIpLeases))
                                     {
-                                        itIp->second.nFlag = IP_LEASE;
-                                        itIp->second.tLeaseTime = chrono::system_clock::now();
-
                                         DhcpHeader.ciaddr = dhcpProto.m_DhcpHeader.ciaddr;
                                         //DhcpHeader.yiaddr = ::inet_addr(itIp->second.strIP.c_str());
                                         ::inet_pton(AF_INET, itIp->second.strIP.c_str(), &DhcpHeader.yiaddr);
-                                        *pOptions++ = 51; *pOptions++ = 4; *((long*)pOptions) = htonl(itConfig->second.nLeaseTime); pOptions += 4;
-                                        *pOptions++ = 53; *pOptions++ = 1; *pOptions++ = DhcpProtokol::DHCPACK;
+                                        fnCommitLease();
+                                        if (nMode == 3)
+                                            CountRenewal();
                                         pOptions = fnSetOptionFromRequestList(pOptions, dhcpProto.m_vOptionRequest);
                                         *pOptions++ = 255;    // End of options
 
                                         size_t iLen = pOptions - pBuffer.get();
                                         if (iLen < 300) iLen = 300;
-                                        pUdpSocket->Write(pBuffer.get(), iLen, strReturnAddr);
+                                        fnSendReply(iLen, strReturnAddr);
                                     }
                                 }
                             }
-                            else if (dhcpProto.m_strServerIdent == itSocket->second.strIpAddr && dhcpProto.m_cDhcpType == DhcpProtokol::DHCPDECLINE)
+                            else if (dhcpProto.m_strServerIdent == pSocketEntry->strIpAddr && dhcpProto.m_cDhcpType == DhcpProtokol::DHCPDECLINE)
                             {
                                 // No answer will be send to this message
                                 OutputDebugString(L"DhcpProtokol::DHCPDECLINE empfangen\r\n");
+                                m_ReplyCache.Invalidate(nHwKey);
 
                                 // The problem IP is send in the request ip option
                                 if (dhcpProto.m_strRequestIp.empty() == false)
@@ -649,20 +2059,24 @@ public:
                                         if (iter.second.strIP == dhcpProto.m_strRequestIp)
                                         {
                                             iter.second.nFlag = IP_DECLINE;
+                                            LeaseChanged(iter.first, iter.second);
                                             //m_maIpLeases.erase(iter.first);
                                             break;
                                         }
                                     }
                                 }
                             }
-                            else if (dhcpProto.m_strServerIdent == itSocket->second.strIpAddr && dhcpProto.m_cDhcpType == DhcpProtokol::DHCPRELEASE)
+                            else if (dhcpProto.m_strServerIdent == pSocketEntry->strIpAddr && dhcpProto.m_cDhcpType == DhcpProtokol::DHCPRELEASE)
                             {
                                 // No answer will be send to this message
                                 OutputDebugString(L"DhcpProtokol::DHCPRELEASE empfangen\r\n");
-                                if (itIp != end(m_maIpLeases))
+                                m_ReplyCache.Invalidate(nHwKey);
+                                if (itIp != end(m_maIpLeases) && itIp->second.nFlag != IP_RELEASE)
                                 {
                                     itIp->second.nFlag = IP_RELEASE;
                                     itIp->second.tLeaseTime = chrono::system_clock::now();
+                                    MarkIpReleased(itIp->second.strIP);
+                                    LeaseChanged(itIp->first, itIp->second);
                                 }
                             }
                             else if (dhcpProto.m_cDhcpType == DhcpProtokol::DHCPINFORM)
@@ -679,10 +2093,10 @@ public:
                                     //string strReturnAddr = inet_ntoa(*(reinterpret_cast<const struct in_addr*>(&dhcpProto.m_DhcpHeader.ciaddr))) + string(":68");
                                     char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 };
                                     string strReturnAddr = inet_ntop(AF_INET, reinterpret_cast<struct in_addr*>(&dhcpProto.m_DhcpHeader.ciaddr), caAddrBuf, sizeof(caAddrBuf));
-                                    pUdpSocket->Write(pBuffer.get(), iLen, strReturnAddr);
+                                    fnSendReply(iLen, strReturnAddr);
                                 }
                             }
-                        }// find_if HW Address blocked
+                        }// HW Address blocked
                     }// itConfig != end(m_maConfig)
                 }
             }
@@ -694,10 +2108,175 @@ public:
 private:
     wstring                            m_strModulePath;
     map<string, CONFIG>                m_maConfig;
+    map<string, vector<CONFIG>>        m_maClasses;    // client classes of the scope, the index is the result of the classification
     map<UdpSocket*, SOCKET_ENTRY>      m_maSockets;
+    mutex                              m_mtxSockets;   // the worker thread uses the sockets, CbIdAddrChanges changes them
     map<array<uint8_t, 16>, IP_ENTRY>  m_maIpLeases;
+    mutex                              m_mtxLeases;    // m_maIpLeases and the pools, the peer updates come from an other thread
+    unique_ptr<PeerLink>               m_pPeer;
+    RateLimiter                        m_RateLimit;
+    ReplyCache                         m_ReplyCache;
+    IngressQueue                       m_IngressQueue;
+    RequestTable                       m_Requests;         // requests that wait for the ping
+    thread                             m_thWorker;
+    unique_ptr<IcmpProbe>              m_pProbe;
+    chrono::seconds                    m_tQuarantine;
+    unique_ptr<DdnsUpdater>            m_pDdns;
+    unique_ptr<LeaseQuery>             m_pLeaseQuery;
+    unique_ptr<LeaseHistory>           m_pHistory;
+    unique_ptr<LeaseView>              m_pLeaseView;
+    unique_ptr<FlightRecorder>         m_pRecorder;
+    array<uint32_t, 10>                m_arRenewals;       // RENEWING and REBINDING requests of the last minutes
+    int64_t                            m_nRenewMinute;     // the minute of the newest counter
+    thread                             m_thHousekeeping;   // lease expiry
+    mutex                              m_mtxHousekeeping;
+    condition_variable                 m_cvHousekeeping;
+    bool                               m_bStop;
+    list<SOCKET_ENTRY>                 m_lstAdopted;       // sockets taken over from the previous process
+    thread                             m_thAdopted;
+    atomic<bool>                       m_bStopAdopted;
+    string                             m_strHotRestart;    // path of the UNIX socket
+    unique_ptr<HotRestart>             m_pHotRestart;
+    atomic<bool>                       m_bFrozen;          // the hand over to a new process is running
+    mutex                              m_mtxHandOver;
+    vector<IngressQueue::ITEM>         m_vHandOver;        // packets for the new process
 };
 
+// --history File IP [From [To]]: without time all events of the address, with one time the last event before, the client that had the address.
+// Time as 2024-03-12T14:00:00 (local time) or seconds since 1970
+int PrintHistory(int argc, const char* argv[])
+{
+    auto fnTime = [](const string& strTime) -> int64_t
+    {
+        if (strTime.find_first_not_of("0123456789") == string::npos)
+            return stoll(strTime);
+        tm stTm = { 0 };
+        istringstream ss(strTime);
+        ss >> get_time(&stTm, "%Y-%m-%dT%H:%M:%S");
+        stTm.tm_isdst = -1;
+        return ss.fail() == true ? -1 : static_cast<int64_t>(mktime(&stTm));
+    };
+
+    uint32_t nIpAddr = 0;
+    if (argc < 2 || (string(argv[1]) != "*" && ::inet_pton(AF_INET, argv[1], &nIpAddr) != 1))
+    {
+        wcout << L"Usage: DhcpServ --history File IP|* [From [To]]" << endl;
+        return 1;
+    }
+    const int64_t tFrom = argc > 2 ? fnTime(argv[2]) : 0;
+    const int64_t tTo = argc > 3 ? fnTime(argv[3]) : argc > 2 ? tFrom : INT64_MAX;
+    if (tFrom < 0 || tTo < 0)
+    {
+        wcout << L"Invalid time, use 2024-03-12T14:00:00" << endl;
+        return 1;
+    }
+
+    auto fnPrint = [](const LeaseHistory::EVENT& stEvent)
+    {
+        const wchar_t* szType[] = { L"removed", L"offer", L"lease", L"", L"release", L"", L"", L"", L"decline" };
+        const time_t tTime = static_cast<time_t>(stEvent.tTime);
+        char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 }, caScopeBuf[INET6_ADDRSTRLEN + 1] = { 0 };
+        const uint32_t nIpAddr = htonl(stEvent.nIpAddr), nScope = htonl(stEvent.nScope);
+        wstringstream ss;
+        ss << put_time(localtime(&tTime), L"%Y-%m-%d %H:%M:%S") << L"  " << setfill(L' ') << std::left << setw(8) << (stEvent.nType < 9 ? szType[stEvent.nType] : L"?") << setw(16) << inet_ntop(AF_INET, &nIpAddr, caAddrBuf, sizeof(caAddrBuf));
+        ss << setfill(L'0') << std::right << hex;
+        for (uint8_t n = 0; n < 6; ++n)
+            ss << (n > 0 ? L":" : L"") << setw(2) << stEvent.arHwAddr[n];
+        ss << L"  ";
+        for (size_t n = 0; n < stEvent.strClientId.size(); ++n)
+            ss << setw(2) << (static_cast<unsigned int>(stEvent.strClientId[n]) & 0xff);
+        ss << L"  " << inet_ntop(AF_INET, &nScope, caScopeBuf, sizeof(caScopeBuf));
+        wcout << ss.str() << endl;
+    };
+
+    bool bFound = false;
+    LeaseHistory::EVENT stLast;
+    const bool bReturn = LeaseHistory::Query(argv[0], ntohl(nIpAddr), argc == 3 ? 0 : tFrom, tTo, [&](const LeaseHistory::EVENT& stEvent)
+    {
+        if (argc != 3)
+            fnPrint(stEvent);
+        else if (bFound == false || stEvent.tTime >= stLast.tTime)
+        {
+            stLast = stEvent;
+            bFound = true;
+        }
+    });
+    if (bFound == true)
+        fnPrint(stLast);
+    if (bReturn == false)
+        wcout << L"Error reading " << argv[0] << endl;
+    return bReturn == true ? 0 : 1;
+}
+
+// --leases [/Name] [IP|MAC]: the pools and the leases of a running server, read from the shared memory
+int PrintLeaseView(int argc, const char* argv[])
+{
+    string strName = "/DhcpServ.leases", strFilter;
+    for (int n = 0; n < argc; ++n)
+        (argv[n][0] == '/' ? strName : strFilter) = argv[n];
+
+    auto fnPrint = [](const LeaseView::SLOT& stSlot)
+    {
+        const wchar_t* szFlag[] = { L"", L"offer", L"lease", L"", L"release", L"", L"", L"", L"decline" };
+        const uint32_t nIpAddr = htonl(stSlot.nIpAddr);
+        const time_t tTime = static_cast<time_t>(stSlot.tLeaseTime);
+        char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 };
+        wstringstream ss;
+        ss << setfill(L' ') << std::left << setw(16) << inet_ntop(AF_INET, &nIpAddr, caAddrBuf, sizeof(caAddrBuf)) << setfill(L'0') << std::right << hex;
+        for (uint8_t n = 0; n < 6; ++n)
+            ss << (n > 0 ? L":" : L"") << setw(2) << stSlot.arHwAddr[n];
+        ss << dec << L"  " << setfill(L' ') << std::left << setw(8) << (stSlot.nFlag < 9 ? szFlag[stSlot.nFlag] : L"?") << put_time(localtime(&tTime), L"%Y-%m-%d %H:%M:%S");
+        if (stSlot.nLeaseTime != 0)
+            ss << L" +" << stSlot.nLeaseTime << L"s";
+        ss << L"  " << wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().from_bytes(string(stSlot.szHostName, stSlot.nHostNameLen));
+        wcout << ss.str() << endl;
+    };
+
+    uint32_t nIpAddr = 0;
+    if (strFilter.empty() == false && ::inet_pton(AF_INET, strFilter.c_str(), &nIpAddr) == 1)
+    {   // lookup without a copy of the table
+        LeaseView::SLOT stSlot;
+        if (LeaseView::FindIp(strName, ntohl(nIpAddr), stSlot) == false)
+        {
+            wcout << L"No lease for " << strFilter.c_str() << endl;
+            return 1;
+        }
+        fnPrint(stSlot);
+        return 0;
+    }
+
+    uint8_t arHwAddr[16] = { 0 };
+    for (size_t n = 0, i = 0; n + 1 < strFilter.size() && i < 16; n += 3)
+        arHwAddr[i++] = static_cast<uint8_t>(stoi(strFilter.substr(n, 2), 0, 16));
+
+    vector<LeaseView::SLOT> vSlots;
+    vector<LeaseView::POOL> vPools;
+    int64_t tPublished = 0;
+    if (LeaseView::Read(strName, vSlots, vPools, tPublished) == false)
+    {
+        wcout << L"Error reading the lease view " << strName.c_str() << endl;
+        return 1;
+    }
+
+    if (strFilter.empty() == true)
+    {
+        const time_t tTime = static_cast<time_t>(tPublished);
+        wcout << L"Published " << put_time(localtime(&tTime), L"%Y-%m-%d %H:%M:%S") << L", " << vSlots.size() << L" leases" << endl;
+        for (const auto& stPool : vPools)
+        {
+            const uint32_t nScope = htonl(stPool.nScope);
+            char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 };
+            wcout << L"Pool " << inet_ntop(AF_INET, &nScope, caAddrBuf, sizeof(caAddrBuf)) << (stPool.szClass[0] != 0 ? L":" : L"") << stPool.szClass << L" - " << stPool.nInUse << L" of " << stPool.nSize << L" in use" << endl;
+        }
+    }
+    for (const auto& stSlot : vSlots)
+    {
+        if (strFilter.empty() == true || memcmp(stSlot.arHwAddr, arHwAddr, sizeof(arHwAddr)) == 0)
+            fnPrint(stSlot);
+    }
+    return 0;
+}
+
 int main(int argc, const char* argv[])
 {
 #if defined(_WIN32) || defined(_WIN64)
@@ -707,13 +2286,51 @@ int main(int argc, const char* argv[])
     _setmode(_fileno(stdout), _O_U16TEXT);
 #endif
 
+    if (argc > 1 && string(argv[1]) == "--history")
+        return PrintHistory(argc - 2, argv + 2);
+    if (argc > 1 && string(argv[1]) == "--leases")
+        return PrintLeaseView(argc - 2, argv + 2);
+
     DhcpServer mDhcpSrv;
+
+    // --import File [isc|csv]: the leases are added to DhcpServ.ini, it is written when the server object ends.
+    // Only with the server stopped, the import is refused if the hot restart socket or the lease view shows a running server.
+    // Without these two a running server is not detected and overwrites DhcpServ.ini when it ends.
+    if (argc > 2 && string(argv[1]) == "--import")
+        return mDhcpSrv.ImportLeaseFile(argv[2], argc > 3 && string(argv[3]) == "isc" ? LeaseImport::FORMAT_ISC : argc > 3 && string(argv[3]) == "csv" ? LeaseImport::FORMAT_CSV : LeaseImport::FORMAT_AUTO) == true ? 0 : 1;
+
+    for (int n = 1; n < argc; ++n)
+    {
+        if (string(argv[n]) == "--takeover" && mDhcpSrv.TakeOver() == false)
+            wcout << L"Takeover failed, the server starts without the running server" << endl;
+    }
     mDhcpSrv.Start();
 
+    // 's' prints the statistics, 'd' writes the flight recorder (also SIGUSR1), every other key ends the server
 #if defined(_WIN32) || defined(_WIN64)
-    _getch();
+    for (int nKey = _getch(); nKey == 's' || nKey == 'S' || nKey == 'd' || nKey == 'D'; nKey = _getch())
+    {
+        if (nKey == 'd' || nKey == 'D')
+            mDhcpSrv.DumpFlightRecorder();
+        else
+            mDhcpSrv.PrintStatistics();
+    }
 #else
-    getchar();
+    // after a hot restart the new process serves, we end without a key
+    while (mDhcpSrv.IsHandedOver() == false)
+    {
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        if (::poll(&pfd, 1, 100) <= 0)
+            continue;
+        int nKey = getchar();
+        if (nKey == 'd' || nKey == 'D')
+            mDhcpSrv.DumpFlightRecorder();
+        else if (nKey == 's' || nKey == 'S')
+            mDhcpSrv.PrintStatistics();
+        else
+            break;
+        while (nKey != '\n' && nKey != EOF) nKey = getchar();   // rest of the line
+    }
 #endif
 
     mDhcpSrv.Stop();
@@ -0,0 +1,248 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+
+#include "FlightRecorder.h"
+#include "Trace.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Ws2tcpip.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#define open _open
+#define write _write
+#define close _close
+#define O_FLAGS (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY), (_S_IREAD | _S_IWRITE)
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define O_FLAGS (O_WRONLY | O_CREAT | O_TRUNC), 0644
+#endif
+
+namespace
+{
+    atomic<FlightRecorder*> s_pRecorder(nullptr);   // the instance of the signal handler
+
+    const int s_arCrashSignals[] = { SIGSEGV, SIGABRT, SIGFPE, SIGILL
+#if !defined(_WIN32) && !defined(_WIN64)
+        , SIGBUS
+#endif
+    };
+
+    // "192.168.1.10:68", the port is optional. inet_pton gets a copy on the stack, no string is built
+    void ParseAddr(const string& strAddr, uint32_t& nIp, uint16_t& nPort, uint16_t nDefaultPort)
+    {
+        nIp = 0;
+        nPort = nDefaultPort;
+        char szIp[16];
+        const size_t nColon = strAddr.find(':');
+        const size_t nIpLen = min(nColon, strAddr.size());
+        if (nIpLen == 0 || nIpLen >= sizeof(szIp))
+            return;
+        memcpy(szIp, strAddr.data(), nIpLen);
+        szIp[nIpLen] = 0;
+        if (::inet_pton(AF_INET, szIp, &nIp) != 1)
+            nIp = 0;
+        if (nColon != string::npos)
+            nPort = static_cast<uint16_t>(atoi(strAddr.c_str() + nColon + 1));
+    }
+
+    uint16_t Checksum(const uint8_t* pData, size_t nLen)
+    {
+        uint32_t nSum = 0;
+        for (; nLen > 1; pData += 2, nLen -= 2)
+            nSum += static_cast<uint32_t>(pData[0] << 8 | pData[1]);
+        while ((nSum >> 16) != 0)
+            nSum = (nSum & 0xffff) + (nSum >> 16);
+        return static_cast<uint16_t>(~nSum);
+    }
+
+    void PutUint16(uint8_t* p, uint16_t n)
+    {
+        p[0] = static_cast<uint8_t>(n >> 8);
+        p[1] = static_cast<uint8_t>(n);
+    }
+}
+
+const size_t FlightRecorder::s_nSnapLen;
+
+FlightRecorder::FlightRecorder(const string& strFile, size_t nSlots) : m_strFile(strFile), m_nSlots(max<size_t>(nSlots, 1)), m_pSlots(make_unique<SLOT[]>(m_nSlots)), m_nNext(0), m_nLost(0), m_bDumping(false)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    Stop();
+}
+
+void FlightRecorder::Start()
+{
+    FlightRecorder* pExpected = nullptr;
+    if (s_pRecorder.compare_exchange_strong(pExpected, this) == false)
+        return;     // an other instance has the signals
+
+#if defined(_WIN32) || defined(_WIN64)
+    for (int iSignal : s_arCrashSignals)
+        signal(iSignal, &FlightRecorder::SignalHandler);
+#else
+    struct sigaction stAction = {};
+    stAction.sa_handler = &FlightRecorder::SignalHandler;
+    sigemptyset(&stAction.sa_mask);
+    stAction.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &stAction, nullptr);
+
+    // the default action follows: the instruction fails again, abort raises the signal again
+    stAction.sa_flags = SA_RESETHAND;
+    for (int iSignal : s_arCrashSignals)
+        sigaction(iSignal, &stAction, nullptr);
+#endif
+}
+
+void FlightRecorder::Stop()
+{
+    FlightRecorder* pExpected = this;
+    if (s_pRecorder.compare_exchange_strong(pExpected, nullptr) == false)
+        return;
+
+    for (int iSignal : s_arCrashSignals)
+        signal(iSignal, SIG_DFL);
+#if !defined(_WIN32) && !defined(_WIN64)
+    signal(SIGUSR1, SIG_DFL);
+#endif
+}
+
+void FlightRecorder::SignalHandler(int iSignal)
+{
+    FlightRecorder* pRecorder = s_pRecorder.load();
+    if (pRecorder != nullptr)
+        pRecorder->Dump();
+#if defined(_WIN32) || defined(_WIN64)
+    signal(iSignal, SIG_DFL);
+#else
+    (void)iSignal;  // SA_RESETHAND resets the crash signals, SIGUSR1 stays
+#endif
+}
+
+void FlightRecorder::Record(DIRECTION nDirection, const uint8_t* pData, size_t nLen, const string& strPeer, const string& strLocal)
+{
+    const uint64_t nTicket = m_nNext.fetch_add(1, memory_order_relaxed);
+    SLOT& stSlot = m_pSlots[nTicket % m_nSlots];
+
+    // the ring has gone round while an other thread writes the slot
+    uint32_t nSeq = stSlot.nSeq.load(memory_order_relaxed);
+    if ((nSeq & 1) != 0 || stSlot.nSeq.compare_exchange_strong(nSeq, nSeq + 1, memory_order_relaxed) == false)
+    {
+        m_nLost.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    atomic_thread_fence(memory_order_release);
+
+    PACKET& stPacket = stSlot.stPacket;
+    stPacket.nTicket = nTicket;
+    stPacket.tTime = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    if (nDirection == DIR_IN)
+    {
+        ParseAddr(strPeer, stPacket.nSrcIp, stPacket.nSrcPort, 68);
+        ParseAddr(strLocal, stPacket.nDstIp, stPacket.nDstPort, 67);
+    }
+    else
+    {
+        ParseAddr(strLocal, stPacket.nSrcIp, stPacket.nSrcPort, 67);
+        ParseAddr(strPeer, stPacket.nDstIp, stPacket.nDstPort, 68);
+    }
+    stPacket.nOrigLen = static_cast<uint32_t>(nLen);
+    stPacket.nLen = static_cast<uint32_t>(min(nLen, s_nSnapLen));
+    memcpy(stPacket.arData, pData, stPacket.nLen);
+
+    stSlot.nSeq.store(nSeq + 2, memory_order_release);
+}
+
+int FlightRecorder::Dump()
+{
+    if (m_bDumping.exchange(true) == true)
+        return -1;      // a dump is running, perhaps on this thread
+
+    const int fdFile = ::open(m_strFile.c_str(), O_FLAGS);
+    if (fdFile < 0)
+    {
+        m_bDumping = false;
+        return -1;
+    }
+
+    // pcap file header: microseconds, LINKTYPE_IPV4 (228), in the byte order of this machine
+    const uint32_t arFileHeader[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 228 };
+    bool bOk = ::write(fdFile, arFileHeader, sizeof(arFileHeader)) == sizeof(arFileHeader);
+
+    // the tickets from the oldest to the newest are the slots in order
+    const uint64_t nEnd = m_nNext.load(memory_order_acquire);
+    int nPackets = 0;
+    for (uint64_t nTicket = nEnd > m_nSlots ? nEnd - m_nSlots : 0; nTicket < nEnd && bOk == true; ++nTicket)
+    {
+        const SLOT& stSlot = m_pSlots[nTicket % m_nSlots];
+        const uint32_t nSeq = stSlot.nSeq.load(memory_order_acquire);
+        if ((nSeq & 1) != 0 || nSeq == 0)
+            continue;
+
+        // record header, IPv4 header, UDP header, data
+        struct
+        {
+            uint32_t arRecord[4];
+            uint8_t  arIp[20];
+            uint8_t  arUdp[8];
+            uint8_t  arData[s_nSnapLen];
+        }stOut;
+        const PACKET& stPacket = stSlot.stPacket;
+        const uint64_t nTicketOfSlot = stPacket.nTicket;
+        const int64_t tTime = stPacket.tTime;
+        const uint32_t nLen = min<uint32_t>(stPacket.nLen, s_nSnapLen);
+        const uint32_t nOrigLen = stPacket.nOrigLen;
+        const uint32_t nSrcIp = stPacket.nSrcIp, nDstIp = stPacket.nDstIp;
+        const uint16_t nSrcPort = stPacket.nSrcPort, nDstPort = stPacket.nDstPort;
+        memcpy(stOut.arData, stPacket.arData, nLen);
+        atomic_thread_fence(memory_order_acquire);
+        if (stSlot.nSeq.load(memory_order_relaxed) != nSeq || nTicketOfSlot != nTicket)
+            continue;   // written in between
+
+        stOut.arRecord[0] = static_cast<uint32_t>(tTime / 1000000);
+        stOut.arRecord[1] = static_cast<uint32_t>(tTime % 1000000);
+        stOut.arRecord[2] = nLen + 28;
+        stOut.arRecord[3] = nOrigLen + 28;
+
+        memset(stOut.arIp, 0, sizeof(stOut.arIp));
+        stOut.arIp[0] = 0x45;
+        PutUint16(&stOut.arIp[2], static_cast<uint16_t>(min<uint32_t>(nOrigLen + 28, 0xffff)));
+        stOut.arIp[8] = 64;     // TTL
+        stOut.arIp[9] = 17;     // UDP
+        memcpy(&stOut.arIp[12], &nSrcIp, 4);
+        memcpy(&stOut.arIp[16], &nDstIp, 4);
+        PutUint16(&stOut.arIp[10], Checksum(stOut.arIp, sizeof(stOut.arIp)));
+
+        PutUint16(&stOut.arUdp[0], nSrcPort);
+        PutUint16(&stOut.arUdp[2], nDstPort);
+        PutUint16(&stOut.arUdp[4], static_cast<uint16_t>(min<uint32_t>(nOrigLen + 8, 0xffff)));
+        PutUint16(&stOut.arUdp[6], 0);      // no checksum
+
+        const size_t nOut = sizeof(stOut.arRecord) + sizeof(stOut.arIp) + sizeof(stOut.arUdp) + nLen;
+        bOk = ::write(fdFile, &stOut, static_cast<unsigned int>(nOut)) == static_cast<int>(nOut);
+        ++nPackets;
+    }
+
+    ::close(fdFile);
+    m_bDumping = false;
+    return bOk == true ? nPackets : -1;
+}
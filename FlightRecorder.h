@@ -0,0 +1,81 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+// The last received and sent DHCP packets in a ring of fixed slots. A packet costs
+// a ticket (atomic counter), the copy into the slot of the ticket and a sequence
+// counter per slot: odd while a thread writes the slot. Nothing is locked, a writer
+// that finds its slot busy drops the packet. Dump writes the ring as pcap file with
+// a built IPv4 and UDP header, it allocates no memory and uses only system calls
+// that are allowed in a signal handler. SIGUSR1 and the crash signals dump the ring.
+class FlightRecorder
+{
+public:
+    enum DIRECTION : uint8_t
+    {
+        DIR_IN = 0,
+        DIR_OUT
+    };
+
+    FlightRecorder(const string& strFile, size_t nSlots);
+    ~FlightRecorder();
+
+    void Start();       // the signal handler
+    void Stop();
+
+    // strPeer and strLocal are "IP[:Port]", empty = not known
+    void Record(DIRECTION nDirection, const uint8_t* pData, size_t nLen, const string& strPeer, const string& strLocal);
+    int Dump();         // number of packets written, -1 = error
+
+    const string& GetFile() const { return m_strFile; }
+    uint64_t GetRecorded() const { return m_nNext; }
+    uint64_t GetLost() const { return m_nLost; }
+
+private:
+    static const size_t s_nSnapLen = 1472;  // UDP payload of an ethernet frame
+
+    typedef struct
+    {
+        uint64_t nTicket;
+        int64_t  tTime;         // microseconds since 1970
+        uint32_t nSrcIp;        // network byte order
+        uint32_t nDstIp;
+        uint16_t nSrcPort;      // host byte order
+        uint16_t nDstPort;
+        uint32_t nOrigLen;
+        uint32_t nLen;          // in arData
+        uint8_t  arData[s_nSnapLen];
+    }PACKET;
+
+    typedef struct
+    {
+        atomic<uint32_t> nSeq;  // odd = a thread writes the packet
+        PACKET   stPacket;
+    }SLOT;
+
+    static void SignalHandler(int iSignal);
+
+private:
+    string   m_strFile;
+    size_t   m_nSlots;
+    unique_ptr<SLOT[]> m_pSlots;
+    atomic<uint64_t> m_nNext;   // the next ticket
+    atomic<uint64_t> m_nLost;   // the slot was busy
+    atomic<bool>     m_bDumping;
+};
@@ -0,0 +1,460 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+#include <random>
+#include <cerrno>
+#include <cstring>
+
+#include "HotRestart.h"
+#include "Trace.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    const uint32_t s_nMagic = 0x44534852;   // "DSHR"
+    const size_t   s_nMaxSockets = 64;
+    const int      s_nReadyTimeoutMs = 5000;
+    const int      s_nRequestTimeoutMs = 1000;
+
+    void PutUInt(vector<uint8_t>& vBuf, uint64_t nValue, int nBytes)
+    {
+        for (int n = nBytes - 1; n >= 0; --n)
+            vBuf.push_back(static_cast<uint8_t>(nValue >> (n * 8)));
+    }
+
+    uint64_t GetUInt(const uint8_t*& pPos, int nBytes)
+    {
+        uint64_t nValue = 0;
+        for (int n = 0; n < nBytes; ++n)
+            nValue = (nValue << 8) | *pPos++;
+        return nValue;
+    }
+
+    bool WriteAll(int fdSocket, const void* pData, size_t nLen)
+    {
+        for (const uint8_t* pPos = static_cast<const uint8_t*>(pData); nLen > 0;)
+        {
+            const ssize_t nSent = ::send(fdSocket, pPos, nLen, MSG_NOSIGNAL);
+            if (nSent <= 0)
+                return false;
+            pPos += nSent;
+            nLen -= nSent;
+        }
+        return true;
+    }
+
+    bool ReadAll(int fdSocket, void* pData, size_t nLen)
+    {
+        for (uint8_t* pPos = static_cast<uint8_t*>(pData); nLen > 0;)
+        {
+            const ssize_t nRead = ::recv(fdSocket, pPos, nLen, 0);
+            if (nRead <= 0)
+                return false;
+            pPos += nRead;
+            nLen -= nRead;
+        }
+        return true;
+    }
+
+    bool MakeAddress(const string& strPath, struct sockaddr_un& addr)
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strPath.size() >= sizeof(addr.sun_path))
+            return false;
+        memcpy(addr.sun_path, strPath.c_str(), strPath.size());
+        return true;
+    }
+
+    int Connect(const string& strPath)
+    {
+        struct sockaddr_un addr;
+        if (MakeAddress(strPath, addr) == false)
+            return -1;
+
+        const int fdConnection = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fdConnection >= 0 && ::connect(fdConnection, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+        {
+            ::close(fdConnection);
+            return -1;
+        }
+        return fdConnection;
+    }
+}
+#endif
+
+HotRestart::HotRestart() : m_fdListen(-1), m_bStop(false), m_bHandedOver(false)
+{
+}
+
+HotRestart::~HotRestart()
+{
+    Stop();
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+bool HotRestart::Listen(const string& strPath, FN_FREEZE fnFreeze, FN_RESUME fnResume, FN_FINISH fnFinish)
+{
+    struct sockaddr_un addr;
+    if (MakeAddress(strPath, addr) == false)
+        return false;
+
+    m_fdListen = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fdListen < 0)
+        return false;
+
+    ::unlink(strPath.c_str());  // left over from a process that was killed
+    if (::bind(m_fdListen, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || ::chmod(strPath.c_str(), 0600) != 0 || ::listen(m_fdListen, 1) != 0)
+    {
+        MyTrace("Error: hot restart socket \'", strPath, "\' could not be created");
+        ::close(m_fdListen);
+        m_fdListen = -1;
+        return false;
+    }
+
+    m_strPath = strPath;
+    m_fnFreeze = fnFreeze;
+    m_fnResume = fnResume;
+    m_fnFinish = fnFinish;
+    m_bStop = false;
+    m_thListen = thread(&HotRestart::ListenThread, this);
+    return true;
+}
+
+void HotRestart::Stop()
+{
+    m_bStop = true;
+    if (m_thListen.joinable() == true)
+        m_thListen.join();
+    if (m_fdListen >= 0)
+    {
+        ::close(m_fdListen);
+        m_fdListen = -1;
+        if (m_bHandedOver == false)
+            ::unlink(m_strPath.c_str());    // after a hand over the path belongs to the new process
+    }
+}
+
+void HotRestart::ListenThread()
+{
+    while (m_bStop == false && m_bHandedOver == false)
+    {
+        struct pollfd pfd = { m_fdListen, POLLIN, 0 };
+        if (::poll(&pfd, 1, 200) <= 0)
+            continue;
+
+        const int fdConnection = ::accept(m_fdListen, nullptr, nullptr);
+        if (fdConnection < 0)
+            continue;
+
+        // the first byte is the request: 'T' = take over, 'P' = only the question if a server is running
+        uint8_t cRequest = 0;
+        struct pollfd pfdRequest = { fdConnection, POLLIN, 0 };
+        if (::poll(&pfdRequest, 1, s_nRequestTimeoutMs) > 0 && ReadAll(fdConnection, &cRequest, 1) == true)
+        {
+            const uint8_t cAlive = 'A';
+            if (cRequest == 'T')
+                HandOver(fdConnection);
+            else if (cRequest == 'P')
+                WriteAll(fdConnection, &cAlive, 1);
+        }
+        ::close(fdConnection);
+    }
+}
+
+void HotRestart::HandOver(int fdConnection)
+{
+    SOCKETLIST vSockets;
+    vector<uint8_t> vLeases;
+    m_fnFreeze(vSockets, vLeases);
+    if (vSockets.size() > s_nMaxSockets)
+        vSockets.resize(s_nMaxSockets);
+
+    // The leases go through shared memory, the new process copies them before it answers. The segment
+    // is created exclusive with a random name and unlinked at once, only the descriptor is passed on
+    int fdShm = -1;
+    random_device rd;
+    for (int nTry = 0; nTry < 16 && fdShm < 0; ++nTry)
+    {
+        const string strShmName = "/DhcpServ." + to_string(::getpid()) + "." + to_string(rd());
+        fdShm = ::shm_open(strShmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fdShm >= 0)
+            ::shm_unlink(strShmName.c_str());
+        else if (errno != EEXIST)
+            break;
+    }
+    bool bReady = fdShm >= 0 && ::ftruncate(fdShm, max<size_t>(vLeases.size(), 1)) == 0;
+    if (bReady == true && vLeases.empty() == false)
+    {
+        void* pShm = ::mmap(nullptr, vLeases.size(), PROT_WRITE, MAP_SHARED, fdShm, 0);
+        bReady = pShm != MAP_FAILED;
+        if (bReady == true)
+        {
+            memcpy(pShm, vLeases.data(), vLeases.size());
+            ::munmap(pShm, vLeases.size());
+        }
+    }
+
+    // magic(4) length(4) lease size(4) count(1) {ip(1+n)}, the descriptors of the sockets in the same order, then the shared memory
+    vector<uint8_t> vMessage;
+    PutUInt(vMessage, s_nMagic, 4);
+    PutUInt(vMessage, 0, 4);
+    PutUInt(vMessage, vLeases.size(), 4);
+    PutUInt(vMessage, vSockets.size(), 1);
+    for (const auto& itSocket : vSockets)
+    {
+        PutUInt(vMessage, itSocket.second.size(), 1);
+        vMessage.insert(end(vMessage), begin(itSocket.second), end(itSocket.second));
+    }
+    const uint32_t nLen = static_cast<uint32_t>(vMessage.size());
+    for (int n = 0; n < 4; ++n)
+        vMessage[4 + n] = static_cast<uint8_t>(nLen >> ((3 - n) * 8));
+
+    vector<int> vFds;
+    for (const auto& itSocket : vSockets)
+        vFds.push_back(itSocket.first);
+    if (bReady == true && vLeases.empty() == false)
+        vFds.push_back(fdShm);
+
+    vector<uint8_t> vControl(CMSG_SPACE(sizeof(int) * (s_nMaxSockets + 1)));
+    struct iovec iov = { vMessage.data(), vMessage.size() };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (vFds.empty() == false)
+    {
+        msg.msg_control = vControl.data();
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * vFds.size());
+        struct cmsghdr* pCmsg = CMSG_FIRSTHDR(&msg);
+        pCmsg->cmsg_level = SOL_SOCKET;
+        pCmsg->cmsg_type = SCM_RIGHTS;
+        pCmsg->cmsg_len = CMSG_LEN(sizeof(int) * vFds.size());
+        memcpy(CMSG_DATA(pCmsg), vFds.data(), sizeof(int) * vFds.size());
+    }
+
+    uint8_t cReady = 0;
+    struct pollfd pfd = { fdConnection, POLLIN, 0 };
+    bReady = bReady == true && ::sendmsg(fdConnection, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(vMessage.size())
+        && ::poll(&pfd, 1, s_nReadyTimeoutMs) > 0 && ReadAll(fdConnection, &cReady, 1) == true && cReady == 'R';
+    if (fdShm >= 0)
+        ::close(fdShm);
+
+    if (bReady == false)
+    {
+        MyTrace("Error: hot restart failed, the server continues");
+        m_fnResume();
+        return;
+    }
+
+    // The new process receives on the sockets, we give it the packets we have not processed
+    PACKETLIST vPackets;
+    m_fnFinish(vPackets);
+    for (const auto& itPacket : vPackets)
+    {
+        vector<uint8_t> vHeader;
+        PutUInt(vHeader, itPacket.first.size(), 1);
+        vHeader.insert(end(vHeader), begin(itPacket.first), end(itPacket.first));
+        PutUInt(vHeader, itPacket.second.size(), 4);
+        if (WriteAll(fdConnection, vHeader.data(), vHeader.size()) == false || WriteAll(fdConnection, itPacket.second.data(), itPacket.second.size()) == false)
+            break;
+    }
+    m_bHandedOver = true;
+}
+
+bool HotRestart::TakeOver(const string& strPath, FN_ADOPT fnAdopt, FN_PACKET fnPacket)
+{
+    const int fdConnection = Connect(strPath);
+    if (fdConnection < 0)
+    {
+        MyTrace("Error: no running server on \'", strPath, "\'");
+        return false;
+    }
+    const uint8_t cRequest = 'T';
+    if (WriteAll(fdConnection, &cRequest, 1) == false)
+    {
+        ::close(fdConnection);
+        return false;
+    }
+
+    vector<uint8_t> vMessage(65536);
+    vector<uint8_t> vControl(CMSG_SPACE(sizeof(int) * (s_nMaxSockets + 1)));
+    struct iovec iov = { vMessage.data(), vMessage.size() };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = vControl.data();
+    msg.msg_controllen = vControl.size();
+    ssize_t nRead = ::recvmsg(fdConnection, &msg, MSG_CMSG_CLOEXEC);
+
+    vector<int> vFds;
+    for (struct cmsghdr* pCmsg = CMSG_FIRSTHDR(&msg); pCmsg != nullptr; pCmsg = CMSG_NXTHDR(&msg, pCmsg))
+    {
+        if (pCmsg->cmsg_level == SOL_SOCKET && pCmsg->cmsg_type == SCM_RIGHTS)
+        {
+            const int* pFds = reinterpret_cast<const int*>(CMSG_DATA(pCmsg));
+            vFds.insert(end(vFds), pFds, pFds + (pCmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        }
+    }
+
+    const uint8_t* pPos = vMessage.data();
+    const size_t nLen = nRead >= 8 && GetUInt(pPos, 4) == s_nMagic ? static_cast<size_t>(GetUInt(pPos, 4)) : 0;
+    if (nLen < 13 || nLen > vMessage.size() || static_cast<size_t>(nRead) > nLen || ReadAll(fdConnection, vMessage.data() + nRead, nLen - nRead) == false)
+    {
+        for (const int fdSocket : vFds)
+            ::close(fdSocket);
+        ::close(fdConnection);
+        return false;
+    }
+
+    const uint8_t* pEnd = vMessage.data() + nLen;
+    SOCKETLIST vSockets;
+    vector<uint8_t> vLeases(static_cast<size_t>(GetUInt(pPos, 4)));
+    const size_t nCount = *pPos++;
+    for (size_t n = 0; n < nCount && pPos < pEnd && n < vFds.size(); ++n)
+    {
+        const size_t nIpLen = min<size_t>(*pPos, pEnd - pPos - 1);
+        vSockets.emplace_back(vFds[n], string(reinterpret_cast<const char*>(pPos) + 1, nIpLen));
+        pPos += 1 + nIpLen;
+    }
+    // the descriptor after the sockets is the shared memory with the leases
+    const int fdShm = vLeases.empty() == false && vSockets.size() == nCount && vFds.size() > nCount ? vFds[nCount] : -1;
+    for (size_t n = vSockets.size(); n < vFds.size(); ++n)
+    {
+        if (vFds[n] != fdShm)
+            ::close(vFds[n]);
+    }
+
+    if (vLeases.empty() == false)
+    {
+        struct stat stShm;
+        void* pShm = fdShm >= 0 && ::fstat(fdShm, &stShm) == 0 && static_cast<size_t>(stShm.st_size) >= vLeases.size() ? ::mmap(nullptr, vLeases.size(), PROT_READ, MAP_SHARED, fdShm, 0) : MAP_FAILED;
+        if (pShm != MAP_FAILED)
+        {
+            memcpy(vLeases.data(), pShm, vLeases.size());
+            ::munmap(pShm, vLeases.size());
+        }
+        else
+        {
+            MyTrace("Error: the leases of the running server could not be read");
+            vLeases.clear();
+        }
+        if (fdShm >= 0)
+            ::close(fdShm);
+    }
+
+    fnAdopt(vSockets, vLeases);
+
+    const uint8_t cReady = 'R';
+    if (WriteAll(fdConnection, &cReady, 1) == false)
+    {
+        ::close(fdConnection);
+        return false;
+    }
+
+    // the packets the old process had in its queue, until it closes the connection
+    for (;;)
+    {
+        uint8_t caHeader[260];
+        if (ReadAll(fdConnection, caHeader, 1) == false || ReadAll(fdConnection, caHeader + 1, caHeader[0] + 4) == false)
+            break;
+        const uint8_t* pSize = caHeader + 1 + caHeader[0];
+        vector<uint8_t> vData(static_cast<size_t>(GetUInt(pSize, 4)));
+        if (vData.size() > 65536 || ReadAll(fdConnection, vData.data(), vData.size()) == false)
+            break;
+        fnPacket(string(reinterpret_cast<const char*>(caHeader) + 1, caHeader[0]), vData);
+    }
+
+    ::close(fdConnection);
+    return true;
+}
+
+bool HotRestart::IsRunning(const string& strPath)
+{
+    const int fdConnection = Connect(strPath);
+    if (fdConnection < 0)
+        return false;
+
+    const uint8_t cRequest = 'P';
+    uint8_t cAlive = 0;
+    struct pollfd pfd = { fdConnection, POLLIN, 0 };
+    const bool bRunning = WriteAll(fdConnection, &cRequest, 1) == true && ::poll(&pfd, 1, s_nRequestTimeoutMs) > 0 && ReadAll(fdConnection, &cAlive, 1) == true && cAlive == 'A';
+    ::close(fdConnection);
+    return bRunning;
+}
+
+int HotRestart::FindBoundSocket(const string& strIpAddr, uint16_t nPort)
+{
+    struct in_addr inAddr;
+    if (::inet_pton(AF_INET, strIpAddr.c_str(), &inAddr) != 1)
+        return -1;
+
+    // SocketLib does not give us its descriptor, we look for the socket with the address
+    for (int fdSocket = 0; fdSocket < ::getdtablesize(); ++fdSocket)
+    {
+        struct sockaddr_in addr = { 0 };
+        socklen_t nAddrLen = sizeof(addr);
+        int nType = 0;
+        socklen_t nTypeLen = sizeof(nType);
+        if (::getsockname(fdSocket, reinterpret_cast<struct sockaddr*>(&addr), &nAddrLen) == 0 && addr.sin_family == AF_INET
+            && addr.sin_port == htons(nPort) && addr.sin_addr.s_addr == inAddr.s_addr
+            && ::getsockopt(fdSocket, SOL_SOCKET, SO_TYPE, &nType, &nTypeLen) == 0 && nType == SOCK_DGRAM)
+            return fdSocket;
+    }
+    return -1;
+}
+
+#else
+
+bool HotRestart::Listen(const string&, FN_FREEZE, FN_RESUME, FN_FINISH)
+{
+    return false;
+}
+
+void HotRestart::Stop()
+{
+}
+
+void HotRestart::ListenThread()
+{
+}
+
+void HotRestart::HandOver(int)
+{
+}
+
+bool HotRestart::TakeOver(const string&, FN_ADOPT, FN_PACKET)
+{
+    return false;
+}
+
+bool HotRestart::IsRunning(const string&)
+{
+    return false;
+}
+
+int HotRestart::FindBoundSocket(const string&, uint16_t)
+{
+    return -1;
+}
+
+#endif
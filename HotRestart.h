@@ -0,0 +1,67 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Restart without losing packets. The running server listens on a UNIX socket.
+// A new process started with --takeover connects to it, the running server stops
+// the processing and sends its bound UDP sockets and a shared memory segment with
+// the leases as descriptors (SCM_RIGHTS), the segment has no name any more. When the new process is ready, the old
+// one closes its sockets, forwards the packets still in its queue and ends.
+// The sockets are never closed in between, the kernel keeps the packets.
+// IsRunning only asks the server if it is running, it goes on without a hand over.
+// Not available on Windows.
+class HotRestart
+{
+public:
+    typedef vector<pair<int, string>> SOCKETLIST;                       // descriptor, IP address
+    typedef vector<pair<string, vector<uint8_t>>> PACKETLIST;           // IP address of the socket, packet
+    typedef function<void(SOCKETLIST&, vector<uint8_t>&)> FN_FREEZE;    // old process: stop the processing, give the sockets and the leases
+    typedef function<void()> FN_RESUME;                                 // old process: the new process failed, go on
+    typedef function<void(PACKETLIST&)> FN_FINISH;                      // old process: close the sockets, give the unprocessed packets
+    typedef function<void(SOCKETLIST&, vector<uint8_t>&)> FN_ADOPT;     // new process: take the sockets and the leases
+    typedef function<void(const string&, vector<uint8_t>&)> FN_PACKET;  // new process: a packet of the old process
+
+    HotRestart();
+    ~HotRestart();
+
+    bool Listen(const string& strPath, FN_FREEZE fnFreeze, FN_RESUME fnResume, FN_FINISH fnFinish);
+    void Stop();
+    bool IsHandedOver() const { return m_bHandedOver; }
+
+    static bool TakeOver(const string& strPath, FN_ADOPT fnAdopt, FN_PACKET fnPacket);
+    static bool IsRunning(const string& strPath);
+    static int FindBoundSocket(const string& strIpAddr, uint16_t nPort);
+
+private:
+    void ListenThread();
+    void HandOver(int fdConnection);
+
+private:
+    string       m_strPath;
+    int          m_fdListen;
+    FN_FREEZE    m_fnFreeze;
+    FN_RESUME    m_fnResume;
+    FN_FINISH    m_fnFinish;
+    thread       m_thListen;
+    atomic<bool> m_bStop;
+    atomic<bool> m_bHandedOver;
+};
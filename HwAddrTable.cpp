@@ -0,0 +1,203 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <fstream>
+#include <sstream>
+#include <codecvt>
+#include <locale>
+
+#include "HwAddrTable.h"
+#include "Trace.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Ws2tcpip.h>
+#define FN_STR(x) x.c_str()
+#else
+#include <arpa/inet.h>
+#define FN_STR(x) wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(x).c_str()
+#endif
+
+namespace
+{
+    // Returns the next comma separated token, trimmed from whitespace and " characters
+    bool NextToken(const char*& pPos, const char* pEnd, const char*& pTokBegin, const char*& pTokEnd)
+    {
+        if (pPos > pEnd)
+            return false;
+
+        pTokBegin = pPos;
+        while (pPos < pEnd && *pPos != ',') ++pPos;
+        pTokEnd = pPos++;   // skip the comma, at the end pPos is > pEnd
+
+        while (pTokBegin < pTokEnd && (*pTokBegin == ' ' || *pTokBegin == '\t' || *pTokBegin == '"')) ++pTokBegin;
+        while (pTokEnd > pTokBegin && (pTokEnd[-1] == ' ' || pTokEnd[-1] == '\t' || pTokEnd[-1] == '"' || pTokEnd[-1] == '\r')) --pTokEnd;
+        return true;
+    }
+
+    template<typename FN>
+    size_t ForEachLine(const wstring& strFileName, FN fnLine)
+    {
+        ifstream fin;
+        fin.open(FN_STR(strFileName), ios::in | ios::binary);
+        if (fin.is_open() == false)
+        {
+            MyTrace("Error: File \'", strFileName, "\' could not be opened");
+            return 0;
+        }
+
+        stringstream ssContent;
+        ssContent << fin.rdbuf();
+        fin.close();
+        const string strContent = ssContent.str();
+
+        size_t nCount = 0;
+        const char* pPos = strContent.c_str();
+        const char* pEnd = pPos + strContent.size();
+        while (pPos < pEnd)
+        {
+            const char* pLineEnd = pPos;
+            while (pLineEnd < pEnd && *pLineEnd != '\n' && *pLineEnd != '#' && *pLineEnd != ';') ++pLineEnd;
+            if (pLineEnd > pPos && fnLine(pPos, pLineEnd) == true)
+                ++nCount;
+            while (pLineEnd < pEnd && *pLineEnd != '\n') ++pLineEnd;   // skip comments
+            pPos = pLineEnd + 1;
+        }
+        return nCount;
+    }
+}
+
+uint64_t HwAddrTable::MakeKey(const uint8_t* pHwAddr)
+{
+    return  static_cast<uint64_t>(pHwAddr[0]) << 40 | static_cast<uint64_t>(pHwAddr[1]) << 32 | static_cast<uint64_t>(pHwAddr[2]) << 24
+          | static_cast<uint64_t>(pHwAddr[3]) << 16 | static_cast<uint64_t>(pHwAddr[4]) << 8 | static_cast<uint64_t>(pHwAddr[5]);
+}
+
+bool HwAddrTable::ParseHwAddr(const char* szBegin, const char* szEnd, uint64_t& nKey)
+{
+    nKey = 0;
+    int nDigits = 0;
+    for (; szBegin < szEnd; ++szBegin)
+    {
+        const char c = *szBegin;
+        uint64_t nNibble;
+        if (c >= '0' && c <= '9') nNibble = c - '0';
+        else if (c >= 'a' && c <= 'f') nNibble = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') nNibble = c - 'A' + 10;
+        else if (c == ':' || c == '-' || c == '.') continue;
+        else return false;
+
+        if (++nDigits > 12)
+            return false;
+        nKey = (nKey << 4) | nNibble;
+    }
+    return nDigits == 12;
+}
+
+void HwAddrTable::AddBlocked(const string& strList)
+{
+    const char* pPos = strList.c_str();
+    const char* pEnd = pPos + strList.size();
+    const char* pTokBegin, *pTokEnd;
+    while (NextToken(pPos, pEnd, pTokBegin, pTokEnd) == true)
+    {
+        uint64_t nKey;
+        if (ParseHwAddr(pTokBegin, pTokEnd, nKey) == true)
+            m_setBlocked.insert(nKey);
+        else if (pTokBegin != pTokEnd)
+            MyTrace("Warnung: invalid MAC address \'", string(pTokBegin, pTokEnd), "\' in HW_Blocked");
+    }
+}
+
+bool HwAddrTable::AddReservation(const string& strLine)
+{
+    const char* pPos = strLine.c_str();
+    const char* pEnd = pPos + strLine.size();
+    const char* pTokBegin, *pTokEnd;
+
+    uint64_t nKey;
+    if (NextToken(pPos, pEnd, pTokBegin, pTokEnd) == false || ParseHwAddr(pTokBegin, pTokEnd, nKey) == false)
+        return false;
+
+    RESERVATION stReserv;
+    uint32_t nIpAddr;
+    if (NextToken(pPos, pEnd, pTokBegin, pTokEnd) == false)
+        return false;
+    stReserv.strIP = string(pTokBegin, pTokEnd);
+    if (::inet_pton(AF_INET, stReserv.strIP.c_str(), &nIpAddr) != 1)
+        return false;
+
+    if (NextToken(pPos, pEnd, pTokBegin, pTokEnd) == true)
+        stReserv.strRouter_IP = string(pTokBegin, pTokEnd);
+    if (NextToken(pPos, pEnd, pTokBegin, pTokEnd) == true)
+        stReserv.strDNS_IP = string(pTokBegin, pTokEnd);
+    if (NextToken(pPos, pEnd, pTokBegin, pTokEnd) == true)
+        stReserv.strDomainName = string(pTokBegin, pTokEnd);
+
+    auto itOld = m_maReservations.find(nKey);
+    if (itOld != end(m_maReservations))
+    {
+        uint32_t nOldIp;
+        if (::inet_pton(AF_INET, itOld->second.strIP.c_str(), &nOldIp) == 1)
+            m_setReservedIp.erase(nOldIp);
+    }
+
+    m_maReservations[nKey] = move(stReserv);
+    m_setReservedIp.insert(nIpAddr);
+    return true;
+}
+
+size_t HwAddrTable::LoadBlockedFile(const wstring& strFileName)
+{
+    return ForEachLine(strFileName, [&](const char* pBegin, const char* pEnd) -> bool
+    {
+        const size_t nOldSize = m_setBlocked.size();
+        AddBlocked(string(pBegin, pEnd));
+        return m_setBlocked.size() > nOldSize;
+    });
+}
+
+size_t HwAddrTable::LoadReservationFile(const wstring& strFileName)
+{
+    return ForEachLine(strFileName, [&](const char* pBegin, const char* pEnd) -> bool
+    {
+        string strLine(pBegin, pEnd);
+        if (strLine.find_first_not_of(" \t\r") == string::npos)
+            return false;
+        if (AddReservation(strLine) == true)
+            return true;
+        MyTrace("Warnung: invalid reservation \'", strLine, "\' in file \'", strFileName, "\'");
+        return false;
+    });
+}
+
+const HwAddrTable::RESERVATION* HwAddrTable::GetReservation(const uint64_t nKey) const
+{
+    if (m_maReservations.empty() == true)
+        return nullptr;
+    const auto itFound = m_maReservations.find(nKey);
+    return itFound != end(m_maReservations) ? &itFound->second : nullptr;
+}
+
+bool HwAddrTable::IsReservedIp(const string& strIpAddr) const
+{
+    uint32_t nIpAddr;
+    if (m_setReservedIp.empty() == true || ::inet_pton(AF_INET, strIpAddr.c_str(), &nIpAddr) != 1)
+        return false;
+    return m_setReservedIp.find(nIpAddr) != end(m_setReservedIp);
+}
+
+vector<string> HwAddrTable::GetReservedIps() const
+{
+    vector<string> vReturn;
+    for (const auto& itReserv : m_maReservations)
+        vReturn.push_back(itReserv.second.strIP);
+    return vReturn;
+}
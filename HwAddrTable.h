@@ -0,0 +1,54 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Blocked MAC addresses and static reservations of a scope. The 48 bit MAC
+// address is packed into an integer, so a lookup is a single hash probe without
+// formating the address into a string.
+class HwAddrTable
+{
+public:
+    typedef struct
+    {
+        string strIP;           // fixed IP address for this client
+        string strRouter_IP;    // optional, overrides the value of the scope
+        string strDNS_IP;       // optional, overrides the value of the scope
+        string strDomainName;   // optional, overrides the value of the scope
+    }RESERVATION;
+
+    static uint64_t MakeKey(const uint8_t* pHwAddr);
+    static bool ParseHwAddr(const char* szBegin, const char* szEnd, uint64_t& nKey);
+
+    void AddBlocked(const string& strList);             // Komma getrennte Liste mit MAC Adressen
+    bool AddReservation(const string& strLine);         // MAC, IP [, Router_IP, DNS_IP, DomainName]
+    size_t LoadBlockedFile(const wstring& strFileName);
+    size_t LoadReservationFile(const wstring& strFileName);
+
+    bool IsBlocked(const uint64_t nKey) const { return m_setBlocked.find(nKey) != end(m_setBlocked); }
+    const RESERVATION* GetReservation(const uint64_t nKey) const;
+    bool IsReservedIp(const string& strIpAddr) const;
+    vector<string> GetReservedIps() const;
+    bool HasReservations() const { return m_maReservations.empty() == false; }
+
+private:
+    unordered_set<uint64_t>               m_setBlocked;
+    unordered_map<uint64_t, RESERVATION>  m_maReservations;
+    unordered_set<uint32_t>               m_setReservedIp;
+};
@@ -0,0 +1,226 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "IcmpProbe.h"
+#include "Trace.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Ws2tcpip.h>
+#define poll WSAPoll
+#define close closesocket
+#define INVALID_FD INVALID_SOCKET
+typedef int socklen_t;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define INVALID_FD -1
+#endif
+
+namespace
+{
+    uint16_t Checksum(const uint8_t* pData, size_t nLen)
+    {
+        uint32_t nSum = 0;
+        for (; nLen > 1; pData += 2, nLen -= 2)
+            nSum += static_cast<uint32_t>(pData[0] << 8 | pData[1]);
+        if (nLen == 1)
+            nSum += static_cast<uint32_t>(pData[0] << 8);
+        while (nSum >> 16)
+            nSum = (nSum & 0xffff) + (nSum >> 16);
+        return static_cast<uint16_t>(~nSum);
+    }
+}
+
+IcmpProbe::IcmpProbe(uint32_t nTimeoutMs, uint32_t nCacheSec) : m_tTimeout(nTimeoutMs), m_tCacheTime(nCacheSec), m_fdSocket(INVALID_FD), m_bRawSocket(true), m_nIdent(0), m_nSequence(0), m_bStop(false), m_nSent(0), m_nInUse(0), m_nCacheHits(0)
+{
+}
+
+IcmpProbe::~IcmpProbe()
+{
+    Stop();
+}
+
+bool IcmpProbe::Start()
+{
+    m_fdSocket = ::socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (m_fdSocket == INVALID_FD)
+    {   // without CAP_NET_RAW we try the ping socket (net.ipv4.ping_group_range)
+        m_fdSocket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+        m_bRawSocket = false;
+    }
+    if (m_fdSocket != INVALID_FD)
+        ::fcntl(m_fdSocket, F_SETFL, ::fcntl(m_fdSocket, F_GETFL) | O_NONBLOCK);
+#else
+    u_long nNonBlocking = 1;
+    if (m_fdSocket != INVALID_FD)
+        ::ioctlsocket(m_fdSocket, FIONBIO, &nNonBlocking);
+#endif
+    if (m_fdSocket == INVALID_FD)
+    {
+        MyTrace("Error: ICMP socket could not be created");
+        return false;
+    }
+
+    m_nIdent = static_cast<uint16_t>(chrono::steady_clock::now().time_since_epoch().count());
+    m_bStop = false;
+    m_thProbe = thread(&IcmpProbe::ProbeThread, this);
+    return true;
+}
+
+void IcmpProbe::Stop()
+{
+    m_bStop = true;
+    if (m_thProbe.joinable() == true)
+        m_thProbe.join();
+    if (m_fdSocket != INVALID_FD)
+    {
+        ::close(m_fdSocket);
+        m_fdSocket = INVALID_FD;
+    }
+}
+
+IcmpProbe::RESULT IcmpProbe::Check(const string& strIpAddr, FN_DONE fnDone)
+{
+    uint32_t nIpAddr;
+    if (m_fdSocket == INVALID_FD || ::inet_pton(AF_INET, strIpAddr.c_str(), &nIpAddr) != 1)
+        return PROBE_FREE;
+
+    lock_guard<mutex> lock(m_mtxProbe);
+    const auto tNow = chrono::steady_clock::now();
+
+    const auto itCache = m_maCache.find(nIpAddr);
+    if (itCache != end(m_maCache) && tNow < itCache->second.second)
+    {
+        ++m_nCacheHits;
+        return itCache->second.first == true ? PROBE_IN_USE : PROBE_FREE;
+    }
+
+    auto itPending = m_maPending.find(nIpAddr);
+    if (itPending != end(m_maPending))
+    {   // a probe is already running, we only wait for it
+        itPending->second.vWaiters.push_back(fnDone);
+        return PROBE_PENDING;
+    }
+
+    // ICMP echo request: type, code, checksum, identifier, sequence, 8 byte data
+    uint8_t caPacket[16] = { 8, 0, 0, 0 };
+    caPacket[4] = static_cast<uint8_t>(m_nIdent >> 8); caPacket[5] = static_cast<uint8_t>(m_nIdent);
+    ++m_nSequence;
+    caPacket[6] = static_cast<uint8_t>(m_nSequence >> 8); caPacket[7] = static_cast<uint8_t>(m_nSequence);
+    memcpy(caPacket + 8, "DhcpServ", 8);
+    const uint16_t nChecksum = Checksum(caPacket, sizeof(caPacket));
+    caPacket[2] = static_cast<uint8_t>(nChecksum >> 8); caPacket[3] = static_cast<uint8_t>(nChecksum);
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = nIpAddr;
+    if (::sendto(m_fdSocket, reinterpret_cast<const char*>(caPacket), sizeof(caPacket), 0, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != sizeof(caPacket))
+        return PROBE_FREE;  // the address can not be reached, nobody can answer
+    ++m_nSent;
+
+    const auto tDeadline = tNow + m_tTimeout;
+    m_maPending.emplace(nIpAddr, PENDING({ tDeadline, { fnDone } }));
+    m_mmTimers.emplace(tDeadline, nIpAddr);
+    return PROBE_PENDING;
+}
+
+void IcmpProbe::ProbeThread()
+{
+    auto tLastCleanup = chrono::steady_clock::now();
+
+    while (m_bStop == false)
+    {
+        int nWaitMs = 100;
+        {
+            lock_guard<mutex> lock(m_mtxProbe);
+            if (m_mmTimers.empty() == false)
+                nWaitMs = static_cast<int>(max<int64_t>(0, min<int64_t>(nWaitMs, chrono::duration_cast<chrono::milliseconds>(begin(m_mmTimers)->first - chrono::steady_clock::now()).count() + 1)));
+        }
+
+        struct pollfd pfd = { m_fdSocket, POLLIN, 0 };
+        const int nReady = ::poll(&pfd, 1, nWaitMs);
+
+        vector<tuple<FN_DONE, string, bool>> vCallbacks;
+        {
+            lock_guard<mutex> lock(m_mtxProbe);
+
+            while (nReady > 0)
+            {
+                uint8_t caBuffer[1500];
+                struct sockaddr_in addrFrom = { 0 };
+                socklen_t nAddrLen = sizeof(addrFrom);
+                const int nBytes = static_cast<int>(::recvfrom(m_fdSocket, reinterpret_cast<char*>(caBuffer), sizeof(caBuffer), 0, reinterpret_cast<struct sockaddr*>(&addrFrom), &nAddrLen));
+                if (nBytes <= 0)
+                    break;
+
+                // The raw socket delivers the IP header, the ping socket only the ICMP message with an identifier choosen by the kernel
+                size_t nOffset = m_bRawSocket == true ? static_cast<size_t>(caBuffer[0] & 0x0f) * 4 : 0;
+                if (static_cast<size_t>(nBytes) < nOffset + 8 || caBuffer[nOffset] != 0)   // 0 = echo reply
+                    continue;
+                if (m_bRawSocket == true && static_cast<uint16_t>(caBuffer[nOffset + 4] << 8 | caBuffer[nOffset + 5]) != m_nIdent)
+                    continue;
+
+                Finish(addrFrom.sin_addr.s_addr, true, vCallbacks);
+            }
+
+            // timeouts, nobody answered
+            const auto tNow = chrono::steady_clock::now();
+            while (m_mmTimers.empty() == false && begin(m_mmTimers)->first <= tNow)
+            {
+                const uint32_t nIpAddr = begin(m_mmTimers)->second;
+                m_mmTimers.erase(begin(m_mmTimers));
+                const auto itPending = m_maPending.find(nIpAddr);
+                if (itPending != end(m_maPending) && itPending->second.tDeadline <= tNow)
+                    Finish(nIpAddr, false, vCallbacks);
+            }
+
+            if (tNow - tLastCleanup > chrono::seconds(10))
+            {
+                tLastCleanup = tNow;
+                for (auto itCache = begin(m_maCache); itCache != end(m_maCache);)
+                {
+                    if (itCache->second.second <= tNow)
+                        itCache = m_maCache.erase(itCache);
+                    else
+                        ++itCache;
+                }
+            }
+        }
+
+        for (auto& itCallback : vCallbacks)
+            get<0>(itCallback)(get<1>(itCallback), get<2>(itCallback));
+    }
+}
+
+void IcmpProbe::Finish(uint32_t nIpAddr, bool bInUse, vector<tuple<FN_DONE, string, bool>>& vCallbacks)
+{
+    const auto itPending = m_maPending.find(nIpAddr);
+    if (itPending == end(m_maPending))
+        return;
+
+    if (bInUse == true)
+        ++m_nInUse;
+    m_maCache[nIpAddr] = make_pair(bInUse, chrono::steady_clock::now() + m_tCacheTime);
+
+    char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 };
+    const string strIpAddr = inet_ntop(AF_INET, &nIpAddr, caAddrBuf, sizeof(caAddrBuf));
+    for (auto& fnDone : itPending->second.vWaiters)
+        vCallbacks.emplace_back(fnDone, strIpAddr, bInUse);
+    m_maPending.erase(itPending);
+}
@@ -0,0 +1,86 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Ping of an address before it is offered. One raw ICMP socket is used for all
+// probes, the echo request is send by the caller and never waits. A thread
+// receives the replies and handles the timeouts, the result is cached for some
+// time and the waiting callers are called back.
+class IcmpProbe
+{
+public:
+    enum RESULT : uint8_t
+    {
+        PROBE_FREE = 0,
+        PROBE_IN_USE,
+        PROBE_PENDING
+    };
+
+    typedef function<void(const string&, bool)> FN_DONE;  // IP address, in use
+
+    IcmpProbe(uint32_t nTimeoutMs, uint32_t nCacheSec);
+    ~IcmpProbe();
+
+    bool Start();
+    void Stop();
+
+    RESULT Check(const string& strIpAddr, FN_DONE fnDone);
+
+    uint64_t GetSent() const { return m_nSent; }
+    uint64_t GetInUse() const { return m_nInUse; }
+    uint64_t GetCacheHits() const { return m_nCacheHits; }
+
+private:
+    typedef struct
+    {
+        chrono::steady_clock::time_point tDeadline;
+        vector<FN_DONE> vWaiters;
+    }PENDING;
+
+    void ProbeThread();
+    void Finish(uint32_t nIpAddr, bool bInUse, vector<tuple<FN_DONE, string, bool>>& vCallbacks);
+
+private:
+    chrono::milliseconds m_tTimeout;
+    chrono::seconds      m_tCacheTime;
+#if defined(_WIN32) || defined(_WIN64)
+    uintptr_t            m_fdSocket;
+#else
+    int                  m_fdSocket;
+#endif
+    bool                 m_bRawSocket;  // false = unprivileged ICMP datagram socket
+    uint16_t             m_nIdent;
+    uint16_t             m_nSequence;
+    thread               m_thProbe;
+    atomic<bool>         m_bStop;
+    mutex                m_mtxProbe;
+    unordered_map<uint32_t, PENDING> m_maPending;                // network byte order
+    multimap<chrono::steady_clock::time_point, uint32_t> m_mmTimers;
+    unordered_map<uint32_t, pair<bool, chrono::steady_clock::time_point>> m_maCache;  // in use, valid until
+    atomic<uint64_t>     m_nSent;
+    atomic<uint64_t>     m_nInUse;
+    atomic<uint64_t>     m_nCacheHits;
+};
@@ -0,0 +1,127 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include "IngressQueue.h"
+
+IngressQueue::IngressQueue(size_t nCapacity, uint16_t nRetrySecs) : m_nCapacity(nCapacity), m_nRetrySecs(nRetrySecs), m_bStop(false)
+{
+    for (int n = 0; n < PRIO_COUNT; ++n)
+    {
+        m_nDepth[n] = 0;
+        m_nShed[n] = 0;
+    }
+}
+
+void IngressQueue::SetLimits(size_t nCapacity, uint16_t nRetrySecs)
+{
+    lock_guard<mutex> lock(m_mtxQueue);
+    m_nCapacity = nCapacity > 0 ? nCapacity : 1;
+    m_nRetrySecs = nRetrySecs;
+}
+
+IngressQueue::PRIORITY IngressQueue::Classify(const PACKETPEEK& stPeek) const
+{
+    switch (stPeek.nMsgType)
+    {
+    case 3:     // DHCPREQUEST
+        if (stPeek.nCiaddr != 0)
+            return PRIO_BOUND;  // RENEWING / REBINDING
+        return PRIO_RETRY;      // SELECTING / INIT-REBOOT, the client is in the middle of a handshake
+    case 4:     // DHCPDECLINE
+    case 7:     // DHCPRELEASE
+    case 8:     // DHCPINFORM
+        return PRIO_BOUND;
+    default:
+        return m_nRetrySecs != 0 && stPeek.nSecs >= m_nRetrySecs ? PRIO_RETRY : PRIO_NEW;
+    }
+}
+
+bool IngressQueue::Push(ITEM&& stItem)
+{
+    const PRIORITY nPrio = stItem.nStep != 0 ? PRIO_RETRY : Classify(stItem.stPeek);
+    {
+        lock_guard<mutex> lock(m_mtxQueue);
+        if (m_bStop == true)
+            return false;
+
+        size_t nTotal = 0;
+        for (int n = 0; n < PRIO_COUNT; ++n)
+            nTotal += m_dqItems[n].size();
+
+        if (nTotal >= m_nCapacity)
+        {
+            int nLowest = PRIO_COUNT - 1;
+            while (nLowest > nPrio && m_dqItems[nLowest].empty() == true)
+                --nLowest;
+            if (nLowest <= nPrio)
+            {   // nothing with less priority in the queue, the new packet is dropped
+                ++m_nShed[nPrio];
+                return false;
+            }
+            m_dqItems[nLowest].pop_front();
+            m_nDepth[nLowest] = m_dqItems[nLowest].size();
+            ++m_nShed[nLowest];
+        }
+
+        m_dqItems[nPrio].push_back(move(stItem));
+        m_nDepth[nPrio] = m_dqItems[nPrio].size();
+    }
+    m_cvQueue.notify_one();
+    return true;
+}
+
+bool IngressQueue::Pop(ITEM& stItem)
+{
+    unique_lock<mutex> lock(m_mtxQueue);
+    for (;;)
+    {
+        if (m_bStop == true)
+            return false;
+
+        for (int n = 0; n < PRIO_COUNT; ++n)
+        {
+            if (m_dqItems[n].empty() == false)
+            {
+                stItem = move(m_dqItems[n].front());
+                m_dqItems[n].pop_front();
+                m_nDepth[n] = m_dqItems[n].size();
+                return true;
+            }
+        }
+        m_cvQueue.wait(lock);
+    }
+}
+
+void IngressQueue::Drain(vector<ITEM>& vItems)
+{
+    lock_guard<mutex> lock(m_mtxQueue);
+    for (int n = 0; n < PRIO_COUNT; ++n)
+    {
+        for (auto& stItem : m_dqItems[n])
+            vItems.push_back(move(stItem));
+        m_dqItems[n].clear();
+        m_nDepth[n] = 0;
+    }
+}
+
+void IngressQueue::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_mtxQueue);
+        m_bStop = true;
+        for (int n = 0; n < PRIO_COUNT; ++n)
+        {
+            m_dqItems[n].clear();
+            m_nDepth[n] = 0;
+        }
+    }
+    m_cvQueue.notify_all();
+}
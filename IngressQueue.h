@@ -0,0 +1,74 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "PacketPeek.h"
+
+using namespace std;
+
+// Bounded queue between the receive and the processing of the requests. The
+// packets are classified by the fixed header only. Clients which already have
+// a lease (RENEWING / REBINDING, RELEASE, DECLINE, INFORM) are served first,
+// then the clients which are waiting for a long time (secs) or finish a
+// handshake, the new DISCOVERs last. If the queue is full the oldest packet
+// of the lowest class is dropped. A resumed request counts as handshake.
+class IngressQueue
+{
+public:
+    enum PRIORITY : uint8_t
+    {
+        PRIO_BOUND = 0,
+        PRIO_RETRY,
+        PRIO_NEW,
+        PRIO_COUNT
+    };
+
+    typedef struct
+    {
+        const void*     pSocket;    // the socket the packet came from
+        PACKETPEEK      stPeek;
+        vector<uint8_t> vData;
+        uint8_t         nStep;      // RequestTable::STEP, 0 = new from the network
+        string          strProbeIp; // STEP_PROBE: the pinged address
+        bool            bInUse;     // STEP_PROBE: the address has answered
+    }ITEM;
+
+    IngressQueue(size_t nCapacity, uint16_t nRetrySecs);
+
+    void SetLimits(size_t nCapacity, uint16_t nRetrySecs);
+    PRIORITY Classify(const PACKETPEEK& stPeek) const;
+    bool Push(ITEM&& stItem);   // false if the packet was dropped
+    bool Pop(ITEM& stItem);     // waits for the next packet, false if the queue is stopped
+    void Drain(vector<ITEM>& vItems);   // takes the queued packets, the best first
+    void Stop();
+
+    size_t GetDepth(PRIORITY nPrio) const { return m_nDepth[nPrio]; }
+    uint64_t GetShed(PRIORITY nPrio) const { return m_nShed[nPrio]; }
+
+private:
+    mutex              m_mtxQueue;
+    condition_variable m_cvQueue;
+    deque<ITEM>        m_dqItems[PRIO_COUNT];
+    size_t             m_nCapacity;
+    uint16_t           m_nRetrySecs;
+    bool               m_bStop;
+    atomic<size_t>     m_nDepth[PRIO_COUNT];
+    atomic<uint64_t>   m_nShed[PRIO_COUNT];
+};
@@ -0,0 +1,172 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include "IpPool.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+IpPool::IpPool(const string& strFrom, const string& strTo) : m_nFirst(0), m_nNext(0), m_nInUse(0), m_nExcluded(0)
+{
+    uint32_t nFrom, nTo;
+    if (::inet_pton(AF_INET, strFrom.c_str(), &nFrom) == 1 && ::inet_pton(AF_INET, strTo.c_str(), &nTo) == 1 && ntohl(nFrom) <= ntohl(nTo))
+    {
+        m_nFirst = ntohl(nFrom);
+        m_vState.resize(ntohl(nTo) - m_nFirst + 1, ADDR_FREE);
+    }
+}
+
+bool IpPool::Allocate(string& strIpAddr, size_t nPart, size_t nParts, bool* pReused)
+{
+    LiftQuarantine();
+    if (m_nInUse >= Size() || nPart >= nParts)
+        return false;
+
+    const size_t nFirst = m_vState.size() * nPart / nParts;
+    const size_t nCount = m_vState.size() * (nPart + 1) / nParts - nFirst;
+    if (nCount == 0)
+        return false;
+    const size_t nStart = m_nNext >= nFirst && m_nNext < nFirst + nCount ? m_nNext - nFirst : 0;
+
+    // a free address, or when there is none, the address of a client that has released it
+    size_t nFound = m_vState.size();
+    for (size_t n = 0; n < nCount; ++n)
+    {
+        const size_t nIndex = nFirst + (nStart + n) % nCount;
+        if (m_vState[nIndex] == ADDR_FREE)
+        {
+            nFound = nIndex;
+            break;
+        }
+        if (m_vState[nIndex] == ADDR_RELEASED && nFound == m_vState.size())
+            nFound = nIndex;
+    }
+    if (nFound == m_vState.size())
+        return false;
+
+    if (pReused != nullptr)
+        *pReused = m_vState[nFound] == ADDR_RELEASED;
+    m_vState[nFound] = ADDR_USED;
+    ++m_nInUse;
+    m_nNext = nFound + 1;
+
+    const uint32_t nIpAddr = htonl(static_cast<uint32_t>(m_nFirst + nFound));
+    char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 };
+    strIpAddr = inet_ntop(AF_INET, &nIpAddr, caAddrBuf, sizeof(caAddrBuf));
+    return true;
+}
+
+bool IpPool::MarkUsed(const string& strIpAddr)
+{
+    size_t nIndex;
+    if (ToIndex(strIpAddr, nIndex) == false)
+        return false;
+    if (m_vState[nIndex] == ADDR_EXCLUDED)
+        return true;
+    if (m_vState[nIndex] == ADDR_FREE || m_vState[nIndex] == ADDR_RELEASED)
+        ++m_nInUse;
+    m_vState[nIndex] = ADDR_USED;
+    return true;
+}
+
+void IpPool::MarkReleased(const string& strIpAddr)
+{
+    size_t nIndex;
+    if (ToIndex(strIpAddr, nIndex) == true && m_vState[nIndex] == ADDR_USED)
+    {
+        m_vState[nIndex] = ADDR_RELEASED;
+        --m_nInUse;
+    }
+}
+
+bool IpPool::Reclaim(const string& strIpAddr)
+{
+    size_t nIndex;
+    if (ToIndex(strIpAddr, nIndex) == false || m_vState[nIndex] == ADDR_EXCLUDED)
+        return true;
+    if (m_vState[nIndex] == ADDR_USED || m_vState[nIndex] == ADDR_QUARANTINE)
+        return false;
+    m_vState[nIndex] = ADDR_USED;
+    ++m_nInUse;
+    return true;
+}
+
+void IpPool::Exclude(const string& strIpAddr)
+{
+    size_t nIndex;
+    if (ToIndex(strIpAddr, nIndex) == false || m_vState[nIndex] == ADDR_EXCLUDED)
+        return;
+    if (m_vState[nIndex] == ADDR_USED || m_vState[nIndex] == ADDR_QUARANTINE)
+        --m_nInUse;
+    m_vState[nIndex] = ADDR_EXCLUDED;
+    ++m_nExcluded;
+}
+
+void IpPool::Release(const string& strIpAddr)
+{
+    size_t nIndex;
+    if (ToIndex(strIpAddr, nIndex) == true && (m_vState[nIndex] == ADDR_USED || m_vState[nIndex] == ADDR_RELEASED))
+    {
+        if (m_vState[nIndex] == ADDR_USED)
+            --m_nInUse;
+        m_vState[nIndex] = ADDR_FREE;
+    }
+}
+
+bool IpPool::Quarantine(const string& strIpAddr, chrono::seconds tDuration)
+{
+    size_t nIndex;
+    if (ToIndex(strIpAddr, nIndex) == false || m_vState[nIndex] == ADDR_EXCLUDED)
+        return false;
+    if (m_vState[nIndex] == ADDR_FREE || m_vState[nIndex] == ADDR_RELEASED)
+        ++m_nInUse;
+    if (m_vState[nIndex] != ADDR_QUARANTINE)
+        m_dqQuarantine.emplace_back(chrono::steady_clock::now() + tDuration, nIndex);
+    m_vState[nIndex] = ADDR_QUARANTINE;
+    return true;
+}
+
+void IpPool::LiftQuarantine()
+{
+    // all entries have the same duration, the oldest is in front
+    const auto tNow = chrono::steady_clock::now();
+    while (m_dqQuarantine.empty() == false && m_dqQuarantine.front().first <= tNow)
+    {
+        const size_t nIndex = m_dqQuarantine.front().second;
+        m_dqQuarantine.pop_front();
+        if (m_vState[nIndex] == ADDR_QUARANTINE)    // MarkUsed may have given it to a client in the meantime
+        {
+            m_vState[nIndex] = ADDR_FREE;
+            --m_nInUse;
+        }
+    }
+}
+
+bool IpPool::Contains(const string& strIpAddr) const
+{
+    size_t nIndex;
+    return ToIndex(strIpAddr, nIndex);
+}
+
+bool IpPool::ToIndex(const string& strIpAddr, size_t& nIndex) const
+{
+    uint32_t nIpAddr;
+    if (::inet_pton(AF_INET, strIpAddr.c_str(), &nIpAddr) != 1)
+        return false;
+    nIpAddr = ntohl(nIpAddr);
+    if (nIpAddr < m_nFirst || nIpAddr - m_nFirst >= m_vState.size())
+        return false;
+    nIndex = nIpAddr - m_nFirst;
+    return true;
+}
@@ -0,0 +1,64 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Address range IP_From - IP_To of a scope or client class. Every address has
+// a state, the search for a free address continues where the last one stopped.
+// An address that answered a ping is quarantined and comes back after some time.
+// A released address stays with its last client until no free address is left.
+// Blocked and reserved addresses are excluded, they do not count in Size().
+class IpPool
+{
+public:
+    IpPool(const string& strFrom, const string& strTo);
+
+    bool Allocate(string& strIpAddr, size_t nPart = 0, size_t nParts = 1, bool* pReused = nullptr);   // from the nPart-th slice of nParts, pReused = a released address was taken
+    bool MarkUsed(const string& strIpAddr);
+    void MarkReleased(const string& strIpAddr);     // not used, but kept for the last client
+    bool Reclaim(const string& strIpAddr);          // the last client comes back, false if the address has an other owner
+    void Exclude(const string& strIpAddr);
+    void Release(const string& strIpAddr);     // quarantined addresses stay blocked
+    bool Quarantine(const string& strIpAddr, chrono::seconds tDuration);
+    bool Contains(const string& strIpAddr) const;
+
+    size_t Size() const { return m_vState.size() - m_nExcluded; }
+    size_t InUse() const { return m_nInUse; }
+
+private:
+    bool ToIndex(const string& strIpAddr, size_t& nIndex) const;
+    void LiftQuarantine();
+
+    enum ADDR_STATE : uint8_t
+    {
+        ADDR_FREE = 0,
+        ADDR_USED,
+        ADDR_QUARANTINE,
+        ADDR_RELEASED,
+        ADDR_EXCLUDED
+    };
+
+private:
+    uint32_t        m_nFirst;   // host byte order
+    vector<uint8_t> m_vState;
+    size_t          m_nNext;
+    size_t          m_nInUse;
+    size_t          m_nExcluded;
+    deque<pair<chrono::steady_clock::time_point, size_t>> m_dqQuarantine;  // end of the quarantine, index
+};
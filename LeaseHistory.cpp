@@ -0,0 +1,430 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+
+#include "LeaseHistory.h"
+#include "Trace.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#include <fcntl.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const uint32_t s_nMagic = 0x44534842;       // "DSHB"
+    const size_t   s_nHeaderSize = 40;          // magic(4) payload size(4) count(4) time min(8) time max(8) ip min(4) ip max(4) checksum(4)
+    const auto     s_tFlushInterval = chrono::seconds(60);     // a block that is not full is written after this time
+    const size_t   s_nMaxPayload = 64 * 1024 * 1024;           // the checksum does not cover the header, the sizes are checked before we allocate
+
+    typedef struct
+    {
+        size_t   nPayload;
+        size_t   nCount;
+        int64_t  tMin;
+        int64_t  tMax;
+        uint32_t nIpMin;
+        uint32_t nIpMax;
+        uint32_t nChecksum;
+    }BLOCKHEADER;
+
+    void PutUInt(vector<uint8_t>& vBuf, uint64_t nValue, int nBytes)
+    {
+        for (int n = nBytes - 1; n >= 0; --n)
+            vBuf.push_back(static_cast<uint8_t>(nValue >> (n * 8)));
+    }
+
+    uint64_t GetUInt(const uint8_t*& pPos, int nBytes)
+    {
+        uint64_t nValue = 0;
+        for (int n = 0; n < nBytes; ++n)
+            nValue = (nValue << 8) | *pPos++;
+        return nValue;
+    }
+
+    // 7 bit per byte, small differences need one byte
+    void PutVarint(vector<uint8_t>& vBuf, int64_t nValue)
+    {
+        uint64_t nZigZag = (static_cast<uint64_t>(nValue) << 1) ^ static_cast<uint64_t>(nValue >> 63);
+        while (nZigZag >= 0x80)
+        {
+            vBuf.push_back(static_cast<uint8_t>(nZigZag | 0x80));
+            nZigZag >>= 7;
+        }
+        vBuf.push_back(static_cast<uint8_t>(nZigZag));
+    }
+
+    bool GetVarint(const uint8_t*& pPos, const uint8_t* pEnd, int64_t& nValue)
+    {
+        uint64_t nZigZag = 0;
+        for (int nShift = 0; pPos < pEnd && nShift < 64; nShift += 7)
+        {
+            const uint8_t c = *pPos++;
+            nZigZag |= static_cast<uint64_t>(c & 0x7f) << nShift;
+            if ((c & 0x80) == 0)
+            {
+                nValue = static_cast<int64_t>(nZigZag >> 1) ^ -static_cast<int64_t>(nZigZag & 1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // false if it is no header of a block. An event needs at least 6 bytes in the payload
+    bool ParseHeader(const uint8_t* pPos, BLOCKHEADER& stHeader)
+    {
+        const uint32_t nMagic = static_cast<uint32_t>(GetUInt(pPos, 4));
+        stHeader.nPayload = static_cast<size_t>(GetUInt(pPos, 4));
+        stHeader.nCount = static_cast<size_t>(GetUInt(pPos, 4));
+        stHeader.tMin = static_cast<int64_t>(GetUInt(pPos, 8));
+        stHeader.tMax = static_cast<int64_t>(GetUInt(pPos, 8));
+        stHeader.nIpMin = static_cast<uint32_t>(GetUInt(pPos, 4));
+        stHeader.nIpMax = static_cast<uint32_t>(GetUInt(pPos, 4));
+        stHeader.nChecksum = static_cast<uint32_t>(GetUInt(pPos, 4));
+        return nMagic == s_nMagic && stHeader.nPayload <= s_nMaxPayload && stHeader.nCount * 6 <= stHeader.nPayload
+            && stHeader.tMin <= stHeader.tMax && stHeader.nIpMin <= stHeader.nIpMax;
+    }
+
+    uint32_t Checksum(const uint8_t* pData, size_t nLen)
+    {   // FNV-1a, finds a block that was not written completely
+        uint32_t nHash = 2166136261u;
+        for (size_t n = 0; n < nLen; ++n)
+            nHash = (nHash ^ pData[n]) * 16777619u;
+        return nHash;
+    }
+
+    // column with the index in a dictionary of the different values
+    void PutDictionary(vector<uint8_t>& vBuf, const vector<string>& vValues)
+    {
+        map<string, size_t> maIndex;
+        vector<size_t> vIndex;
+        vIndex.reserve(vValues.size());
+        for (const auto& strValue : vValues)
+            vIndex.push_back(maIndex.emplace(strValue, maIndex.size()).first->second);
+
+        vector<const string*> vDictionary(maIndex.size());
+        for (const auto& itIndex : maIndex)
+            vDictionary[itIndex.second] = &itIndex.first;
+
+        PutVarint(vBuf, static_cast<int64_t>(vDictionary.size()));
+        for (const auto pValue : vDictionary)
+        {
+            vBuf.push_back(static_cast<uint8_t>(min<size_t>(pValue->size(), 255)));
+            vBuf.insert(end(vBuf), begin(*pValue), begin(*pValue) + min<size_t>(pValue->size(), 255));
+        }
+        for (const auto nIndex : vIndex)
+            PutVarint(vBuf, static_cast<int64_t>(nIndex));
+    }
+
+    bool GetDictionary(const uint8_t*& pPos, const uint8_t* pEnd, size_t nCount, vector<string>& vValues)
+    {
+        int64_t nSize;
+        if (GetVarint(pPos, pEnd, nSize) == false || nSize < 0 || static_cast<uint64_t>(nSize) > nCount)
+            return false;
+        vector<string> vDictionary;
+        for (int64_t n = 0; n < nSize; ++n)
+        {
+            if (pPos >= pEnd || pPos + 1 + *pPos > pEnd)
+                return false;
+            vDictionary.emplace_back(reinterpret_cast<const char*>(pPos) + 1, *pPos);
+            pPos += 1 + *pPos;
+        }
+        vValues.resize(nCount);
+        for (size_t n = 0; n < nCount; ++n)
+        {
+            int64_t nIndex;
+            if (GetVarint(pPos, pEnd, nIndex) == false || nIndex < 0 || nIndex >= nSize)
+                return false;
+            vValues[n] = vDictionary[static_cast<size_t>(nIndex)];
+        }
+        return true;
+    }
+}
+
+LeaseHistory::LeaseHistory(const string& strFile, size_t nBlockSize) : m_strFile(strFile), m_nBlockSize(max<size_t>(nBlockSize, 16)), m_bStop(false), m_nBlocks(0)
+{
+}
+
+LeaseHistory::~LeaseHistory()
+{
+    Stop();
+}
+
+bool LeaseHistory::Start()
+{
+    Repair();
+
+    ofstream fout(m_strFile, ios::out | ios::app | ios::binary);
+    if (fout.is_open() == false)
+        return false;
+
+    m_bStop = false;
+    m_thWriter = thread(&LeaseHistory::WriterThread, this);
+    return true;
+}
+
+// The headers are followed to the end of the file, the payload of the last block is checked. From the first
+// block that is not complete everything is cut off, the new blocks are appended after the last valid one
+void LeaseHistory::Repair()
+{
+    ifstream fin(m_strFile, ios::in | ios::binary);
+    if (fin.is_open() == false)
+        return;
+    fin.seekg(0, ios::end);
+    const uint64_t nFileSize = static_cast<uint64_t>(fin.tellg());
+    fin.seekg(0, ios::beg);
+
+    uint64_t nValid = 0, nLast = 0;
+    BLOCKHEADER stHeader = { 0 };
+    uint8_t caHeader[s_nHeaderSize];
+    while (nValid + s_nHeaderSize <= nFileSize && fin.read(reinterpret_cast<char*>(caHeader), s_nHeaderSize)
+        && ParseHeader(caHeader, stHeader) == true && nValid + s_nHeaderSize + stHeader.nPayload <= nFileSize)
+    {
+        nLast = nValid;
+        nValid += s_nHeaderSize + stHeader.nPayload;
+        fin.seekg(static_cast<streamoff>(nValid), ios::beg);
+    }
+
+    if (nValid > 0)
+    {   // only the last block can be written in part
+        fin.clear();
+        fin.seekg(static_cast<streamoff>(nLast), ios::beg);
+        vector<uint8_t> vPayload;
+        if (fin.read(reinterpret_cast<char*>(caHeader), s_nHeaderSize) && ParseHeader(caHeader, stHeader) == true)
+        {
+            vPayload.resize(stHeader.nPayload);
+            if (!fin.read(reinterpret_cast<char*>(vPayload.data()), vPayload.size()) || Checksum(vPayload.data(), vPayload.size()) != stHeader.nChecksum)
+                nValid = nLast;
+        }
+    }
+    fin.close();
+
+    if (nValid == nFileSize)
+        return;
+    MyTrace("Warnung: lease history ", m_strFile, " has an incomplete block, ", nFileSize - nValid, " bytes cut off");
+#if defined(_WIN32) || defined(_WIN64)
+    int fdFile = -1;
+    if (_sopen_s(&fdFile, m_strFile.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) == 0)
+    {
+        _chsize_s(fdFile, static_cast<__int64>(nValid));
+        _close(fdFile);
+    }
+#else
+    if (::truncate(m_strFile.c_str(), static_cast<off_t>(nValid)) != 0)
+        MyTrace("Error: lease history ", m_strFile, " could not be truncated");
+#endif
+}
+
+void LeaseHistory::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_mtxEvents);
+        m_bStop = true;
+    }
+    m_cvEvents.notify_all();
+    if (m_thWriter.joinable() == true)
+        m_thWriter.join();
+}
+
+void LeaseHistory::Record(EVENT&& stEvent)
+{
+    size_t nEvents;
+    {
+        lock_guard<mutex> lock(m_mtxEvents);
+        m_vEvents.push_back(move(stEvent));
+        nEvents = m_vEvents.size();
+    }
+    if (nEvents >= m_nBlockSize)
+        m_cvEvents.notify_all();
+}
+
+void LeaseHistory::WriterThread()
+{
+    unique_lock<mutex> lock(m_mtxEvents);
+    while (m_bStop == false || m_vEvents.empty() == false)
+    {
+        m_cvEvents.wait_for(lock, s_tFlushInterval, [&]() { return m_bStop == true || m_vEvents.size() >= m_nBlockSize; });
+
+        vector<EVENT> vEvents;
+        vEvents.swap(m_vEvents);
+        lock.unlock();
+
+        for (size_t nStart = 0; nStart < vEvents.size(); nStart += m_nBlockSize)
+        {
+            vector<EVENT> vBlock(make_move_iterator(begin(vEvents) + nStart), make_move_iterator(begin(vEvents) + min(nStart + m_nBlockSize, vEvents.size())));
+            if (WriteBlock(vBlock) == false)
+                MyTrace("Error: writing lease history ", m_strFile);
+        }
+
+        lock.lock();
+    }
+}
+
+bool LeaseHistory::WriteBlock(vector<EVENT>& vEvents)
+{
+    if (vEvents.empty() == true)
+        return true;
+
+    int64_t tMin = vEvents[0].tTime, tMax = vEvents[0].tTime;
+    uint32_t nIpMin = vEvents[0].nIpAddr, nIpMax = vEvents[0].nIpAddr;
+    for (const auto& stEvent : vEvents)
+    {
+        tMin = min(tMin, stEvent.tTime); tMax = max(tMax, stEvent.tTime);
+        nIpMin = min(nIpMin, stEvent.nIpAddr); nIpMax = max(nIpMax, stEvent.nIpAddr);
+    }
+
+    // columns: time, ip, type, scope, hardware address, client identifier
+    vector<uint8_t> vPayload;
+    vPayload.reserve(vEvents.size() * 8);
+    int64_t nLast = tMin;
+    for (const auto& stEvent : vEvents)
+    {
+        PutVarint(vPayload, stEvent.tTime - nLast);
+        nLast = stEvent.tTime;
+    }
+    nLast = nIpMin;
+    for (const auto& stEvent : vEvents)
+    {
+        PutVarint(vPayload, static_cast<int64_t>(stEvent.nIpAddr) - nLast);
+        nLast = stEvent.nIpAddr;
+    }
+    for (const auto& stEvent : vEvents)
+        vPayload.push_back(stEvent.nType);
+    nLast = 0;
+    for (const auto& stEvent : vEvents)
+    {
+        PutVarint(vPayload, static_cast<int64_t>(stEvent.nScope) - nLast);
+        nLast = stEvent.nScope;
+    }
+
+    vector<string> vValues;
+    vValues.reserve(vEvents.size());
+    for (const auto& stEvent : vEvents)
+    {   // without the zeros at the end
+        size_t nLen = stEvent.arHwAddr.size();
+        while (nLen > 0 && stEvent.arHwAddr[nLen - 1] == 0)
+            --nLen;
+        vValues.emplace_back(reinterpret_cast<const char*>(stEvent.arHwAddr.data()), nLen);
+    }
+    PutDictionary(vPayload, vValues);
+    vValues.clear();
+    for (auto& stEvent : vEvents)
+        vValues.push_back(move(stEvent.strClientId));
+    PutDictionary(vPayload, vValues);
+
+    vector<uint8_t> vHeader;
+    vHeader.reserve(s_nHeaderSize);
+    PutUInt(vHeader, s_nMagic, 4);
+    PutUInt(vHeader, vPayload.size(), 4);
+    PutUInt(vHeader, vEvents.size(), 4);
+    PutUInt(vHeader, static_cast<uint64_t>(tMin), 8);
+    PutUInt(vHeader, static_cast<uint64_t>(tMax), 8);
+    PutUInt(vHeader, nIpMin, 4);
+    PutUInt(vHeader, nIpMax, 4);
+    PutUInt(vHeader, Checksum(vPayload.data(), vPayload.size()), 4);
+
+    ofstream fout(m_strFile, ios::out | ios::app | ios::binary);
+    if (fout.is_open() == false)
+        return false;
+    fout.write(reinterpret_cast<const char*>(vHeader.data()), vHeader.size());
+    fout.write(reinterpret_cast<const char*>(vPayload.data()), vPayload.size());
+    fout.close();
+    if (fout.fail() == true)
+        return false;
+
+    ++m_nBlocks;
+    return true;
+}
+
+bool LeaseHistory::Query(const string& strFile, uint32_t nIpAddr, int64_t tFrom, int64_t tTo, FN_EVENT fnEvent)
+{
+    ifstream fin(strFile, ios::in | ios::binary);
+    if (fin.is_open() == false)
+        return false;
+
+    uint8_t caHeader[s_nHeaderSize];
+    BLOCKHEADER stHeader;
+    while (fin.read(reinterpret_cast<char*>(caHeader), s_nHeaderSize))
+    {
+        if (ParseHeader(caHeader, stHeader) == false)
+            return false;
+        const size_t nPayload = stHeader.nPayload;
+        const size_t nCount = stHeader.nCount;
+        const int64_t tMin = stHeader.tMin;
+        const int64_t tMax = stHeader.tMax;
+        const uint32_t nIpMin = stHeader.nIpMin;
+        const uint32_t nIpMax = stHeader.nIpMax;
+        const uint32_t nChecksum = stHeader.nChecksum;
+
+        // only the header of blocks without a matching event is read
+        if (tMax < tFrom || tMin > tTo || (nIpAddr != 0 && (nIpAddr < nIpMin || nIpAddr > nIpMax)))
+        {
+            fin.seekg(nPayload, ios::cur);
+            continue;
+        }
+
+        vector<uint8_t> vPayload(nPayload);
+        if (!fin.read(reinterpret_cast<char*>(vPayload.data()), nPayload) || Checksum(vPayload.data(), nPayload) != nChecksum)
+            return false;   // the last block was not written completely
+
+        vector<EVENT> vEvents(nCount);
+        const uint8_t* pPos = vPayload.data();
+        const uint8_t* pEnd = pPos + vPayload.size();
+        int64_t nValue, nLast = tMin;
+        for (auto& stEvent : vEvents)
+        {
+            if (GetVarint(pPos, pEnd, nValue) == false)
+                return false;
+            stEvent.tTime = nLast += nValue;
+        }
+        nLast = nIpMin;
+        for (auto& stEvent : vEvents)
+        {
+            if (GetVarint(pPos, pEnd, nValue) == false)
+                return false;
+            stEvent.nIpAddr = static_cast<uint32_t>(nLast += nValue);
+        }
+        if (static_cast<size_t>(pEnd - pPos) < nCount)
+            return false;
+        for (auto& stEvent : vEvents)
+            stEvent.nType = *pPos++;
+        nLast = 0;
+        for (auto& stEvent : vEvents)
+        {
+            if (GetVarint(pPos, pEnd, nValue) == false)
+                return false;
+            stEvent.nScope = static_cast<uint32_t>(nLast += nValue);
+        }
+        vector<string> vHwAddr, vClientId;
+        if (GetDictionary(pPos, pEnd, nCount, vHwAddr) == false || GetDictionary(pPos, pEnd, nCount, vClientId) == false)
+            return false;
+
+        for (size_t n = 0; n < nCount; ++n)
+        {
+            EVENT& stEvent = vEvents[n];
+            if ((nIpAddr != 0 && stEvent.nIpAddr != nIpAddr) || stEvent.tTime < tFrom || stEvent.tTime > tTo)
+                continue;
+            stEvent.arHwAddr.fill(0);
+            copy(begin(vHwAddr[n]), begin(vHwAddr[n]) + min<size_t>(vHwAddr[n].size(), 16), begin(stEvent.arHwAddr));
+            stEvent.strClientId = move(vClientId[n]);
+            fnEvent(stEvent);
+        }
+    }
+    return true;
+}
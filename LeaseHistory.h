@@ -0,0 +1,82 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Append only archive of the lease changes. The events are collected in memory and
+// written by a thread as blocks. A block stores every field as a column: times and
+// addresses as delta coded varints, hardware addresses and client identifiers as
+// index into a dictionary of the block. The block header has the time and address
+// range, a query reads only the blocks that can contain the searched event. Start
+// cuts a block off that was not written completely (the process died while writing).
+class LeaseHistory
+{
+public:
+    enum EVENT_TYPE : uint8_t
+    {
+        EVENT_REMOVED = 0,      // the other values are the IP_FLAGS of the lease
+        EVENT_OFFER = 1,
+        EVENT_LEASE = 2,
+        EVENT_RELEASE = 4,
+        EVENT_DECLINE = 8
+    };
+
+    typedef struct
+    {
+        int64_t  tTime;         // time_t
+        array<uint8_t, 16> arHwAddr;
+        string   strClientId;
+        uint32_t nIpAddr;       // host byte order
+        uint8_t  nType;
+        uint32_t nScope;        // address of the scope, host byte order
+    }EVENT;
+
+    typedef function<void(const EVENT&)> FN_EVENT;
+
+    LeaseHistory(const string& strFile, size_t nBlockSize);
+    ~LeaseHistory();
+
+    bool Start();
+    void Stop();
+    void Record(EVENT&& stEvent);
+
+    uint64_t GetBlocks() const { return m_nBlocks; }
+
+    // all events of nIpAddr (0 = all addresses) from tFrom to tTo
+    static bool Query(const string& strFile, uint32_t nIpAddr, int64_t tFrom, int64_t tTo, FN_EVENT fnEvent);
+
+private:
+    void Repair();
+    void WriterThread();
+    bool WriteBlock(vector<EVENT>& vEvents);
+
+private:
+    string   m_strFile;
+    size_t   m_nBlockSize;      // events per block
+    thread   m_thWriter;
+    mutex    m_mtxEvents;
+    condition_variable m_cvEvents;
+    bool     m_bStop;
+    vector<EVENT> m_vEvents;
+    atomic<uint64_t> m_nBlocks;
+};
@@ -0,0 +1,505 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "LeaseImport.h"
+#include "Trace.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    enum TOKEN_TYPE : uint8_t
+    {
+        TOKEN_END = 0,
+        TOKEN_WORD,
+        TOKEN_STRING,       // without the quotes, escapes not resolved
+        TOKEN_SEMICOLON,
+        TOKEN_OPEN,
+        TOKEN_CLOSE
+    };
+
+    typedef struct
+    {
+        TOKEN_TYPE nType;
+        const char* pStart;
+        size_t nLen;
+    }TOKEN;
+
+    // characters that end a word
+    struct Delimiter
+    {
+        Delimiter() : arTable()
+        {
+            for (const char* p = " \t\r\n;{}\"#"; *p != 0; ++p)
+                arTable[static_cast<uint8_t>(*p)] = true;
+        }
+        bool arTable[256];
+    };
+    const Delimiter s_Delimiter;
+
+    // Tokens of the dhcpd.leases syntax, # starts a comment
+    class Tokenizer
+    {
+    public:
+        Tokenizer(const char* pPos, const char* pEnd) : m_pPos(pPos), m_pEnd(pEnd), m_nLine(1) {}
+
+        TOKEN Next()
+        {
+            for (;;)
+            {
+                while (m_pPos < m_pEnd && (*m_pPos == ' ' || *m_pPos == '\t' || *m_pPos == '\r' || *m_pPos == '\n'))
+                {
+                    if (*m_pPos++ == '\n')
+                        ++m_nLine;
+                }
+                if (m_pPos < m_pEnd && *m_pPos == '#')
+                {
+                    const char* pEol = static_cast<const char*>(memchr(m_pPos, '\n', m_pEnd - m_pPos));
+                    m_pPos = pEol != nullptr ? pEol : m_pEnd;
+                    continue;
+                }
+                break;
+            }
+            if (m_pPos >= m_pEnd)
+                return TOKEN({ TOKEN_END, m_pEnd, 0 });
+
+            const char* pStart = m_pPos;
+            switch (*m_pPos)
+            {
+            case ';': ++m_pPos; return TOKEN({ TOKEN_SEMICOLON, pStart, 1 });
+            case '{': ++m_pPos; return TOKEN({ TOKEN_OPEN, pStart, 1 });
+            case '}': ++m_pPos; return TOKEN({ TOKEN_CLOSE, pStart, 1 });
+            case '"':
+                for (++m_pPos; m_pPos < m_pEnd && *m_pPos != '"'; ++m_pPos)
+                {
+                    if (*m_pPos == '\\' && m_pPos + 1 < m_pEnd)
+                        ++m_pPos;
+                    else if (*m_pPos == '\n')
+                        ++m_nLine;
+                }
+                m_pPos = min(m_pPos + 1, m_pEnd);
+                return TOKEN({ TOKEN_STRING, pStart + 1, static_cast<size_t>(max<ptrdiff_t>(m_pPos - pStart - 2, 0)) });
+            }
+            while (m_pPos < m_pEnd && s_Delimiter.arTable[static_cast<uint8_t>(*m_pPos)] == false)
+                ++m_pPos;
+            return TOKEN({ TOKEN_WORD, pStart, static_cast<size_t>(m_pPos - pStart) });
+        }
+
+        // the rest of a statement, with a block in it
+        void SkipStatement(TOKEN stToken)
+        {
+            int nDepth = 0;
+            for (; stToken.nType != TOKEN_END; stToken = Next())
+            {
+                if (stToken.nType == TOKEN_OPEN)
+                    ++nDepth;
+                else if (stToken.nType == TOKEN_CLOSE && --nDepth <= 0)
+                    return;
+                else if (stToken.nType == TOKEN_SEMICOLON && nDepth == 0)
+                    return;
+            }
+        }
+
+        size_t GetLine() const { return m_nLine; }
+
+    private:
+        const char* m_pPos;
+        const char* m_pEnd;
+        size_t m_nLine;
+    };
+
+    template<size_t N>
+    bool Equal(const TOKEN& stToken, const char (&szWord)[N])
+    {
+        return stToken.nType == TOKEN_WORD && stToken.nLen == N - 1 && memcmp(stToken.pStart, szWord, N - 1) == 0;
+    }
+
+    bool ParseIp(const char* pPos, size_t nLen, uint32_t& nIpAddr)
+    {
+        uint8_t arAddr[4];
+        const char* pEnd = pPos + nLen;
+        for (int n = 0; n < 4; ++n)
+        {
+            uint32_t nValue = 0;
+            const char* pStart = pPos;
+            while (pPos < pEnd && *pPos >= '0' && *pPos <= '9' && pPos - pStart < 3)
+                nValue = nValue * 10 + (*pPos++ - '0');
+            if (pPos == pStart || nValue > 255 || (n < 3 && (pPos >= pEnd || *pPos++ != '.')))
+                return false;
+            arAddr[n] = static_cast<uint8_t>(nValue);
+        }
+        if (pPos != pEnd)
+            return false;
+        memcpy(&nIpAddr, arAddr, 4);
+        return true;
+    }
+
+    int HexDigit(char c)
+    {
+        return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    }
+
+    // 00:11:2a or 0:11:2a, the separator is ':' or '-'
+    bool ParseHex(const char* pPos, size_t nLen, uint8_t* pOut, size_t nMax, uint8_t& nOutLen)
+    {
+        const char* pEnd = pPos + nLen;
+        nOutLen = 0;
+        while (pPos < pEnd)
+        {
+            int nHigh = HexDigit(*pPos++), nLow = pPos < pEnd ? HexDigit(*pPos) : -1;
+            if (nHigh < 0 || nOutLen >= nMax)
+                return false;
+            if (nLow >= 0)
+            {
+                nHigh = nHigh * 16 + nLow;
+                ++pPos;
+            }
+            pOut[nOutLen++] = static_cast<uint8_t>(nHigh);
+            if (pPos < pEnd && *pPos != ':' && *pPos != '-')
+                return false;
+            if (pPos < pEnd && ++pPos == pEnd)
+                return false;
+        }
+        return nOutLen > 0;
+    }
+
+    // "\001\000\021" with octal and \x escapes
+    void Unescape(const TOKEN& stToken, uint8_t* pOut, size_t nMax, uint8_t& nOutLen)
+    {
+        nOutLen = 0;
+        for (const char* pPos = stToken.pStart, *pEnd = stToken.pStart + stToken.nLen; pPos < pEnd && nOutLen < nMax; ++pPos)
+        {
+            if (*pPos != '\\' || pPos + 1 >= pEnd)
+            {
+                pOut[nOutLen++] = static_cast<uint8_t>(*pPos);
+                continue;
+            }
+            ++pPos;
+            if (*pPos >= '0' && *pPos <= '7')
+            {
+                uint32_t nValue = 0;
+                for (int n = 0; n < 3 && pPos < pEnd && *pPos >= '0' && *pPos <= '7'; ++n)
+                    nValue = nValue * 8 + (*pPos++ - '0');
+                --pPos;
+                pOut[nOutLen++] = static_cast<uint8_t>(nValue);
+            }
+            else if (*pPos == 'x' && pPos + 2 < pEnd && HexDigit(pPos[1]) >= 0 && HexDigit(pPos[2]) >= 0)
+            {
+                pOut[nOutLen++] = static_cast<uint8_t>(HexDigit(pPos[1]) * 16 + HexDigit(pPos[2]));
+                pPos += 2;
+            }
+            else
+                pOut[nOutLen++] = static_cast<uint8_t>(*pPos == 'n' ? '\n' : *pPos == 't' ? '\t' : *pPos);
+        }
+    }
+
+    bool ParseNumber(const char*& pPos, const char* pEnd, int64_t& nValue)
+    {
+        const char* pStart = pPos;
+        nValue = 0;
+        while (pPos < pEnd && *pPos >= '0' && *pPos <= '9')
+            nValue = nValue * 10 + (*pPos++ - '0');
+        return pPos != pStart;
+    }
+
+    // days since 1970-01-01 of a date of the gregorian calendar, without the time zone of timegm
+    int64_t DaysFromCivil(int64_t nYear, int64_t nMonth, int64_t nDay)
+    {
+        nYear -= nMonth <= 2 ? 1 : 0;
+        const int64_t nEra = (nYear >= 0 ? nYear : nYear - 399) / 400;
+        const int64_t nYearOfEra = nYear - nEra * 400;
+        const int64_t nDayOfYear = (153 * (nMonth + (nMonth > 2 ? -3 : 9)) + 2) / 5 + nDay - 1;
+        const int64_t nDayOfEra = nYearOfEra * 365 + nYearOfEra / 4 - nYearOfEra / 100 + nDayOfYear;
+        return nEra * 146097 + nDayOfEra - 719468;
+    }
+
+    // "2024/03/12 14:00:00" in UTC
+    bool ParseDateTime(const TOKEN& stDate, const TOKEN& stTime, int64_t& tTime)
+    {
+        int64_t nYear, nMonth, nDay, nHour, nMinute, nSecond;
+        const char* pPos = stDate.pStart, *pEnd = stDate.pStart + stDate.nLen;
+        if (ParseNumber(pPos, pEnd, nYear) == false || pPos >= pEnd || *pPos++ != '/' || ParseNumber(pPos, pEnd, nMonth) == false || pPos >= pEnd || *pPos++ != '/' || ParseNumber(pPos, pEnd, nDay) == false || pPos != pEnd)
+            return false;
+        pPos = stTime.pStart; pEnd = stTime.pStart + stTime.nLen;
+        if (ParseNumber(pPos, pEnd, nHour) == false || pPos >= pEnd || *pPos++ != ':' || ParseNumber(pPos, pEnd, nMinute) == false || pPos >= pEnd || *pPos++ != ':' || ParseNumber(pPos, pEnd, nSecond) == false || pPos != pEnd)
+            return false;
+        if (nMonth < 1 || nMonth > 12 || nDay < 1 || nDay > 31 || nHour > 23 || nMinute > 59 || nSecond > 60)
+            return false;
+        tTime = DaysFromCivil(nYear, nMonth, nDay) * 86400 + nHour * 3600 + nMinute * 60 + nSecond;
+        return true;
+    }
+
+    const char* Trim(const char*& pStart, const char* pEnd)
+    {
+        while (pStart < pEnd && (*pStart == ' ' || *pStart == '\t' || *pStart == '"'))
+            ++pStart;
+        while (pEnd > pStart && (pEnd[-1] == ' ' || pEnd[-1] == '\t' || pEnd[-1] == '"'))
+            --pEnd;
+        return pEnd;
+    }
+}
+
+bool LeaseImport::Parse(const string& strFile, FORMAT nFormat, FN_RECORD fnRecord, size_t& nRecords, size_t& nErrors)
+{
+    nRecords = nErrors = 0;
+
+    const char* pData = nullptr;
+    size_t nSize = 0;
+#if !defined(_WIN32) && !defined(_WIN64)
+    const int fdFile = ::open(strFile.c_str(), O_RDONLY);
+    if (fdFile < 0)
+        return false;
+    struct stat stStat;
+    void* pMap = MAP_FAILED;
+    if (::fstat(fdFile, &stStat) == 0 && stStat.st_size > 0)
+    {
+        nSize = static_cast<size_t>(stStat.st_size);
+        pMap = ::mmap(nullptr, nSize, PROT_READ, MAP_PRIVATE, fdFile, 0);
+    }
+    ::close(fdFile);
+    if (pMap == MAP_FAILED)
+        return nSize == 0;  // an empty file has no leases
+    ::madvise(pMap, nSize, MADV_SEQUENTIAL);
+    pData = static_cast<const char*>(pMap);
+#else
+    ifstream fin(strFile, ios::in | ios::binary);
+    if (fin.is_open() == false)
+        return false;
+    vector<char> vData((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+    pData = vData.data();
+    nSize = vData.size();
+#endif
+
+    if (nFormat == FORMAT_AUTO)
+    {   // dhcpd.leases has "lease a.b.c.d {" blocks
+        Tokenizer tokenizer(pData, pData + min<size_t>(nSize, 64 * 1024));
+        nFormat = FORMAT_CSV;
+        for (TOKEN stToken = tokenizer.Next(); stToken.nType != TOKEN_END && nFormat == FORMAT_CSV; stToken = tokenizer.Next())
+        {
+            if (Equal(stToken, "lease") == true || Equal(stToken, "server-duid") == true || Equal(stToken, "authoring-byte-order") == true)
+                nFormat = FORMAT_ISC;
+            else if (stToken.nType == TOKEN_WORD)
+                break;
+        }
+    }
+
+    if (nFormat == FORMAT_ISC)
+        ParseIsc(pData, pData + nSize, fnRecord, nRecords, nErrors);
+    else
+        ParseCsv(pData, pData + nSize, fnRecord, nRecords, nErrors);
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    ::munmap(pMap, nSize);
+#endif
+    return true;
+}
+
+// lease 192.168.214.105 { starts 2 2024/03/12 14:00:00; ends 2 2024/03/12 15:00:00; binding state active;
+//     hardware ethernet 00:11:6b:f0:10:0c; uid "\001\000\021k\360\020\014"; set ddns-fwd-name = "pc1.benzinger.local"; }
+void LeaseImport::ParseIsc(const char* pPos, const char* pEnd, FN_RECORD& fnRecord, size_t& nRecords, size_t& nErrors)
+{
+    Tokenizer tokenizer(pPos, pEnd);
+    RECORD stRecord;
+
+    for (TOKEN stToken = tokenizer.Next(); stToken.nType != TOKEN_END; stToken = tokenizer.Next())
+    {
+        if (Equal(stToken, "lease") == false)
+        {   // server-duid, failover, lease6 ...
+            tokenizer.SkipStatement(stToken);
+            continue;
+        }
+
+        memset(&stRecord, 0, sizeof(stRecord));
+        stRecord.nLine = tokenizer.GetLine();
+        stRecord.nFlag = 2;
+        const TOKEN stIp = tokenizer.Next();
+        bool bValid = stIp.nType == TOKEN_WORD && ParseIp(stIp.pStart, stIp.nLen, stRecord.nIpAddr) == true;
+        stToken = tokenizer.Next();
+        if (stToken.nType != TOKEN_OPEN)
+        {
+            ++nErrors;
+            tokenizer.SkipStatement(stToken);
+            continue;
+        }
+
+        for (stToken = tokenizer.Next(); stToken.nType != TOKEN_CLOSE && stToken.nType != TOKEN_END; stToken = tokenizer.Next())
+        {
+            if (Equal(stToken, "starts") == true || Equal(stToken, "ends") == true)
+            {
+                int64_t& tTime = stToken.pStart[0] == 's' ? stRecord.tStart : stRecord.tEnd;
+                const TOKEN stFirst = tokenizer.Next();
+                if (Equal(stFirst, "never") == true)
+                    tTime = -1;
+                else if (Equal(stFirst, "epoch") == true)
+                {
+                    const TOKEN stSeconds = tokenizer.Next();
+                    const char* pNum = stSeconds.pStart;
+                    bValid = bValid == true && ParseNumber(pNum, stSeconds.pStart + stSeconds.nLen, tTime) == true;
+                }
+                else
+                {   // weekday date time
+                    const TOKEN stDate = tokenizer.Next();
+                    const TOKEN stTime = tokenizer.Next();
+                    bValid = bValid == true && ParseDateTime(stDate, stTime, tTime) == true;
+                }
+            }
+            else if (Equal(stToken, "binding") == true)
+            {
+                tokenizer.Next();   // state
+                const TOKEN stState = tokenizer.Next();
+                stRecord.nFlag = Equal(stState, "active") == true ? 2 : Equal(stState, "abandoned") == true ? 8 : 4;
+            }
+            else if (Equal(stToken, "hardware") == true)
+            {
+                tokenizer.Next();   // ethernet, token-ring
+                const TOKEN stHwAddr = tokenizer.Next();
+                bValid = bValid == true && ParseHex(stHwAddr.pStart, stHwAddr.nLen, stRecord.arHwAddr, sizeof(stRecord.arHwAddr), stRecord.nHwAddrLen) == true;
+            }
+            else if (Equal(stToken, "uid") == true)
+            {
+                const TOKEN stUid = tokenizer.Next();
+                if (stUid.nType == TOKEN_STRING)
+                    Unescape(stUid, stRecord.arClientId, sizeof(stRecord.arClientId), stRecord.nClientIdLen);
+                else if (ParseHex(stUid.pStart, stUid.nLen, stRecord.arClientId, sizeof(stRecord.arClientId), stRecord.nClientIdLen) == false)
+                    stRecord.nClientIdLen = 0;
+            }
+            else if (Equal(stToken, "set") == true)
+            {   // set ddns-fwd-name = "pc1.benzinger.local"; the name dhcpd has registered in the DNS
+                const TOKEN stVariable = tokenizer.Next();
+                if (Equal(stVariable, "ddns-fwd-name") == true && Equal(tokenizer.Next(), "=") == true)
+                {
+                    const TOKEN stName = tokenizer.Next();
+                    if (stName.nType == TOKEN_STRING)
+                    {
+                        stRecord.pHostName = stName.pStart;
+                        stRecord.nHostNameLen = stName.nLen;
+                    }
+                    stToken = stName;
+                }
+                else
+                    stToken = stVariable;
+            }
+            else if (stToken.nType == TOKEN_SEMICOLON)
+                continue;
+            else
+            {   // next binding state, set ..., on expiry { ... }
+                tokenizer.SkipStatement(stToken);
+                continue;
+            }
+            // the rest of the statement
+            while (stToken.nType != TOKEN_SEMICOLON && stToken.nType != TOKEN_END && stToken.nType != TOKEN_CLOSE)
+                stToken = tokenizer.Next();
+            if (stToken.nType == TOKEN_CLOSE)
+                break;
+        }
+
+        if (bValid == true && stRecord.nHwAddrLen > 0)
+        {
+            ++nRecords;
+            fnRecord(stRecord);
+        }
+        else if (bValid == false)
+            ++nErrors;
+        // a free address without a client is not a lease
+    }
+}
+
+// 00:11:6b:f0:10:0c, "1=00:11:6b:f0:10:0c", 192.168.214.110, 2, 1710252000[, pc1.benzinger.local]
+void LeaseImport::ParseCsv(const char* pPos, const char* pEnd, FN_RECORD& fnRecord, size_t& nRecords, size_t& nErrors)
+{
+    RECORD stRecord;
+    size_t nLine = 0;
+
+    while (pPos < pEnd)
+    {
+        const char* pEol = static_cast<const char*>(memchr(pPos, '\n', pEnd - pPos));
+        const char* pLineEnd = pEol != nullptr ? pEol : pEnd;
+        const char* pNext = pEol != nullptr ? pEol + 1 : pEnd;
+        ++nLine;
+
+        for (const char* pComment = pPos; pComment < pLineEnd; ++pComment)
+        {   // comments as in the loader of DhcpServ.ini
+            if (*pComment == '#' || *pComment == ';' || *pComment == '\r')
+            {
+                pLineEnd = pComment;
+                break;
+            }
+        }
+
+        // the fields without the spaces and quotes
+        const char* arField[6];
+        const char* arFieldEnd[6];
+        size_t nFields = 0;
+        for (const char* pField = pPos; nFields < 6;)
+        {
+            const char* pComma = static_cast<const char*>(memchr(pField, ',', pLineEnd - pField));
+            const char* pFieldEnd = pComma != nullptr ? pComma : pLineEnd;
+            arField[nFields] = pField;
+            arFieldEnd[nFields] = Trim(arField[nFields], pFieldEnd);
+            ++nFields;
+            if (pComma == nullptr)
+                break;
+            pField = pComma + 1;
+        }
+        if (nFields == 1 && arField[0] == arFieldEnd[0])
+        {   // empty line
+            pPos = pNext;
+            continue;
+        }
+
+        memset(&stRecord, 0, sizeof(stRecord));
+        stRecord.nLine = nLine;
+        int64_t nFlag = 0;
+        bool bValid = nFields >= 5
+            && ParseHex(arField[0], arFieldEnd[0] - arField[0], stRecord.arHwAddr, sizeof(stRecord.arHwAddr), stRecord.nHwAddrLen) == true
+            && ParseIp(arField[2], arFieldEnd[2] - arField[2], stRecord.nIpAddr) == true
+            && ParseNumber(arField[3], arFieldEnd[3], nFlag) == true && arField[3] == arFieldEnd[3]
+            && (nFlag == 1 || nFlag == 2 || nFlag == 4 || nFlag == 8)     // offered, leased, released, declined
+            && ParseNumber(arField[4], arFieldEnd[4], stRecord.tStart) == true && arField[4] == arFieldEnd[4];
+
+        // client identifier as type=hex
+        const char* pEqual = bValid == true ? static_cast<const char*>(memchr(arField[1], '=', arFieldEnd[1] - arField[1])) : nullptr;
+        int64_t nType = 0;
+        if (pEqual != nullptr && ParseNumber(arField[1], pEqual, nType) == true && nType < 256)
+        {
+            stRecord.arClientId[0] = static_cast<uint8_t>(nType);
+            uint8_t nLen = 0;
+            if (pEqual + 1 == arFieldEnd[1] || ParseHex(pEqual + 1, arFieldEnd[1] - pEqual - 1, stRecord.arClientId + 1, sizeof(stRecord.arClientId) - 1, nLen) == true)
+                stRecord.nClientIdLen = static_cast<uint8_t>(nLen + 1);
+        }
+
+        if (bValid == true)
+        {
+            stRecord.nFlag = static_cast<uint32_t>(nFlag);
+            if (nFields == 6)
+            {
+                stRecord.pHostName = arField[5];
+                stRecord.nHostNameLen = arFieldEnd[5] - arField[5];
+            }
+            ++nRecords;
+            fnRecord(stRecord);
+        }
+        else
+            ++nErrors;
+
+        pPos = pNext;
+    }
+}
@@ -0,0 +1,56 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+// Reads foreign lease files in one pass over the mapped file: ISC dhcpd.leases and
+// CSV in the format of DhcpServ.ini (HW Addr, "Client IDent", IP, Flag, Time[, Host]).
+// The fields are not copied into strings, a record points into the file or into
+// its own fixed buffers. The caller validates the record and stores it.
+class LeaseImport
+{
+public:
+    enum FORMAT : uint8_t
+    {
+        FORMAT_AUTO = 0,
+        FORMAT_ISC,
+        FORMAT_CSV
+    };
+
+    typedef struct
+    {
+        uint8_t  arHwAddr[16];
+        uint8_t  nHwAddrLen;
+        uint8_t  arClientId[255];
+        uint8_t  nClientIdLen;
+        uint32_t nIpAddr;           // network byte order
+        uint32_t nFlag;             // IP_FLAGS: 2 = active, 4 = free / released / expired, 8 = abandoned
+        int64_t  tStart;            // time_t
+        int64_t  tEnd;              // time_t, 0 = not known, -1 = never
+        const char* pHostName;      // not 0 terminated
+        size_t   nHostNameLen;
+        size_t   nLine;             // for error messages
+    }RECORD;
+
+    typedef function<void(const RECORD&)> FN_RECORD;
+
+    static bool Parse(const string& strFile, FORMAT nFormat, FN_RECORD fnRecord, size_t& nRecords, size_t& nErrors);
+
+private:
+    static void ParseIsc(const char* pPos, const char* pEnd, FN_RECORD& fnRecord, size_t& nRecords, size_t& nErrors);
+    static void ParseCsv(const char* pPos, const char* pEnd, FN_RECORD& fnRecord, size_t& nRecords, size_t& nErrors);
+};
@@ -0,0 +1,353 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "LeaseQuery.h"
+#include "Trace.h"
+
+namespace
+{
+    // RFC 4388 / RFC 6926 message types and options
+    const uint8_t s_nLeaseActive = 13;
+    const uint8_t s_nBulkLeaseQuery = 14;
+    const uint8_t s_nLeaseQueryDone = 15;
+    const uint8_t s_nStatusSuccess = 0;
+    const uint8_t s_nStatusMalformed = 3;
+    const uint8_t s_nStateActive = 2;
+
+    const size_t  s_nHeaderSize = 240;          // fixed part of a DHCP message including the magic cookie
+    const size_t  s_nHighWater = 64 * 1024;     // no more messages while the socket has so many bytes to send
+    const size_t  s_nChunk = 16 * 1024;         // bytes given to the socket with one Write
+    const size_t  s_nMaxQueries = 8;            // waiting queries per connection
+    const size_t  s_nMaxConnections = 16;
+
+    void PutUInt(vector<uint8_t>& vBuf, uint64_t nValue, int nBytes)
+    {
+        for (int n = nBytes - 1; n >= 0; --n)
+            vBuf.push_back(static_cast<uint8_t>(nValue >> (n * 8)));
+    }
+}
+
+LeaseQuery::LeaseQuery(const string& strListen, FN_SNAPSHOT fnSnapshot) : m_strListen(strListen), m_fnSnapshot(fnSnapshot), m_nQueries(0), m_nLeasesSent(0)
+{
+}
+
+LeaseQuery::~LeaseQuery()
+{
+    Stop();
+}
+
+bool LeaseQuery::Start()
+{
+    const size_t nPos = m_strListen.find_last_of(':');
+    const string strIpAddr = m_strListen.substr(0, nPos);
+    const short nPort = static_cast<short>(nPos != string::npos ? stoi(m_strListen.substr(nPos + 1)) : 67);   // RFC 6926: the DHCP server port
+
+    m_TcpServer.BindErrorFunction([&](BaseSocket* pBaseSocket) { MyTrace("Error: Leasequery socket ", m_strListen); });
+    m_TcpServer.BindNewConnection([&](const vector<TcpSocket*>& vNewConnections) { NewConnection(vNewConnections); });
+    return m_TcpServer.Start(strIpAddr.c_str(), nPort);
+}
+
+void LeaseQuery::Stop()
+{
+    m_TcpServer.Close();
+
+    vector<TcpSocket*> vSockets;
+    {
+        lock_guard<mutex> lock(m_mtxConnections);
+        for (auto& itConnection : m_maConnections)
+            vSockets.push_back(itConnection.first);
+        m_maConnections.clear();
+    }
+    for (auto pTcpSocket : vSockets)    // the close callback takes the lock
+        pTcpSocket->Close();
+}
+
+void LeaseQuery::NewConnection(const vector<TcpSocket*>& vNewConnections)
+{
+    lock_guard<mutex> lock(m_mtxConnections);
+    for (auto pTcpSocket : vNewConnections)
+    {
+        if (m_maConnections.size() >= s_nMaxConnections)
+        {
+            MyTrace("Leasequery: too many connections, ", pTcpSocket->GetClientAddr(), " refused");
+            pTcpSocket->BindCloseFunction([&](BaseSocket* pBaseSocket) { static_cast<TcpSocket*>(pBaseSocket)->SelfDestroy(); });
+            pTcpSocket->Close();
+            continue;
+        }
+
+        m_maConnections.emplace(pTcpSocket, CONNECTION({ vector<uint8_t>(), deque<vector<uint8_t>>(), SNAPSHOT(), 0, 0, false }));
+        pTcpSocket->BindFuncBytesReceived([&](TcpSocket* pSocket) { BytesReceived(pSocket); });
+        pTcpSocket->BindFuncBytesWritten([&](BaseSocket* pBaseSocket, size_t) { BytesWritten(pBaseSocket); });
+        pTcpSocket->BindErrorFunction([&](BaseSocket* pBaseSocket) { pBaseSocket->Close(); });
+        pTcpSocket->BindCloseFunction([&](BaseSocket* pBaseSocket) { Closing(pBaseSocket); });
+        pTcpSocket->StartReceiving();
+    }
+}
+
+void LeaseQuery::BytesReceived(TcpSocket* pTcpSocket)
+{
+    const size_t nAvalible = pTcpSocket->GetBytesAvailable();
+    vector<uint8_t> vBuffer(nAvalible);
+    const size_t nRead = pTcpSocket->Read(vBuffer.data(), vBuffer.size());
+
+    bool bClose = false;
+    {
+        lock_guard<mutex> lock(m_mtxConnections);
+        const auto itConnection = m_maConnections.find(pTcpSocket);
+        if (itConnection == end(m_maConnections))
+            return;
+        CONNECTION& stConnection = itConnection->second;
+        stConnection.vInput.insert(end(stConnection.vInput), begin(vBuffer), begin(vBuffer) + nRead);
+
+        // every message has a 2 byte length in front (RFC 6926, Section 6.1)
+        size_t nPos = 0;
+        while (stConnection.vInput.size() - nPos >= 2)
+        {
+            const size_t nLen = (static_cast<size_t>(stConnection.vInput[nPos]) << 8) | stConnection.vInput[nPos + 1];
+            if (stConnection.vInput.size() - nPos - 2 < nLen)
+                break;
+            if (stConnection.dqQueries.size() >= s_nMaxQueries)
+            {
+                MyTrace("Leasequery: too many queries from ", pTcpSocket->GetClientAddr());
+                bClose = true;
+                break;
+            }
+            stConnection.dqQueries.emplace_back(begin(stConnection.vInput) + nPos + 2, begin(stConnection.vInput) + nPos + 2 + nLen);
+            nPos += 2 + nLen;
+        }
+
+        if (bClose == false)
+        {
+            stConnection.vInput.erase(begin(stConnection.vInput), begin(stConnection.vInput) + nPos);
+            if (stConnection.bStreaming == false)
+                NextQuery(pTcpSocket, stConnection);
+        }
+    }
+    if (bClose == true)     // the close callback takes the lock
+        pTcpSocket->Close();
+}
+
+void LeaseQuery::BytesWritten(BaseSocket* pBaseSocket)
+{
+    TcpSocket* pTcpSocket = static_cast<TcpSocket*>(pBaseSocket);
+
+    lock_guard<mutex> lock(m_mtxConnections);
+    const auto itConnection = m_maConnections.find(pTcpSocket);
+    if (itConnection != end(m_maConnections) && itConnection->second.bStreaming == true)
+        Pump(pTcpSocket, itConnection->second);
+}
+
+void LeaseQuery::Closing(BaseSocket* pBaseSocket)
+{
+    {
+        lock_guard<mutex> lock(m_mtxConnections);
+        m_maConnections.erase(static_cast<TcpSocket*>(pBaseSocket));
+    }
+    static_cast<TcpSocket*>(pBaseSocket)->SelfDestroy();
+}
+
+// called with m_mtxConnections locked. The snapshot function locks the lease table
+// for the copy only, the stream itself is written without it
+void LeaseQuery::NextQuery(TcpSocket* pTcpSocket, CONNECTION& stConnection)
+{
+    while (stConnection.dqQueries.empty() == false)
+    {
+        vector<uint8_t> vQuery = move(stConnection.dqQueries.front());
+        stConnection.dqQueries.pop_front();
+        ++m_nQueries;
+
+        QUERY stQuery;
+        if (ParseQuery(vQuery, stQuery, stConnection.nXid) == false)
+        {
+            vector<uint8_t> vOut;
+            AppendMessage(vOut, s_nLeaseQueryDone, stConnection.nXid, nullptr, nullptr, s_nStatusMalformed);
+            pTcpSocket->Write(vOut.data(), vOut.size());
+            continue;
+        }
+
+        stConnection.stSnapshot.vLeases.clear();
+        stConnection.stSnapshot.strPool.clear();
+        m_fnSnapshot(stQuery, stConnection.stSnapshot);
+        stConnection.nNext = 0;
+        stConnection.bStreaming = true;
+        Pump(pTcpSocket, stConnection);
+        if (stConnection.bStreaming == true)
+            break;  // the rest is written when the socket has send the data
+    }
+}
+
+void LeaseQuery::Pump(TcpSocket* pTcpSocket, CONNECTION& stConnection)
+{
+    const SNAPSHOT& stSnapshot = stConnection.stSnapshot;
+    vector<uint8_t> vOut;
+    vOut.reserve(s_nChunk + 512);
+
+    while (pTcpSocket->GetOutBytesInQue() < s_nHighWater)
+    {
+        while (vOut.size() < s_nChunk && stConnection.nNext < stSnapshot.vLeases.size())
+        {
+            AppendMessage(vOut, s_nLeaseActive, stConnection.nXid, &stSnapshot.vLeases[stConnection.nNext++], &stSnapshot, -1);
+            ++m_nLeasesSent;
+        }
+
+        const bool bDone = stConnection.nNext >= stSnapshot.vLeases.size();
+        if (bDone == true)
+            AppendMessage(vOut, s_nLeaseQueryDone, stConnection.nXid, nullptr, nullptr, s_nStatusSuccess);
+
+        pTcpSocket->Write(vOut.data(), vOut.size());
+        vOut.clear();
+
+        if (bDone == true)
+        {
+            stConnection.bStreaming = false;
+            stConnection.stSnapshot = SNAPSHOT();   // give the memory back
+            NextQuery(pTcpSocket, stConnection);
+            return;
+        }
+    }
+}
+
+bool LeaseQuery::ParseQuery(const vector<uint8_t>& vQuery, QUERY& stQuery, uint32_t& nXid) const
+{
+    if (vQuery.size() < s_nHeaderSize)
+        return false;
+
+    nXid = (static_cast<uint32_t>(vQuery[4]) << 24) | (static_cast<uint32_t>(vQuery[5]) << 16) | (static_cast<uint32_t>(vQuery[6]) << 8) | vQuery[7];
+    if (vQuery[236] != 0x63 || vQuery[237] != 0x82 || vQuery[238] != 0x53 || vQuery[239] != 0x63)
+        return false;
+
+    uint8_t nMsgType = 0;
+    string strClientId, strRelayId, strRemoteId;
+    for (size_t nPos = s_nHeaderSize; nPos < vQuery.size() && vQuery[nPos] != 255;)
+    {
+        if (vQuery[nPos] == 0)
+        {
+            ++nPos;
+            continue;
+        }
+        if (nPos + 2 > vQuery.size() || nPos + 2 + vQuery[nPos + 1] > vQuery.size())
+            return false;
+        const uint8_t nCode = vQuery[nPos];
+        const uint8_t nLen = vQuery[nPos + 1];
+        const uint8_t* pValue = &vQuery[nPos + 2];
+
+        if (nCode == 53 && nLen == 1)
+            nMsgType = pValue[0];
+        else if (nCode == 61)
+            strClientId = string(reinterpret_cast<const char*>(pValue), nLen);
+        else if (nCode == 82)   // RFC 6926: relay-id (sub option 12) or remote-id (sub option 2) as query
+        {
+            for (const uint8_t* pSubOpt = pValue; pSubOpt + 2 <= pValue + nLen && pSubOpt + 2 + pSubOpt[1] <= pValue + nLen; pSubOpt += 2 + pSubOpt[1])
+            {
+                if (pSubOpt[0] == 12)
+                    strRelayId = string(reinterpret_cast<const char*>(pSubOpt) + 2, pSubOpt[1]);
+                else if (pSubOpt[0] == 2)
+                    strRemoteId = string(reinterpret_cast<const char*>(pSubOpt) + 2, pSubOpt[1]);
+            }
+        }
+        nPos += 2 + nLen;
+    }
+
+    if (nMsgType != s_nBulkLeaseQuery)
+        return false;
+
+    stQuery.arHwAddr.fill(0);
+    stQuery.nScope = 0;
+    const uint8_t nHwLen = min<uint8_t>(vQuery[2], 16);
+    const bool bHwAddr = nHwLen > 0 && any_of(begin(vQuery) + 28, begin(vQuery) + 28 + nHwLen, [](uint8_t c) { return c != 0; });
+    uint32_t nCiAddr;
+    memcpy(&nCiAddr, &vQuery[12], 4);
+
+    // only one kind of query per message (RFC 6926, Section 7.2)
+    if ((bHwAddr == true) + (strClientId.empty() == false) + (strRelayId.empty() == false) + (strRemoteId.empty() == false) + (nCiAddr != 0) > 1)
+        return false;
+
+    if (bHwAddr == true)
+    {
+        stQuery.nType = QUERY_CHADDR;
+        copy(begin(vQuery) + 28, begin(vQuery) + 28 + nHwLen, begin(stQuery.arHwAddr));
+    }
+    else if (strClientId.empty() == false)
+    {
+        stQuery.nType = QUERY_CLIENT_ID;
+        stQuery.strValue = strClientId;
+    }
+    else if (strRelayId.empty() == false)
+    {
+        stQuery.nType = QUERY_RELAY_ID;
+        stQuery.strValue = strRelayId;
+    }
+    else if (strRemoteId.empty() == false)
+    {
+        stQuery.nType = QUERY_REMOTE_ID;
+        stQuery.strValue = strRemoteId;
+    }
+    else if (nCiAddr != 0)
+    {
+        stQuery.nType = QUERY_SCOPE;
+        stQuery.nScope = nCiAddr;
+    }
+    else
+        stQuery.nType = QUERY_ALL;
+
+    return true;
+}
+
+// length(2) op htype hlen hops xid secs flags ciaddr yiaddr siaddr giaddr chaddr sname file cookie options
+void LeaseQuery::AppendMessage(vector<uint8_t>& vOut, uint8_t nMsgType, uint32_t nXid, const LEASE* pLease, const SNAPSHOT* pSnapshot, int nStatus)
+{
+    const size_t nStart = vOut.size();
+    vOut.resize(nStart + 2 + s_nHeaderSize, 0);
+    uint8_t* pMsg = &vOut[nStart + 2];
+    pMsg[0] = 2;    // BOOTREPLY
+    pMsg[1] = 1;    // Ethernet
+    pMsg[4] = static_cast<uint8_t>(nXid >> 24); pMsg[5] = static_cast<uint8_t>(nXid >> 16); pMsg[6] = static_cast<uint8_t>(nXid >> 8); pMsg[7] = static_cast<uint8_t>(nXid);
+    pMsg[236] = 0x63; pMsg[237] = 0x82; pMsg[238] = 0x53; pMsg[239] = 0x63;
+
+    vOut.push_back(53); vOut.push_back(1); vOut.push_back(nMsgType);
+
+    if (pLease != nullptr)
+    {
+        pMsg = &vOut[nStart + 2];
+        pMsg[2] = 6;
+        memcpy(&pMsg[12], &pLease->nIpAddr, 4);
+        copy(begin(pLease->arHwAddr), end(pLease->arHwAddr), &pMsg[28]);
+
+        // all times relative to the base time (RFC 6926, Section 6.2.5)
+        const int64_t tNow = chrono::system_clock::to_time_t(chrono::system_clock::now());
+        vOut.push_back(152); vOut.push_back(4); PutUInt(vOut, static_cast<uint32_t>(tNow), 4);
+        vOut.push_back(51); vOut.push_back(4); PutUInt(vOut, static_cast<uint32_t>(max<int64_t>(pLease->tLeaseEnd - tNow, 0)), 4);
+        vOut.push_back(91); vOut.push_back(4); PutUInt(vOut, static_cast<uint32_t>(max<int64_t>(tNow - pLease->tLastTransaction, 0)), 4);
+        vOut.push_back(156); vOut.push_back(1); vOut.push_back(s_nStateActive);
+        if (pLease->nClientIdLen > 0)
+        {
+            vOut.push_back(61); vOut.push_back(pLease->nClientIdLen);
+            vOut.insert(end(vOut), begin(pSnapshot->strPool) + pLease->nClientId, begin(pSnapshot->strPool) + pLease->nClientId + pLease->nClientIdLen);
+        }
+    }
+
+    if (nStatus > 0)
+    {
+        const char szMalformed[] = "MalformedQuery";
+        vOut.push_back(151); vOut.push_back(static_cast<uint8_t>(1 + sizeof(szMalformed) - 1)); vOut.push_back(static_cast<uint8_t>(nStatus));
+        vOut.insert(end(vOut), szMalformed, szMalformed + sizeof(szMalformed) - 1);
+    }
+
+    vOut.push_back(255);
+
+    const size_t nLen = vOut.size() - nStart - 2;
+    vOut[nStart] = static_cast<uint8_t>(nLen >> 8);
+    vOut[nStart + 1] = static_cast<uint8_t>(nLen);
+}
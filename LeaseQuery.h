@@ -0,0 +1,111 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "socketlib/SocketLib.h"
+
+using namespace std;
+
+// Bulk Leasequery (RFC 6926) over TCP. A query selects all active leases, or the
+// leases of one client (chaddr, client identifier), relay (relay identifier,
+// remote id) or scope (ciaddr = address of the scope, our extension). The leases
+// are copied once into a compact snapshot, the stream is written from the snapshot
+// without any lock on the lease table. A connection only gets more data when the
+// send queue of the socket is below the high water mark.
+class LeaseQuery
+{
+public:
+    enum QUERY_TYPE : uint8_t
+    {
+        QUERY_ALL = 0,
+        QUERY_CHADDR,
+        QUERY_CLIENT_ID,
+        QUERY_RELAY_ID,
+        QUERY_REMOTE_ID,
+        QUERY_SCOPE
+    };
+
+    typedef struct
+    {
+        QUERY_TYPE nType;
+        array<uint8_t, 16> arHwAddr;
+        string   strValue;      // client identifier, relay identifier or remote id
+        uint32_t nScope;        // network byte order
+    }QUERY;
+
+    typedef struct
+    {
+        array<uint8_t, 16> arHwAddr;
+        uint32_t nIpAddr;           // network byte order
+        int64_t  tLastTransaction;  // time_t
+        int64_t  tLeaseEnd;         // time_t
+        uint32_t nClientId;         // offset in SNAPSHOT::strPool
+        uint8_t  nClientIdLen;
+    }LEASE;
+
+    typedef struct
+    {
+        vector<LEASE> vLeases;
+        string strPool;             // the client identifiers of all leases
+    }SNAPSHOT;
+
+    typedef function<void(const QUERY&, SNAPSHOT&)> FN_SNAPSHOT;
+
+    LeaseQuery(const string& strListen, FN_SNAPSHOT fnSnapshot);
+    ~LeaseQuery();
+
+    bool Start();
+    void Stop();
+
+    uint64_t GetQueries() const { return m_nQueries; }
+    uint64_t GetLeasesSent() const { return m_nLeasesSent; }
+
+private:
+    typedef struct
+    {
+        vector<uint8_t> vInput;             // received bytes, not yet a complete message
+        deque<vector<uint8_t>> dqQueries;   // waiting queries, one is streamed at a time
+        SNAPSHOT stSnapshot;
+        size_t   nNext;
+        uint32_t nXid;
+        bool     bStreaming;
+    }CONNECTION;
+
+    void NewConnection(const vector<TcpSocket*>& vNewConnections);
+    void BytesReceived(TcpSocket* pTcpSocket);
+    void BytesWritten(BaseSocket* pBaseSocket);
+    void Closing(BaseSocket* pBaseSocket);
+
+    void NextQuery(TcpSocket* pTcpSocket, CONNECTION& stConnection);
+    void Pump(TcpSocket* pTcpSocket, CONNECTION& stConnection);
+    bool ParseQuery(const vector<uint8_t>& vQuery, QUERY& stQuery, uint32_t& nXid) const;
+    static void AppendMessage(vector<uint8_t>& vOut, uint8_t nMsgType, uint32_t nXid, const LEASE* pLease, const SNAPSHOT* pSnapshot, int nStatus);
+
+private:
+    string      m_strListen;
+    FN_SNAPSHOT m_fnSnapshot;
+    TcpServer   m_TcpServer;
+    mutex       m_mtxConnections;
+    map<TcpSocket*, CONNECTION> m_maConnections;
+    atomic<uint64_t> m_nQueries;
+    atomic<uint64_t> m_nLeasesSent;
+};
@@ -0,0 +1,292 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "LeaseView.h"
+#include "Trace.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace
+{
+    const uint32_t s_nMagic = 0x44534c56;       // "DSLV"
+    const uint32_t s_nVersion = 1;
+    const int      s_nMaxRetries = 1000;        // a reader gives up when the writer is always faster
+    const auto     s_tPublishInterval = chrono::seconds(1);
+    const auto     s_tRefreshInterval = chrono::seconds(10);   // the pool counters change without a lease change (quarantine)
+}
+
+LeaseView::LeaseView(const string& strName, uint32_t nSlots) : m_strName(strName), m_nSlots(nSlots), m_pHeader(nullptr), m_pSlots(nullptr), m_nSize(0), m_bStop(false), m_bChanged(true)
+{
+}
+
+LeaseView::~LeaseView()
+{
+    Stop();
+}
+
+bool LeaseView::Start(FN_SNAPSHOT fnSnapshot)
+{
+    m_fnSnapshot = fnSnapshot;
+
+    const int fdShm = ::shm_open(m_strName.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fdShm < 0)
+        return false;
+
+    m_nSize = sizeof(HEADER) + static_cast<size_t>(m_nSlots) * sizeof(SLOT);
+    void* pMap = ::ftruncate(fdShm, m_nSize) == 0 ? ::mmap(nullptr, m_nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fdShm, 0) : MAP_FAILED;
+    ::close(fdShm);
+    if (pMap == MAP_FAILED)
+        return false;
+
+    // a reader that has the old segment open sees an odd counter until we have written
+    m_pHeader = static_cast<HEADER*>(pMap);
+    m_pSlots = reinterpret_cast<SLOT*>(m_pHeader + 1);
+    m_pHeader->nSeq.store(m_pHeader->nSeq.load() | 1);
+    m_pHeader->nMagic = s_nMagic;
+    m_pHeader->nVersion = s_nVersion;
+    m_pHeader->nSlots = m_nSlots;
+    m_pHeader->nPid = static_cast<uint32_t>(::getpid());
+    m_pHeader->nCount = 0;
+    m_pHeader->nPools = 0;
+    m_pHeader->nSeq.fetch_add(1);
+
+    m_bStop = false;
+    m_thPublish = thread(&LeaseView::PublishThread, this);
+    return true;
+}
+
+void LeaseView::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_mtxPublish);
+        m_bStop = true;
+    }
+    m_cvPublish.notify_all();
+    if (m_thPublish.joinable() == true)
+        m_thPublish.join();
+
+    if (m_pHeader != nullptr)
+    {
+        // after a hot restart the segment belongs to the new process
+        if (m_pHeader->nPid == static_cast<uint32_t>(::getpid()))
+            ::shm_unlink(m_strName.c_str());
+        ::munmap(m_pHeader, m_nSize);
+        m_pHeader = nullptr;
+    }
+}
+
+void LeaseView::PublishThread()
+{
+    auto tLastPublish = chrono::steady_clock::now() - s_tRefreshInterval;
+    unique_lock<mutex> lock(m_mtxPublish);
+    while (m_bStop == false)
+    {
+        if (m_bChanged.exchange(false) == true || chrono::steady_clock::now() - tLastPublish >= s_tRefreshInterval)
+        {
+            lock.unlock();
+            Publish();
+            tLastPublish = chrono::steady_clock::now();
+            lock.lock();
+        }
+        m_cvPublish.wait_for(lock, s_tPublishInterval, [&]() { return m_bStop; });
+    }
+}
+
+void LeaseView::Publish()
+{
+    vector<SLOT> vSlots;
+    vector<POOL> vPools;
+    m_fnSnapshot(vSlots, vPools);
+    sort(begin(vSlots), end(vSlots), [](const SLOT& a, const SLOT& b) { return a.nIpAddr < b.nIpAddr; });
+
+    const size_t nCount = min<size_t>(vSlots.size(), m_nSlots);
+    const size_t nPools = min<size_t>(vPools.size(), sizeof(m_pHeader->arPools) / sizeof(m_pHeader->arPools[0]));
+
+    m_pHeader->nSeq.fetch_add(1, memory_order_relaxed);     // odd, the data is changing
+    atomic_thread_fence(memory_order_release);
+    memcpy(m_pSlots, vSlots.data(), nCount * sizeof(SLOT));
+    memcpy(m_pHeader->arPools, vPools.data(), nPools * sizeof(POOL));
+    m_pHeader->nCount = static_cast<uint32_t>(nCount);
+    m_pHeader->nPools = static_cast<uint32_t>(nPools);
+    m_pHeader->nTruncated = static_cast<uint32_t>(vSlots.size() - nCount);
+    m_pHeader->tPublished = chrono::system_clock::to_time_t(chrono::system_clock::now());
+    m_pHeader->nSeq.fetch_add(1, memory_order_release);     // even, the data is consistent
+}
+
+const LeaseView::HEADER* LeaseView::OpenSegment(const string& strName, size_t& nSize)
+{
+    const int fdShm = ::shm_open(strName.c_str(), O_RDONLY, 0);
+    if (fdShm < 0)
+        return nullptr;
+
+    struct stat stStat;
+    void* pMap = MAP_FAILED;
+    if (::fstat(fdShm, &stStat) == 0 && static_cast<size_t>(stStat.st_size) >= sizeof(HEADER))
+    {
+        nSize = static_cast<size_t>(stStat.st_size);
+        pMap = ::mmap(nullptr, nSize, PROT_READ, MAP_SHARED, fdShm, 0);
+    }
+    ::close(fdShm);
+    if (pMap == MAP_FAILED)
+        return nullptr;
+
+    const HEADER* pHeader = static_cast<const HEADER*>(pMap);
+    if (pHeader->nMagic != s_nMagic || pHeader->nVersion != s_nVersion || sizeof(HEADER) + static_cast<size_t>(pHeader->nSlots) * sizeof(SLOT) > nSize)
+    {
+        ::munmap(pMap, nSize);
+        return nullptr;
+    }
+    return pHeader;
+}
+
+void LeaseView::CloseSegment(const HEADER* pHeader, size_t nSize)
+{
+    ::munmap(const_cast<HEADER*>(pHeader), nSize);
+}
+
+bool LeaseView::Read(const string& strName, vector<SLOT>& vSlots, vector<POOL>& vPools, int64_t& tPublished)
+{
+    size_t nSize = 0;
+    const HEADER* pHeader = OpenSegment(strName, nSize);
+    if (pHeader == nullptr)
+        return false;
+    const SLOT* pSlots = reinterpret_cast<const SLOT*>(pHeader + 1);
+
+    bool bConsistent = false;
+    for (int n = 0; n < s_nMaxRetries && bConsistent == false; ++n)
+    {
+        const uint32_t nSeq = pHeader->nSeq.load(memory_order_acquire);
+        if ((nSeq & 1) != 0)
+        {
+            this_thread::yield();
+            continue;
+        }
+        const uint32_t nCount = min(pHeader->nCount, pHeader->nSlots);
+        const uint32_t nPools = min<uint32_t>(pHeader->nPools, sizeof(pHeader->arPools) / sizeof(pHeader->arPools[0]));
+        vSlots.assign(pSlots, pSlots + nCount);
+        vPools.assign(pHeader->arPools, pHeader->arPools + nPools);
+        tPublished = pHeader->tPublished;
+        atomic_thread_fence(memory_order_acquire);
+        bConsistent = pHeader->nSeq.load(memory_order_relaxed) == nSeq;
+    }
+
+    CloseSegment(pHeader, nSize);
+    return bConsistent;
+}
+
+bool LeaseView::FindIp(const string& strName, uint32_t nIpAddr, SLOT& stSlot)
+{
+    size_t nSize = 0;
+    const HEADER* pHeader = OpenSegment(strName, nSize);
+    if (pHeader == nullptr)
+        return false;
+    const SLOT* pSlots = reinterpret_cast<const SLOT*>(pHeader + 1);
+
+    bool bFound = false, bConsistent = false;
+    for (int n = 0; n < s_nMaxRetries && bConsistent == false; ++n)
+    {
+        const uint32_t nSeq = pHeader->nSeq.load(memory_order_acquire);
+        if ((nSeq & 1) != 0)
+        {
+            this_thread::yield();
+            continue;
+        }
+        // binary search, only the found slot is copied
+        const SLOT* pEnd = pSlots + min(pHeader->nCount, pHeader->nSlots);
+        const SLOT* pSlot = lower_bound(pSlots, pEnd, nIpAddr, [](const SLOT& stSlot, uint32_t nIp) { return stSlot.nIpAddr < nIp; });
+        bFound = pSlot != pEnd && pSlot->nIpAddr == nIpAddr;
+        if (bFound == true)
+            stSlot = *pSlot;
+        atomic_thread_fence(memory_order_acquire);
+        bConsistent = pHeader->nSeq.load(memory_order_relaxed) == nSeq;
+    }
+
+    CloseSegment(pHeader, nSize);
+    return bConsistent == true && bFound == true;
+}
+
+uint32_t LeaseView::WriterPid(const string& strName)
+{
+    size_t nSize = 0;
+    const HEADER* pHeader = OpenSegment(strName, nSize);
+    if (pHeader == nullptr)
+        return 0;
+    uint32_t nPid = pHeader->nPid;
+    CloseSegment(pHeader, nSize);
+
+    // the segment of a killed server stays, its process is gone
+    if (nPid == 0 || (::kill(static_cast<pid_t>(nPid), 0) != 0 && errno != EPERM))
+        nPid = 0;
+    return nPid;
+}
+
+#else
+
+LeaseView::LeaseView(const string& strName, uint32_t nSlots) : m_strName(strName), m_nSlots(nSlots), m_pHeader(nullptr), m_pSlots(nullptr), m_nSize(0), m_bStop(false), m_bChanged(false)
+{
+}
+
+LeaseView::~LeaseView()
+{
+}
+
+bool LeaseView::Start(FN_SNAPSHOT)
+{
+    return false;
+}
+
+void LeaseView::Stop()
+{
+}
+
+void LeaseView::PublishThread()
+{
+}
+
+void LeaseView::Publish()
+{
+}
+
+const LeaseView::HEADER* LeaseView::OpenSegment(const string&, size_t&)
+{
+    return nullptr;
+}
+
+void LeaseView::CloseSegment(const HEADER*, size_t)
+{
+}
+
+bool LeaseView::Read(const string&, vector<SLOT>&, vector<POOL>&, int64_t&)
+{
+    return false;
+}
+
+bool LeaseView::FindIp(const string&, uint32_t, SLOT&)
+{
+    return false;
+}
+
+uint32_t LeaseView::WriterPid(const string&)
+{
+    return 0;
+}
+
+#endif
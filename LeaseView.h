@@ -0,0 +1,103 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// The lease table as read only copy in a shared memory segment, for monitoring
+// tools without a connection to the server. A thread writes the table when it
+// has changed, the packet processing only sets a flag. The segment is protected
+// by a sequence counter (seqlock): odd while the writer is working, a reader copies
+// the data and repeats when the counter has changed in between. No reader can
+// block the server. The slots are sorted by IP address. Not available on Windows.
+class LeaseView
+{
+public:
+    typedef struct
+    {
+        uint8_t  arHwAddr[16];
+        uint32_t nIpAddr;       // host byte order
+        uint32_t nFlag;         // IP_FLAGS of the lease
+        int64_t  tLeaseTime;    // time_t of the last change
+        uint32_t nLeaseTime;    // seconds, 0 = unknown
+        uint8_t  nClientIdLen;
+        uint8_t  nHostNameLen;
+        uint8_t  arReserved[2];
+        uint8_t  arClientId[32];
+        char     szHostName[64];
+    }SLOT;
+
+    typedef struct
+    {
+        uint32_t nScope;        // address of the scope, host byte order
+        uint32_t nSize;
+        uint32_t nInUse;
+        char     szClass[20];   // empty for the pool of the scope
+    }POOL;
+
+    typedef function<void(vector<SLOT>&, vector<POOL>&)> FN_SNAPSHOT;
+
+    LeaseView(const string& strName, uint32_t nSlots);
+    ~LeaseView();
+
+    bool Start(FN_SNAPSHOT fnSnapshot);
+    void Stop();
+    void Changed() { m_bChanged = true; }
+    const string& Name() const { return m_strName; }
+
+    // Reader side, the server is not needed
+    static bool Read(const string& strName, vector<SLOT>& vSlots, vector<POOL>& vPools, int64_t& tPublished);
+    static bool FindIp(const string& strName, uint32_t nIpAddr, SLOT& stSlot);
+    static uint32_t WriterPid(const string& strName);   // 0 = no running server writes the segment
+
+private:
+    typedef struct
+    {
+        uint32_t nMagic;
+        uint32_t nVersion;      // of the layout
+        uint32_t nSlots;        // size of the slot table
+        uint32_t nPid;          // of the writer
+        atomic<uint32_t> nSeq;  // odd = the writer is working
+        uint32_t nCount;        // used slots
+        uint32_t nPools;
+        uint32_t nTruncated;    // leases without slot
+        int64_t  tPublished;
+        POOL     arPools[64];
+    }HEADER;
+
+    void PublishThread();
+    void Publish();
+    static const HEADER* OpenSegment(const string& strName, size_t& nSize);
+    static void CloseSegment(const HEADER* pHeader, size_t nSize);
+
+private:
+    string       m_strName;
+    uint32_t     m_nSlots;
+    FN_SNAPSHOT  m_fnSnapshot;
+    HEADER*      m_pHeader;
+    SLOT*        m_pSlots;
+    size_t       m_nSize;
+    thread       m_thPublish;
+    mutex        m_mtxPublish;
+    condition_variable m_cvPublish;
+    bool         m_bStop;
+    atomic<bool> m_bChanged;
+};
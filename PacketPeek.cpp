@@ -0,0 +1,58 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <cstring>
+
+#include "PacketPeek.h"
+#include "HwAddrTable.h"
+
+namespace
+{
+    const size_t s_nHeaderSize = 240;   // sizeof(DhcpProtokol::DHCPHEADER) including the magic cookie
+    const size_t s_nOffsetXid = 4;
+    const size_t s_nOffsetSecs = 8;
+    const size_t s_nOffsetCiaddr = 12;
+    const size_t s_nOffsetChaddr = 28;
+}
+
+bool PeekPacket(const uint8_t* pBuffer, size_t nBytInBuf, PACKETPEEK& stPeek)
+{
+    if (nBytInBuf < s_nHeaderSize)
+        return false;
+
+    stPeek.nOp = pBuffer[0];
+    memcpy(&stPeek.nXid, pBuffer + s_nOffsetXid, sizeof(stPeek.nXid));
+    memcpy(&stPeek.nCiaddr, pBuffer + s_nOffsetCiaddr, sizeof(stPeek.nCiaddr));
+    stPeek.nSecs = static_cast<uint16_t>(pBuffer[s_nOffsetSecs] << 8 | pBuffer[s_nOffsetSecs + 1]);
+    stPeek.nHwKey = HwAddrTable::MakeKey(pBuffer + s_nOffsetChaddr);
+    stPeek.nMsgType = 0;
+
+    // Option 53 is nearly always the first option, otherwise we walk the options
+    const uint8_t* pOption = pBuffer + s_nHeaderSize;
+    const uint8_t* pEnd = pBuffer + nBytInBuf;
+    while (pOption < pEnd && *pOption != 255)
+    {
+        if (*pOption == 0)
+        {
+            ++pOption;
+            continue;
+        }
+        if (pOption + 2 > pEnd || pOption + 2 + pOption[1] > pEnd)
+            break;
+        if (*pOption == 53 && pOption[1] == 1)
+        {
+            stPeek.nMsgType = pOption[2];
+            break;
+        }
+        pOption += 2 + pOption[1];
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// The few fields needed before the full parsing of a packet, read from the
+// fixed offsets of the DHCP header. No memory is allocated.
+typedef struct
+{
+    uint64_t nHwKey;    // chaddr packed into 48 bit, see HwAddrTable::MakeKey
+    uint32_t nXid;      // as in the packet (network byte order)
+    uint32_t nCiaddr;   // as in the packet (network byte order)
+    uint16_t nSecs;     // host byte order
+    uint8_t  nOp;
+    uint8_t  nMsgType;  // option 53, 0 if not found
+}PACKETPEEK;
+
+bool PeekPacket(const uint8_t* pBuffer, size_t nBytInBuf, PACKETPEEK& stPeek);
@@ -0,0 +1,427 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "PeerLink.h"
+#include "Trace.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace
+{
+    // RFC 3074, Section 6: Pearson hash permutation table
+    const uint8_t s_arLoadbMxTbl[256] = {
+        251, 175, 119, 215,  81,  14,  79, 191, 103,  49, 181, 143, 186, 157,   0, 232,
+         31,  32,  55,  60, 152,  58,  17, 237, 174,  70, 160, 144, 220,  90,  57, 223,
+         59,   3,  18, 140, 111, 166, 203, 196, 134, 243, 124,  95, 222, 179, 197,  65,
+        180,  48,  36,  15, 107,  46, 233, 130, 165,  30, 123, 161, 209,  23,  97,  16,
+         40,  91, 219,  61, 100,  10, 210, 109, 250, 127,  22, 138,  29, 108, 244,  67,
+        207,   9, 178, 204,  74,  98, 126, 249, 167, 116,  34,  77, 193, 200, 121,   5,
+         20, 113,  71,  35, 128,  13, 182,  94,  25, 226, 227, 199,  75,  27,  41, 245,
+        230, 224,  43, 225, 177,  26, 155, 150, 212, 142, 218, 115, 241,  73,  88, 105,
+         39, 114,  62, 255, 192, 201, 145, 214, 168, 158, 221, 148, 154, 122,  12,  84,
+         82, 163,  44, 139, 228, 236, 205, 242, 217,  11, 187, 146, 159,  64,  86, 239,
+        195,  42, 106, 198, 118, 112, 184, 172,  87,   2, 173, 117, 176, 229, 247, 253,
+        137, 185,  99, 164, 102, 147,  45,  66, 231,  52, 141, 211, 194, 206, 246, 238,
+         56, 110,  78, 248,  63, 240, 189,  93,  92,  51,  53, 183,  19, 171,  72,  50,
+         33, 104, 101,  69,   8, 252,  83, 120,  76, 135,  85,  54, 202, 125, 188, 213,
+         96, 235, 136, 208, 162, 129, 190, 132, 156,  38,  47,   1,   7, 254,  24,   4,
+        216, 131,  89,  21,  28, 133,  37, 153, 149,  80, 170,  68,   6, 169, 234, 151
+    };
+
+    const uint32_t s_nMagic = 0x4453504c;       // "DSPL"
+    const size_t   s_nHeaderSize = 19;          // magic(4) type(1) session(8) seq(4) count(2)
+    const size_t   s_nMaxDatagram = 1400;
+    const int64_t  s_nRetransmitMs = 500;
+    const size_t   s_nMaxUnacked = 256;
+    const size_t   s_nMacSize = 16;             // HMAC-SHA256, truncated
+
+    int64_t NowMs()
+    {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void PutUInt(vector<uint8_t>& vBuf, uint64_t nValue, int nBytes)
+    {
+        for (int n = nBytes - 1; n >= 0; --n)
+            vBuf.push_back(static_cast<uint8_t>(nValue >> (n * 8)));
+    }
+
+    uint64_t GetUInt(const uint8_t*& pPos, int nBytes)
+    {
+        uint64_t nValue = 0;
+        for (int n = 0; n < nBytes; ++n)
+            nValue = (nValue << 8) | *pPos++;
+        return nValue;
+    }
+}
+
+PeerLink::PeerLink(bool bPrimary, const string& strListen, const string& strPeer, uint8_t nSplit, uint32_t nTimeout)
+    : m_bPrimary(bPrimary), m_strListen(strListen), m_strPeer(strPeer), m_nSplit(nSplit), m_nTimeout(nTimeout), m_bStop(false), m_nSession(0), m_nNextSeq(1), m_nHeartbeat(0), m_tLastHeard(0), m_bResync(false), m_nPeerSession(0), m_nPeerApplied(0), m_nPeerHeartbeat(0)
+{
+}
+
+PeerLink::~PeerLink()
+{
+    Stop();
+}
+
+bool PeerLink::Start(FN_APPLY fnApply, FN_SNAPSHOT fnSnapshot)
+{
+    m_fnApply = fnApply;
+    m_fnSnapshot = fnSnapshot;
+
+    const size_t nPos = m_strListen.find_last_of(':');
+    if (nPos == string::npos)
+        return false;
+
+    m_UdpSocket.BindErrorFunction([&](BaseSocket* pBaseSocket) { MyTrace("Error: Peer socket ", m_strListen); });
+    m_UdpSocket.BindFuncBytesReceived([&](UdpSocket* pUdpSocket) { DatenEmpfangen(pUdpSocket); });
+    if (m_UdpSocket.Create(m_strListen.substr(0, nPos).c_str(), static_cast<short>(stoi(m_strListen.substr(nPos + 1)))) == false)
+        return false;
+
+    {
+        lock_guard<mutex> lock(m_mtxQueue);
+        m_bStop = false;
+        NewSession();
+    }
+    m_thWorker = thread(&PeerLink::WorkerThread, this);
+    return true;
+}
+
+void PeerLink::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_mtxQueue);
+        m_bStop = true;
+    }
+    m_cvQueue.notify_all();
+    if (m_thWorker.joinable() == true)
+    {
+        m_thWorker.join();
+        m_UdpSocket.Close();
+    }
+}
+
+uint8_t PeerLink::HashBucket(const uint8_t* pKey, size_t nLen)
+{
+    uint8_t nHash = static_cast<uint8_t>(nLen);
+    for (size_t i = nLen; i > 0;)
+        nHash = s_arLoadbMxTbl[nHash ^ pKey[--i]];
+    return nHash;
+}
+
+bool PeerLink::IsResponsible(uint8_t nBucket) const
+{
+    if (IsPeerAlive() == false)
+        return true;    // take over the buckets of the partner
+    return m_bPrimary == true ? nBucket < m_nSplit : nBucket >= m_nSplit;
+}
+
+bool PeerLink::IsPeerAlive() const
+{
+    const int64_t tLastHeard = m_tLastHeard;
+    return tLastHeard != 0 && NowMs() - tLastHeard < static_cast<int64_t>(m_nTimeout) * 1000;
+}
+
+void PeerLink::GetPoolShare(size_t& nPart, size_t& nParts) const
+{
+    // As long as both are running, each allocates from an other half of the pools
+    if (IsPeerAlive() == true)
+    {
+        nPart = m_bPrimary == true ? 0 : 1;
+        nParts = 2;
+    }
+    else
+    {
+        nPart = 0;
+        nParts = 1;
+    }
+}
+
+void PeerLink::Queue(const LEASE_UPDATE& stUpdate)
+{
+    size_t nQueued;
+    {
+        lock_guard<mutex> lock(m_mtxQueue);
+        m_vQueue.push_back(stUpdate);
+        nQueued = m_vQueue.size();
+    }
+    if (nQueued >= 32)
+        m_cvQueue.notify_all();
+}
+
+void PeerLink::DatenEmpfangen(UdpSocket* pUdpSocket)
+{
+    size_t nAvalible = pUdpSocket->GetBytesAvailable();
+    auto spBuffer = make_unique<uint8_t[]>(nAvalible + 1);
+
+    string strFrom;
+    size_t nRead = pUdpSocket->Read(spBuffer.get(), nAvalible, strFrom);
+
+    // only the partner may change our leases
+    if (strFrom.substr(0, strFrom.find_last_of(':')) != m_strPeer.substr(0, m_strPeer.find_last_of(':')))
+        return;
+    if (Verify(spBuffer.get(), nRead) == false || nRead < s_nHeaderSize)
+        return;
+
+    const uint8_t* pPos = spBuffer.get();
+    const uint8_t* pEnd = pPos + nRead;
+    if (GetUInt(pPos, 4) != s_nMagic)
+        return;
+    const uint8_t nType = *pPos++;
+    const uint64_t nSession = GetUInt(pPos, 8);
+    const uint32_t nSeq = static_cast<uint32_t>(GetUInt(pPos, 4));
+    const uint16_t nCount = static_cast<uint16_t>(GetUInt(pPos, 2));
+
+    if (nType == MSG_ACK)
+    {   // the ack has our session, an ack of an older session is not for our batches
+        lock_guard<mutex> lock(m_mtxQueue);
+        if (nSession == m_nSession)
+            m_maUnacked.erase(nSeq);
+        return;
+    }
+
+    if (nSession < m_nPeerSession)
+        return;     // an old or replayed datagram
+    if (nSession > m_nPeerSession)
+    {   // the partner was restarted or has given up unacked batches
+        m_nPeerSession = nSession;
+        m_nPeerApplied = 0;
+        m_nPeerHeartbeat = 0;
+    }
+    if (nType == MSG_HEARTBEAT)
+    {
+        if (nSeq <= m_nPeerHeartbeat)
+            return;
+        m_nPeerHeartbeat = nSeq;
+    }
+    else if (nType == MSG_UPDATE && nSeq > m_nPeerApplied + 1)
+        return;     // a batch before is missing, the partner repeats both
+
+    const int64_t tLastHeard = m_tLastHeard.exchange(NowMs());
+    if (tLastHeard == 0 || NowMs() - tLastHeard >= static_cast<int64_t>(m_nTimeout) * 1000)
+    {   // the partner is (back) online, it gets our complete table
+        MyTrace("Peer ", m_strPeer, " online");
+        m_bResync = true;
+        m_cvQueue.notify_all();
+    }
+
+    if (nType == MSG_UPDATE)
+    {
+        vector<LEASE_UPDATE> vUpdates;
+        for (uint16_t n = 0; n < nCount && nSeq == m_nPeerApplied + 1; ++n)
+        {
+            if (pEnd - pPos < 16 + 4 + 4 + 8 + 4)
+                return;     // broken message, no ack. The partner repeats it
+            LEASE_UPDATE stUpdate;
+            copy(pPos, pPos + 16, begin(stUpdate.arHwAddr)); pPos += 16;
+            stUpdate.nFlag = static_cast<uint32_t>(GetUInt(pPos, 4));
+            char caAddrBuf[INET6_ADDRSTRLEN + 1] = { 0 };
+            stUpdate.strIP = inet_ntop(AF_INET, pPos, caAddrBuf, sizeof(caAddrBuf)); pPos += 4;
+            stUpdate.tLeaseTime = static_cast<int64_t>(GetUInt(pPos, 8));
+            stUpdate.nLeaseTime = static_cast<uint32_t>(GetUInt(pPos, 4));
+            for (string* pString : { &stUpdate.strClientId, &stUpdate.strHostName, &stUpdate.strRemoteId, &stUpdate.strRelayId })
+            {
+                if (pEnd - pPos < 1 || pEnd - pPos - 1 < *pPos)
+                    return;
+                *pString = string(reinterpret_cast<const char*>(pPos) + 1, *pPos);
+                pPos += 1 + *pPos;
+            }
+            vUpdates.push_back(move(stUpdate));
+        }
+
+        // a batch that was applied before is only acked again
+        if (nSeq == m_nPeerApplied + 1)
+        {
+            m_nPeerApplied = nSeq;
+            for (const auto& stUpdate : vUpdates)
+            {
+                if (m_fnApply)
+                    m_fnApply(stUpdate);
+            }
+        }
+
+        vector<uint8_t> vAck = MakeHeader(MSG_ACK, nSession, nSeq, 0);
+        Sign(vAck);
+        m_UdpSocket.Write(vAck.data(), vAck.size(), m_strPeer);
+    }
+}
+
+void PeerLink::WorkerThread()
+{
+    int64_t tLastHeartbeat = 0;
+
+    unique_lock<mutex> lock(m_mtxQueue);
+    while (m_bStop == false)
+    {
+        m_cvQueue.wait_for(lock, chrono::milliseconds(50), [&]() { return m_bStop == true || m_vQueue.size() >= 32 || m_bResync == true; });
+        if (m_bStop == true)
+            break;
+
+        vector<LEASE_UPDATE> vUpdates;
+        vUpdates.swap(m_vQueue);
+        lock.unlock();
+
+        if (m_bResync.exchange(false) == true && m_fnSnapshot)
+        {
+            vector<LEASE_UPDATE> vAll;
+            m_fnSnapshot(vAll);
+            vUpdates.insert(begin(vUpdates), begin(vAll), end(vAll));
+        }
+
+        // Only the last change of a client is send
+        if (vUpdates.size() > 1)
+        {
+            map<array<uint8_t, 16>, size_t> maLast;
+            for (size_t n = 0; n < vUpdates.size(); ++n)
+                maLast[vUpdates[n].arHwAddr] = n;
+            if (maLast.size() < vUpdates.size())
+            {
+                vector<LEASE_UPDATE> vTmp;
+                for (size_t n = 0; n < vUpdates.size(); ++n)
+                {
+                    if (maLast[vUpdates[n].arHwAddr] == n)
+                        vTmp.push_back(move(vUpdates[n]));
+                }
+                vUpdates.swap(vTmp);
+            }
+        }
+
+        // While the partner is offline nothing is send, he gets a full resync when he comes back
+        if (vUpdates.empty() == false && IsPeerAlive() == true)
+            SendBatches(vUpdates);
+
+        const int64_t tNow = NowMs();
+        if (tNow - tLastHeartbeat >= 1000)
+        {
+            tLastHeartbeat = tNow;
+            lock.lock();
+            vector<uint8_t> vHeartbeat = MakeHeader(MSG_HEARTBEAT, m_nSession, ++m_nHeartbeat, 0);
+            lock.unlock();
+            Sign(vHeartbeat);
+            m_UdpSocket.Write(vHeartbeat.data(), vHeartbeat.size(), m_strPeer);
+        }
+
+        lock.lock();
+
+        // repeat the batches without ack
+        const auto tSteadyNow = chrono::steady_clock::now();
+        for (auto& itUnacked : m_maUnacked)
+        {
+            if (chrono::duration_cast<chrono::milliseconds>(tSteadyNow - itUnacked.second.first).count() >= s_nRetransmitMs)
+            {
+                itUnacked.second.first = tSteadyNow;
+                m_UdpSocket.Write(itUnacked.second.second.data(), itUnacked.second.second.size(), m_strPeer);
+            }
+        }
+        // The partner can not apply the batches after a missing one, it gets everything again in a new session
+        if ((IsPeerAlive() == false && m_maUnacked.empty() == false) || m_maUnacked.size() > s_nMaxUnacked)
+            NewSession();
+    }
+}
+
+void PeerLink::SendBatches(vector<LEASE_UPDATE>& vUpdates)
+{
+    size_t nIndex = 0;
+    while (nIndex < vUpdates.size())
+    {
+        lock_guard<mutex> lock(m_mtxQueue);
+        const uint32_t nSeq = m_nNextSeq++;
+        vector<uint8_t> vMsg = MakeHeader(MSG_UPDATE, m_nSession, nSeq, 0);
+        uint16_t nCount = 0;
+
+        // chaddr(16) flag(4) ip(4) time(8) lease time(4) client id(1+n) host name(1+n) remote id(1+n) relay id(1+n)
+        for (; nIndex < vUpdates.size(); ++nIndex, ++nCount)
+        {
+            const LEASE_UPDATE& stUpdate = vUpdates[nIndex];
+            const size_t nStringLen = 4 + min<size_t>(stUpdate.strClientId.size(), 255) + min<size_t>(stUpdate.strHostName.size(), 255) + min<size_t>(stUpdate.strRemoteId.size(), 255) + min<size_t>(stUpdate.strRelayId.size(), 255);
+            if (nCount > 0 && vMsg.size() + 16 + 4 + 4 + 8 + 4 + nStringLen + s_nMacSize > s_nMaxDatagram)
+                break;
+
+            vMsg.insert(end(vMsg), begin(stUpdate.arHwAddr), end(stUpdate.arHwAddr));
+            PutUInt(vMsg, stUpdate.nFlag, 4);
+            uint32_t nIpAddr = 0;
+            ::inet_pton(AF_INET, stUpdate.strIP.c_str(), &nIpAddr);
+            const uint8_t* pIp = reinterpret_cast<const uint8_t*>(&nIpAddr);
+            vMsg.insert(end(vMsg), pIp, pIp + 4);
+            PutUInt(vMsg, static_cast<uint64_t>(stUpdate.tLeaseTime), 8);
+            PutUInt(vMsg, stUpdate.nLeaseTime, 4);
+            for (const string* pString : { &stUpdate.strClientId, &stUpdate.strHostName, &stUpdate.strRemoteId, &stUpdate.strRelayId })
+            {
+                const size_t nLen = min<size_t>(pString->size(), 255);
+                vMsg.push_back(static_cast<uint8_t>(nLen));
+                vMsg.insert(end(vMsg), begin(*pString), begin(*pString) + nLen);
+            }
+        }
+
+        vMsg[s_nHeaderSize - 2] = static_cast<uint8_t>(nCount >> 8);
+        vMsg[s_nHeaderSize - 1] = static_cast<uint8_t>(nCount);
+        Sign(vMsg);
+
+        m_UdpSocket.Write(vMsg.data(), vMsg.size(), m_strPeer);
+        m_maUnacked.emplace(nSeq, make_pair(chrono::steady_clock::now(), move(vMsg)));
+    }
+}
+
+vector<uint8_t> PeerLink::MakeHeader(MSG_TYPE nType, uint64_t nSession, uint32_t nSeq, uint16_t nCount) const
+{
+    vector<uint8_t> vMsg;
+    vMsg.reserve(s_nMaxDatagram);
+    PutUInt(vMsg, s_nMagic, 4);
+    vMsg.push_back(nType);
+    PutUInt(vMsg, nSession, 8);
+    PutUInt(vMsg, nSeq, 4);
+    PutUInt(vMsg, nCount, 2);
+    return vMsg;
+}
+
+void PeerLink::NewSession()
+{
+    const uint64_t nNow = static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count());
+    m_nSession = max(nNow, m_nSession + 1);
+    m_nNextSeq = 1;
+    m_nHeartbeat = 0;
+    m_maUnacked.clear();
+    m_bResync = true;
+}
+
+void PeerLink::Sign(vector<uint8_t>& vMsg) const
+{
+    if (m_strKey.empty() == true)
+        return;
+    uint8_t caMac[EVP_MAX_MD_SIZE];
+    unsigned int nMacLen = 0;
+    HMAC(EVP_sha256(), m_strKey.data(), static_cast<int>(m_strKey.size()), vMsg.data(), vMsg.size(), caMac, &nMacLen);
+    vMsg.insert(end(vMsg), caMac, caMac + s_nMacSize);
+}
+
+bool PeerLink::Verify(const uint8_t* pMsg, size_t& nLen) const
+{
+    if (m_strKey.empty() == true)
+        return true;
+    if (nLen < s_nMacSize)
+        return false;
+    nLen -= s_nMacSize;
+    uint8_t caMac[EVP_MAX_MD_SIZE];
+    unsigned int nMacLen = 0;
+    HMAC(EVP_sha256(), m_strKey.data(), static_cast<int>(m_strKey.size()), pMsg, nLen, caMac, &nMacLen);
+    return CRYPTO_memcmp(caMac, pMsg + nLen, s_nMacSize) == 0;
+}
@@ -0,0 +1,116 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "socketlib/SocketLib.h"
+
+using namespace std;
+
+// Two servers share the clients by the hash bucket of RFC 3074. The primary
+// answers the buckets below the split value, the secondary the others. Lease
+// changes are send to the partner in batches over UDP, every batch is acknowledged
+// and repeated until the ack is received. If the partner is silent for longer than
+// the timeout, the remaining server takes over all buckets. Only datagrams from
+// the address of the partner are accepted. With a shared key every datagram has an
+// HMAC-SHA256 (truncated to 16 bytes), datagrams without a valid one are dropped.
+// Every sender has a session (its start time, a new session is always greater) and
+// numbers its batches. The receiver applies the batches of a session strictly in
+// order: a repeated or replayed batch is only acked, a batch after a gap waits for
+// the repetition of the missing one. Datagrams of an older session are dropped. If
+// the sender has to give up unacked batches, it starts a new session with a resync.
+class PeerLink
+{
+public:
+    typedef struct
+    {
+        array<uint8_t, 16> arHwAddr;
+        string   strClientId;
+        string   strIP;
+        uint32_t nFlag;         // 0 = the entry was removed
+        int64_t  tLeaseTime;    // time_t
+        string   strHostName;
+        uint32_t nLeaseTime;
+        string   strRemoteId;
+        string   strRelayId;
+    }LEASE_UPDATE;
+
+    typedef function<void(const LEASE_UPDATE&)> FN_APPLY;
+    typedef function<void(vector<LEASE_UPDATE>&)> FN_SNAPSHOT;
+
+    PeerLink(bool bPrimary, const string& strListen, const string& strPeer, uint8_t nSplit, uint32_t nTimeout);
+    ~PeerLink();
+
+    void SetKey(const string& strKey) { m_strKey = strKey; }
+    bool Start(FN_APPLY fnApply, FN_SNAPSHOT fnSnapshot);
+    void Stop();
+
+    static uint8_t HashBucket(const uint8_t* pKey, size_t nLen);
+    bool IsResponsible(uint8_t nBucket) const;
+    bool IsPeerAlive() const;
+    void GetPoolShare(size_t& nPart, size_t& nParts) const;
+    void Queue(const LEASE_UPDATE& stUpdate);
+
+private:
+    enum MSG_TYPE : uint8_t
+    {
+        MSG_HEARTBEAT = 1,
+        MSG_UPDATE,
+        MSG_ACK
+    };
+
+    void DatenEmpfangen(UdpSocket* pUdpSocket);
+    void WorkerThread();
+    void SendBatches(vector<LEASE_UPDATE>& vUpdates);
+    vector<uint8_t> MakeHeader(MSG_TYPE nType, uint64_t nSession, uint32_t nSeq, uint16_t nCount) const;
+    void NewSession();      // with m_mtxQueue
+    void Sign(vector<uint8_t>& vMsg) const;
+    bool Verify(const uint8_t* pMsg, size_t& nLen) const;
+
+private:
+    bool        m_bPrimary;
+    string      m_strListen;
+    string      m_strPeer;
+    string      m_strKey;       // empty = no authentication
+    uint8_t     m_nSplit;
+    uint32_t    m_nTimeout;     // seconds
+    UdpSocket   m_UdpSocket;
+    FN_APPLY    m_fnApply;
+    FN_SNAPSHOT m_fnSnapshot;
+
+    thread      m_thWorker;
+    mutex       m_mtxQueue;
+    condition_variable m_cvQueue;
+    bool        m_bStop;
+    vector<LEASE_UPDATE> m_vQueue;
+    uint64_t    m_nSession;     // microseconds since 1970 at the start of the session
+    uint32_t    m_nNextSeq;
+    uint32_t    m_nHeartbeat;
+    map<uint32_t, pair<chrono::steady_clock::time_point, vector<uint8_t>>> m_maUnacked;
+    atomic<int64_t> m_tLastHeard;   // steady_clock in milliseconds, 0 = never
+    atomic<bool>    m_bResync;
+
+    // the session of the partner, only used by the receiving thread
+    uint64_t    m_nPeerSession;
+    uint32_t    m_nPeerApplied;     // the last applied batch
+    uint32_t    m_nPeerHeartbeat;
+};
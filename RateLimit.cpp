@@ -0,0 +1,109 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+#include "RateLimit.h"
+
+namespace
+{
+    const uint64_t s_nTokenUnit = 16;
+    const uint64_t s_nTokenMask = 0xffffff;
+
+    uint64_t NowMs()
+    {
+        static const auto tStart = chrono::steady_clock::now();
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - tStart).count()) + 1;
+    }
+}
+
+RateLimiter::RateLimiter(uint32_t nPerClient, uint32_t nBurst, uint32_t nGlobal) : m_nGlobalState(0), m_nPassed(0), m_nDroppedClient(0), m_nDroppedGlobal(0)
+{
+    m_pMemory = make_unique<uint8_t[]>(s_nSlots * sizeof(BUCKET) + alignof(BUCKET));
+    m_pBuckets = reinterpret_cast<BUCKET*>((reinterpret_cast<uintptr_t>(m_pMemory.get()) + alignof(BUCKET) - 1) & ~(static_cast<uintptr_t>(alignof(BUCKET)) - 1));
+    for (size_t n = 0; n < s_nSlots; ++n)
+    {
+        new (&m_pBuckets[n]) BUCKET;
+        m_pBuckets[n].nKey = 0;
+        m_pBuckets[n].nState = 0;
+    }
+    SetLimits(nPerClient, nBurst, nGlobal);
+}
+
+RateLimiter::~RateLimiter()
+{
+    for (size_t n = 0; n < s_nSlots; ++n)
+        m_pBuckets[n].~BUCKET();
+}
+
+void RateLimiter::SetLimits(uint32_t nPerClient, uint32_t nBurst, uint32_t nGlobal)
+{
+    // the tokens must fit into 24 bit
+    m_nPerClient = nPerClient;
+    m_nBurst = static_cast<uint32_t>(min<uint64_t>(max(nBurst, nPerClient), s_nTokenMask / s_nTokenUnit));
+    m_nGlobal = static_cast<uint32_t>(min<uint64_t>(nGlobal, s_nTokenMask / s_nTokenUnit));
+}
+
+bool RateLimiter::Admit(uint64_t nHwKey)
+{
+    const uint64_t nNow = NowMs();
+
+    if (m_nGlobal != 0 && TakeToken(m_nGlobalState, nNow, m_nGlobal, m_nGlobal) == false)
+    {
+        ++m_nDroppedGlobal;
+        return false;
+    }
+
+    if (m_nPerClient != 0)
+    {
+        BUCKET& stBucket = m_pBuckets[((nHwKey + 1) * 0x9E3779B97F4A7C15ull >> 40) & (s_nSlots - 1)];
+        if (stBucket.nKey.load(memory_order_relaxed) != nHwKey + 1)
+        {   // free slot, or taken by an other client. The new client starts with a full bucket
+            stBucket.nKey.store(nHwKey + 1, memory_order_relaxed);
+            stBucket.nState.store(nNow << 24 | ((m_nBurst - 1) * s_nTokenUnit), memory_order_relaxed);
+        }
+        else if (TakeToken(stBucket.nState, nNow, m_nPerClient, m_nBurst) == false)
+        {
+            ++m_nDroppedClient;
+            return false;
+        }
+    }
+
+    ++m_nPassed;
+    return true;
+}
+
+bool RateLimiter::TakeToken(atomic<uint64_t>& nState, uint64_t nNow, uint32_t nRate, uint32_t nBurst)
+{
+    uint64_t nOld = nState.load(memory_order_relaxed);
+    for (;;)
+    {
+        const uint64_t nLast = nOld >> 24;
+        uint64_t nTokens = nOld & s_nTokenMask;
+        if (nLast == 0)     // never used
+            nTokens = nBurst * s_nTokenUnit;
+        else if (nNow > nLast)
+            nTokens = min<uint64_t>(nTokens + (nNow - nLast) * nRate * s_nTokenUnit / 1000, nBurst * s_nTokenUnit);
+
+        // The time is only moved on if at least one 1/16 token was added, so slow rates are not lost by rounding
+        const uint64_t nTime = nLast == 0 || nTokens != (nOld & s_nTokenMask) ? nNow : nLast;
+        if (nTokens < s_nTokenUnit)
+        {
+            if (nState.compare_exchange_weak(nOld, nTime << 24 | nTokens, memory_order_relaxed) == true)
+                return false;
+            continue;
+        }
+        if (nState.compare_exchange_weak(nOld, nTime << 24 | (nTokens - s_nTokenUnit), memory_order_relaxed) == true)
+            return true;
+    }
+}
@@ -0,0 +1,62 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+using namespace std;
+
+// Token buckets per MAC address and one global bucket, checked before a packet
+// is parsed. The table of the MAC addresses has a fixed size, a client whose
+// slot is taken by an other client simply starts with a full bucket (lossy).
+// Each slot is one cache line, the state is changed with compare and swap.
+class RateLimiter
+{
+public:
+    RateLimiter(uint32_t nPerClient, uint32_t nBurst, uint32_t nGlobal);
+    ~RateLimiter();
+
+    void SetLimits(uint32_t nPerClient, uint32_t nBurst, uint32_t nGlobal);
+    bool Admit(uint64_t nHwKey);    // false = drop the packet
+
+    uint64_t GetPassed() const { return m_nPassed; }
+    uint64_t GetDroppedClient() const { return m_nDroppedClient; }
+    uint64_t GetDroppedGlobal() const { return m_nDroppedGlobal; }
+
+private:
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // State: milliseconds of the last refill (40 bit) | tokens in 1/16 (24 bit)
+    static bool TakeToken(atomic<uint64_t>& nState, uint64_t nNow, uint32_t nRate, uint32_t nBurst);
+
+    struct alignas(64) BUCKET
+    {
+        atomic<uint64_t> nKey;
+        atomic<uint64_t> nState;
+    };
+
+    static const size_t s_nSlots = 4096;    // power of 2
+
+private:
+    unique_ptr<uint8_t[]> m_pMemory;
+    BUCKET*          m_pBuckets;            // aligned to 64 inside m_pMemory
+    atomic<uint64_t> m_nGlobalState;
+    uint32_t         m_nPerClient;          // packets per second, 0 = no limit
+    uint32_t         m_nBurst;
+    uint32_t         m_nGlobal;             // packets per second, 0 = no limit
+    atomic<uint64_t> m_nPassed;
+    atomic<uint64_t> m_nDroppedClient;
+    atomic<uint64_t> m_nDroppedGlobal;
+};
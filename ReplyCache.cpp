@@ -0,0 +1,81 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include "ReplyCache.h"
+
+ReplyCache::ReplyCache(uint32_t nTtlMs) : m_tTtl(nTtlMs), m_vEntries(s_nSlots), m_nHits(0), m_nMisses(0)
+{
+    for (auto& stEntry : m_vEntries)
+    {
+        stEntry.nHwKey = 0;
+        stEntry.nXid = 0;
+        stEntry.nMsgType = 0;
+        stEntry.pSocket = nullptr;
+        stEntry.vReply.reserve(576);
+    }
+}
+
+bool ReplyCache::Replay(uint64_t nHwKey, uint32_t nXid, uint8_t nMsgType, const void* pSocket, const FN_SEND& fnSend)
+{
+    const size_t nSlot = Slot(nHwKey, nXid);
+    vector<uint8_t> vReply;
+    string strAddr;
+    {
+        lock_guard<mutex> lock(m_mtxSlots[nSlot % s_nLocks]);
+        ENTRY& stEntry = m_vEntries[nSlot];
+        if (stEntry.pSocket == pSocket && stEntry.nHwKey == nHwKey && stEntry.nXid == nXid && stEntry.nMsgType == nMsgType
+            && stEntry.vReply.empty() == false && chrono::steady_clock::now() < stEntry.tExpire)
+        {
+            vReply = stEntry.vReply;
+            strAddr = stEntry.strAddr;
+        }
+    }
+    if (vReply.empty() == true)
+    {
+        ++m_nMisses;
+        return false;
+    }
+
+    // sent without the lock, fnSend may take locks of the caller (the sockets)
+    fnSend(vReply.data(), vReply.size(), strAddr);
+    ++m_nHits;
+    return true;
+}
+
+void ReplyCache::Store(uint64_t nHwKey, uint32_t nXid, uint8_t nMsgType, const void* pSocket, const uint8_t* pReply, size_t nLen, const string& strAddr)
+{
+    const size_t nSlot = Slot(nHwKey, nXid);
+    lock_guard<mutex> lock(m_mtxSlots[nSlot % s_nLocks]);
+    ENTRY& stEntry = m_vEntries[nSlot];
+    stEntry.nHwKey = nHwKey;
+    stEntry.nXid = nXid;
+    stEntry.nMsgType = nMsgType;
+    stEntry.pSocket = pSocket;
+    stEntry.tExpire = chrono::steady_clock::now() + m_tTtl;
+    stEntry.strAddr = strAddr;
+    stEntry.vReply.assign(pReply, pReply + nLen);
+}
+
+void ReplyCache::Invalidate(uint64_t nHwKey)
+{
+    // The slot depends on the xid, so all slots are checked. Only used for the rare RELEASE / DECLINE
+    for (size_t nSlot = 0; nSlot < s_nSlots; ++nSlot)
+    {
+        lock_guard<mutex> lock(m_mtxSlots[nSlot % s_nLocks]);
+        if (m_vEntries[nSlot].nHwKey == nHwKey)
+            m_vEntries[nSlot].vReply.clear();
+    }
+}
+
+size_t ReplyCache::Slot(uint64_t nHwKey, uint32_t nXid) const
+{
+    return static_cast<size_t>(((nHwKey ^ (static_cast<uint64_t>(nXid) << 16)) * 0x9E3779B97F4A7C15ull) >> 40) & (s_nSlots - 1);
+}
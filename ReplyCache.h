@@ -0,0 +1,65 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// The encoded replies of the last requests, keyed by chaddr, xid and message type.
+// A retransmission of the client is answered with the same bytes, without parsing
+// the request or touching the leases. The table has a fixed size, a new reply
+// overwrites the old one in the slot.
+class ReplyCache
+{
+public:
+    typedef function<void(const uint8_t*, size_t, const string&)> FN_SEND;
+
+    explicit ReplyCache(uint32_t nTtlMs = 5000);
+
+    bool Replay(uint64_t nHwKey, uint32_t nXid, uint8_t nMsgType, const void* pSocket, const FN_SEND& fnSend);
+    void Store(uint64_t nHwKey, uint32_t nXid, uint8_t nMsgType, const void* pSocket, const uint8_t* pReply, size_t nLen, const string& strAddr);
+    void Invalidate(uint64_t nHwKey);
+
+    uint64_t GetHits() const { return m_nHits; }
+    uint64_t GetMisses() const { return m_nMisses; }
+
+private:
+    typedef struct
+    {
+        uint64_t    nHwKey;
+        uint32_t    nXid;
+        uint8_t     nMsgType;
+        const void* pSocket;
+        chrono::steady_clock::time_point tExpire;
+        string      strAddr;
+        vector<uint8_t> vReply;
+    }ENTRY;
+
+    size_t Slot(uint64_t nHwKey, uint32_t nXid) const;
+
+    static const size_t s_nSlots = 1024;    // power of 2
+    static const size_t s_nLocks = 64;
+
+private:
+    chrono::milliseconds m_tTtl;
+    vector<ENTRY>    m_vEntries;
+    mutex            m_mtxSlots[s_nLocks];
+    atomic<uint64_t> m_nHits;
+    atomic<uint64_t> m_nMisses;
+};
@@ -0,0 +1,108 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+#include "RequestTable.h"
+
+RequestTable::RequestTable(IngressQueue& Queue, size_t nMaxParked, chrono::seconds tTimeout) : m_Queue(Queue), m_nMaxParked(nMaxParked), m_tTimeout(tTimeout), m_nParked(0), m_nResumed(0), m_nAbsorbed(0), m_nExpired(0)
+{
+}
+
+void RequestTable::SetLimit(size_t nMaxParked)
+{
+    lock_guard<mutex> lock(m_mtxTable);
+    m_nMaxParked = nMaxParked;
+}
+
+bool RequestTable::Park(IngressQueue::ITEM&& stItem, STEP nStep)
+{
+    const KEY key(stItem.stPeek.nHwKey, stItem.stPeek.nXid);
+    {
+        lock_guard<mutex> lock(m_mtxTable);
+        auto itEntry = m_maEntries.find(key);
+        if (itEntry == end(m_maEntries))
+        {
+            if (m_nParked >= m_nMaxParked)
+                return false;
+            m_maEntries.emplace(key, ENTRY({ chrono::steady_clock::now() + m_tTimeout, nStep, true, move(stItem) }));
+            ++m_nParked;
+            return true;
+        }
+        if (itEntry->second.bParked == true)
+        {   // the same request twice, the first one waits already
+            ++m_nAbsorbed;
+            return false;
+        }
+        // the step has finished before we came here
+        stItem.nStep = itEntry->second.nStep;
+        stItem.strProbeIp = move(itEntry->second.stItem.strProbeIp);
+        stItem.bInUse = itEntry->second.stItem.bInUse;
+        m_maEntries.erase(itEntry);
+    }
+    ++m_nResumed;
+    return m_Queue.Push(move(stItem));
+}
+
+void RequestTable::Resume(const PACKETPEEK& stPeek, STEP nStep, const string& strProbeIp, bool bInUse)
+{
+    const KEY key(stPeek.nHwKey, stPeek.nXid);
+    IngressQueue::ITEM stItem;
+    {
+        lock_guard<mutex> lock(m_mtxTable);
+        auto itEntry = m_maEntries.find(key);
+        if (itEntry == end(m_maEntries))
+        {   // Park comes later and finds the mark
+            stItem.strProbeIp = strProbeIp;
+            stItem.bInUse = bInUse;
+            m_maEntries.emplace(key, ENTRY({ chrono::steady_clock::now() + m_tTimeout, nStep, false, move(stItem) }));
+            return;
+        }
+        if (itEntry->second.bParked == false)
+            return;
+        stItem = move(itEntry->second.stItem);
+        stItem.nStep = nStep;
+        stItem.strProbeIp = strProbeIp;
+        stItem.bInUse = bInUse;
+        m_maEntries.erase(itEntry);
+        --m_nParked;
+    }
+    ++m_nResumed;
+    m_Queue.Push(move(stItem));
+}
+
+bool RequestTable::Absorb(const PACKETPEEK& stPeek)
+{
+    lock_guard<mutex> lock(m_mtxTable);
+    auto itEntry = m_maEntries.find(KEY(stPeek.nHwKey, stPeek.nXid));
+    if (itEntry == end(m_maEntries) || itEntry->second.bParked == false)
+        return false;
+    ++m_nAbsorbed;
+    return true;
+}
+
+void RequestTable::Expire()
+{
+    const auto tNow = chrono::steady_clock::now();
+    lock_guard<mutex> lock(m_mtxTable);
+    for (auto itEntry = begin(m_maEntries); itEntry != end(m_maEntries);)
+    {
+        if (itEntry->second.tDeadline > tNow)
+        {
+            ++itEntry;
+            continue;
+        }
+        if (itEntry->second.bParked == true)
+        {
+            --m_nParked;
+            ++m_nExpired;
+        }
+        itEntry = m_maEntries.erase(itEntry);
+    }
+}
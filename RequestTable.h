@@ -0,0 +1,79 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+ * You may use, distribute and modify this code under the terms
+ * that changes to the code must be reported back the original
+ * author
+ *
+ * Company: Hauck Software Solutions
+ * Author:  Thomas Hauck
+ * Email:   Thomas@fam-hauck.de
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "IngressQueue.h"
+
+using namespace std;
+
+// The requests that wait for an asynchronous step. The worker thread is the event
+// loop of the server: a request that has to wait is parked here with the step it
+// waits for, and the worker takes the next packet. The completion comes from any
+// thread and resumes the request, it is put into the ingress queue again and the
+// worker continues it. What was done before the suspension is in the lease table,
+// the result of the step (the pinged address and its answer) comes with the request,
+// it does not depend on a cache that may be expired when the worker gets there.
+//
+// Parking is done in two phases, because the completion can come before the
+// request is parked: Resume without a parked request keeps a mark, Park finds it
+// and resumes at once. A retransmission of a parked request is absorbed, a request
+// that is not completed in time is dropped (the client sends it again).
+class RequestTable
+{
+public:
+    enum STEP : uint8_t
+    {
+        STEP_RECEIVED = 0,  // new from the network
+        STEP_PROBE          // the ping of the offered address has finished
+    };
+
+    RequestTable(IngressQueue& Queue, size_t nMaxParked, chrono::seconds tTimeout);
+
+    void SetLimit(size_t nMaxParked);
+    bool Park(IngressQueue::ITEM&& stItem, STEP nStep);   // false if the request is dropped
+    void Resume(const PACKETPEEK& stPeek, STEP nStep, const string& strProbeIp, bool bInUse);
+    bool Absorb(const PACKETPEEK& stPeek);                // true if the request is a retransmission of a parked one
+    void Expire();
+
+    size_t GetParked() const { return m_nParked; }
+    uint64_t GetResumed() const { return m_nResumed; }
+    uint64_t GetAbsorbed() const { return m_nAbsorbed; }
+    uint64_t GetExpired() const { return m_nExpired; }
+
+private:
+    typedef pair<uint64_t, uint32_t> KEY;   // hardware address, xid
+
+    typedef struct
+    {
+        chrono::steady_clock::time_point tDeadline;
+        STEP  nStep;
+        bool  bParked;          // false = the completion came first
+        IngressQueue::ITEM stItem;  // the result of the step is in stItem, if the completion came first only the result
+    }ENTRY;
+
+private:
+    mutex            m_mtxTable;
+    map<KEY, ENTRY>  m_maEntries;
+    IngressQueue&    m_Queue;
+    size_t           m_nMaxParked;
+    chrono::seconds  m_tTimeout;
+    atomic<size_t>   m_nParked;
+    atomic<uint64_t> m_nResumed;
+    atomic<uint64_t> m_nAbsorbed;
+    atomic<uint64_t> m_nExpired;
+};
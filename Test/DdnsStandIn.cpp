@@ -0,0 +1,477 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+// A DdnsUpdater against a small DNS server on the loopback interface. The stand-in
+// keeps one zone in memory, checks the TSIG of every message and evaluates the
+// prerequisites of RFC 2136 like a real server. Tested are the rules of RFC 4703
+// (the DHCID protects the name of an other client), the TSIG and the increasing
+// delay of the repetitions when the server does not answer (takes about 12 s).
+//
+// g++ -std=c++14 -I.. DdnsStandIn.cpp ../DdnsUpdater.cpp ../Trace.cpp -lcrypto -lpthread -o DdnsStandIn
+// ./DdnsStandIn
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "../DdnsUpdater.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    const uint16_t s_nPort = 47053;
+    const char*    s_szKeyName = "dhcp-key";
+    const char*    s_szSecret = "c2VjcmV0LWtleS1vZi10aGUtdGVzdA==";     // "secret-key-of-the-test"
+    const char*    s_szWrongSecret = "d3Jvbmcta2V5LW9mLXRoZS10ZXN0";     // "wrong-key-of-the-test"
+
+    enum : uint16_t
+    {
+        TYPE_A = 1,
+        TYPE_PTR = 12,
+        TYPE_DHCID = 49,
+        TYPE_TSIG = 250,
+        TYPE_ANY = 255,
+        CLASS_IN = 1,
+        CLASS_NONE = 254,
+        CLASS_ANY = 255
+    };
+
+    enum : uint8_t
+    {
+        RCODE_NOERROR = 0,
+        RCODE_FORMERR = 1,
+        RCODE_NXDOMAIN = 3,
+        RCODE_YXDOMAIN = 6,
+        RCODE_YXRRSET = 7,
+        RCODE_NXRRSET = 8,
+        RCODE_NOTAUTH = 9
+    };
+
+    typedef struct
+    {
+        string   strName;
+        uint16_t nType;
+        uint16_t nClass;
+        uint32_t nTtl;
+        vector<uint8_t> vRdata;
+        size_t   nStart;        // offset of the record in the message
+    }RR;
+
+    uint64_t GetUInt(const vector<uint8_t>& vMsg, size_t& nPos, int nBytes)
+    {
+        uint64_t nValue = 0;
+        for (int n = 0; n < nBytes && nPos < vMsg.size(); ++n)
+            nValue = (nValue << 8) | vMsg[nPos++];
+        return nValue;
+    }
+
+    // the updater never compresses names
+    bool GetName(const vector<uint8_t>& vMsg, size_t& nPos, string& strName)
+    {
+        strName.clear();
+        while (nPos < vMsg.size() && vMsg[nPos] != 0)
+        {
+            const size_t nLen = vMsg[nPos++];
+            if (nLen > 63 || nPos + nLen > vMsg.size())
+                return false;
+            strName += (strName.empty() == true ? "" : ".") + string(reinterpret_cast<const char*>(&vMsg[nPos]), nLen);
+            nPos += nLen;
+        }
+        ++nPos;
+        return nPos <= vMsg.size();
+    }
+
+    void PutName(vector<uint8_t>& vBuf, const string& strName)
+    {
+        for (size_t nStart = 0; nStart < strName.size();)
+        {
+            size_t nEnd = strName.find('.', nStart);
+            if (nEnd == string::npos)
+                nEnd = strName.size();
+            vBuf.push_back(static_cast<uint8_t>(nEnd - nStart));
+            vBuf.insert(end(vBuf), begin(strName) + nStart, begin(strName) + nEnd);
+            nStart = nEnd + 1;
+        }
+        vBuf.push_back(0);
+    }
+
+    void PutUInt(vector<uint8_t>& vBuf, uint64_t nValue, int nBytes)
+    {
+        for (int n = nBytes - 1; n >= 0; --n)
+            vBuf.push_back(static_cast<uint8_t>(nValue >> (n * 8)));
+    }
+
+    vector<uint8_t> Decode(const string& strBase64)
+    {
+        vector<uint8_t> vOut(strBase64.size() / 4 * 3);
+        const int nLen = EVP_DecodeBlock(vOut.data(), reinterpret_cast<const unsigned char*>(strBase64.c_str()), static_cast<int>(strBase64.size()));
+        vOut.resize(nLen - count(end(strBase64) - 2, end(strBase64), '='));
+        return vOut;
+    }
+
+    vector<uint8_t> Address(const char* szIpAddr)
+    {
+        vector<uint8_t> vAddr(4);
+        ::inet_pton(AF_INET, szIpAddr, vAddr.data());
+        return vAddr;
+    }
+}
+
+// The DNS server: name -> type -> the RDATA of the records
+class StandIn
+{
+public:
+    StandIn(const string& strSecret) : m_vSecret(Decode(strSecret)), m_fdSocket(-1), m_bStop(false), m_nDrop(0), m_nBadTsig(0), m_nUnsigned(0)
+    {
+    }
+
+    ~StandIn()
+    {
+        m_bStop = true;
+        if (m_thServer.joinable() == true)
+            m_thServer.join();
+        if (m_fdSocket >= 0)
+            ::close(m_fdSocket);
+    }
+
+    bool Start()
+    {
+        struct sockaddr_in addr = { 0 };
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(s_nPort);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        m_fdSocket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (m_fdSocket < 0 || ::bind(m_fdSocket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+            return false;
+        m_thServer = thread(&StandIn::ServerThread, this);
+        return true;
+    }
+
+    void Drop(uint32_t nMessages) { m_nDrop = nMessages; }
+    uint32_t GetBadTsig() const { return m_nBadTsig; }
+    uint32_t GetUnsigned() const { return m_nUnsigned; }
+
+    vector<chrono::steady_clock::time_point> GetReceived()
+    {
+        lock_guard<mutex> lock(m_mtxZone);
+        return m_vReceived;
+    }
+
+    set<vector<uint8_t>> Get(const string& strName, uint16_t nType)
+    {
+        lock_guard<mutex> lock(m_mtxZone);
+        const auto itName = m_maZone.find(strName);
+        if (itName == end(m_maZone))
+            return set<vector<uint8_t>>();
+        const auto itType = itName->second.find(nType);
+        return itType != end(itName->second) ? itType->second : set<vector<uint8_t>>();
+    }
+
+private:
+    void ServerThread()
+    {
+        while (m_bStop == false)
+        {
+            struct pollfd pfd = { m_fdSocket, POLLIN, 0 };
+            if (::poll(&pfd, 1, 100) <= 0)
+                continue;
+
+            vector<uint8_t> vMsg(65535);
+            struct sockaddr_in addrFrom = { 0 };
+            socklen_t nAddrLen = sizeof(addrFrom);
+            const ssize_t nBytes = ::recvfrom(m_fdSocket, vMsg.data(), vMsg.size(), 0, reinterpret_cast<struct sockaddr*>(&addrFrom), &nAddrLen);
+            if (nBytes < 12)
+                continue;
+            vMsg.resize(static_cast<size_t>(nBytes));
+
+            {
+                lock_guard<mutex> lock(m_mtxZone);
+                m_vReceived.push_back(chrono::steady_clock::now());
+            }
+            if (m_nDrop > 0)
+            {
+                --m_nDrop;
+                continue;
+            }
+
+            vector<uint8_t> vReply(vMsg.begin(), vMsg.begin() + 12);
+            vReply[2] |= 0x80;
+            vReply[3] = (vReply[3] & 0xf0) | Update(vMsg);
+            for (size_t n = 4; n < 12; ++n)
+                vReply[n] = 0;
+            ::sendto(m_fdSocket, vReply.data(), vReply.size(), 0, reinterpret_cast<struct sockaddr*>(&addrFrom), nAddrLen);
+        }
+    }
+
+    uint8_t Update(const vector<uint8_t>& vMsg)
+    {
+        size_t nPos = 4;
+        const size_t nZones = static_cast<size_t>(GetUInt(vMsg, nPos, 2));
+        const size_t nPrereqs = static_cast<size_t>(GetUInt(vMsg, nPos, 2));
+        const size_t nUpdates = static_cast<size_t>(GetUInt(vMsg, nPos, 2));
+        const size_t nAdditional = static_cast<size_t>(GetUInt(vMsg, nPos, 2));
+        if ((vMsg[2] >> 3 & 0x0f) != 5 || nZones != 1)
+            return RCODE_FORMERR;
+
+        string strZone;
+        if (GetName(vMsg, nPos, strZone) == false)
+            return RCODE_FORMERR;
+        nPos += 4;
+
+        vector<RR> vRecords;
+        for (size_t n = 0; n < nPrereqs + nUpdates + nAdditional; ++n)
+        {
+            RR stRR;
+            stRR.nStart = nPos;
+            if (GetName(vMsg, nPos, stRR.strName) == false || nPos + 10 > vMsg.size())
+                return RCODE_FORMERR;
+            stRR.nType = static_cast<uint16_t>(GetUInt(vMsg, nPos, 2));
+            stRR.nClass = static_cast<uint16_t>(GetUInt(vMsg, nPos, 2));
+            stRR.nTtl = static_cast<uint32_t>(GetUInt(vMsg, nPos, 4));
+            const size_t nLen = static_cast<size_t>(GetUInt(vMsg, nPos, 2));
+            if (nPos + nLen > vMsg.size())
+                return RCODE_FORMERR;
+            stRR.vRdata.assign(vMsg.begin() + nPos, vMsg.begin() + nPos + nLen);
+            nPos += nLen;
+            vRecords.push_back(stRR);
+        }
+
+        // RFC 8945: the TSIG is the last record, the key is required
+        if (vRecords.empty() == true || vRecords.back().nType != TYPE_TSIG)
+        {
+            ++m_nUnsigned;
+            return RCODE_NOTAUTH;
+        }
+        if (CheckTsig(vMsg, vRecords.back()) == false)
+        {
+            ++m_nBadTsig;
+            return RCODE_NOTAUTH;
+        }
+
+        lock_guard<mutex> lock(m_mtxZone);
+
+        // RFC 2136, 3.2: the prerequisites
+        for (size_t n = 0; n < nPrereqs; ++n)
+        {
+            const RR& stRR = vRecords[n];
+            const auto itName = m_maZone.find(stRR.strName);
+            const bool bName = itName != end(m_maZone) && itName->second.empty() == false;
+            const bool bRRset = bName == true && itName->second.find(stRR.nType) != end(itName->second);
+            if (stRR.nClass == CLASS_ANY && stRR.nType == TYPE_ANY && bName == false)
+                return RCODE_NXDOMAIN;
+            if (stRR.nClass == CLASS_ANY && stRR.nType != TYPE_ANY && bRRset == false)
+                return RCODE_NXRRSET;
+            if (stRR.nClass == CLASS_NONE && stRR.nType == TYPE_ANY && bName == true)
+                return RCODE_YXDOMAIN;
+            if (stRR.nClass == CLASS_NONE && stRR.nType != TYPE_ANY && bRRset == true)
+                return RCODE_YXRRSET;
+            if (stRR.nClass == CLASS_IN && (bRRset == false || itName->second[stRR.nType].count(stRR.vRdata) == 0))
+                return RCODE_NXRRSET;
+        }
+
+        // 3.4: the updates
+        for (size_t n = nPrereqs; n < nPrereqs + nUpdates; ++n)
+        {
+            const RR& stRR = vRecords[n];
+            auto& maTypes = m_maZone[stRR.strName];
+            if (stRR.nClass == CLASS_IN)
+                maTypes[stRR.nType].insert(stRR.vRdata);
+            else if (stRR.nClass == CLASS_ANY && stRR.nType == TYPE_ANY)
+                maTypes.clear();
+            else if (stRR.nClass == CLASS_ANY)
+                maTypes.erase(stRR.nType);
+            else if (stRR.nClass == CLASS_NONE)
+            {
+                maTypes[stRR.nType].erase(stRR.vRdata);
+                if (maTypes[stRR.nType].empty() == true)
+                    maTypes.erase(stRR.nType);
+            }
+            if (maTypes.empty() == true)
+                m_maZone.erase(stRR.strName);
+        }
+        return RCODE_NOERROR;
+    }
+
+    // RFC 8945, 4.3.3: the message without the TSIG record and with ARCOUNT - 1, then the TSIG variables
+    bool CheckTsig(const vector<uint8_t>& vMsg, const RR& stTsig) const
+    {
+        size_t nPos = 0;
+        string strAlgorithm;
+        if (GetName(stTsig.vRdata, nPos, strAlgorithm) == false || strAlgorithm != "hmac-sha256" || stTsig.strName != s_szKeyName)
+            return false;
+        const uint64_t tSigned = GetUInt(stTsig.vRdata, nPos, 6);
+        const uint16_t nFudge = static_cast<uint16_t>(GetUInt(stTsig.vRdata, nPos, 2));
+        const size_t nMacLen = static_cast<size_t>(GetUInt(stTsig.vRdata, nPos, 2));
+        if (nPos + nMacLen + 6 > stTsig.vRdata.size())
+            return false;
+        const vector<uint8_t> vMac(stTsig.vRdata.begin() + nPos, stTsig.vRdata.begin() + nPos + nMacLen);
+        nPos += nMacLen + 2;
+        const uint16_t nError = static_cast<uint16_t>(GetUInt(stTsig.vRdata, nPos, 2));
+        const size_t nOtherLen = static_cast<size_t>(GetUInt(stTsig.vRdata, nPos, 2));
+
+        const uint64_t tNow = static_cast<uint64_t>(time(nullptr));
+        if (tSigned + nFudge < tNow || tNow + nFudge < tSigned)
+            return false;
+
+        vector<uint8_t> vSign(vMsg.begin(), vMsg.begin() + stTsig.nStart);
+        vSign[11] -= 1;
+        PutName(vSign, stTsig.strName);
+        PutUInt(vSign, CLASS_ANY, 2);
+        PutUInt(vSign, 0, 4);
+        PutName(vSign, strAlgorithm);
+        PutUInt(vSign, tSigned, 6);
+        PutUInt(vSign, nFudge, 2);
+        PutUInt(vSign, nError, 2);
+        PutUInt(vSign, nOtherLen, 2);
+        vSign.insert(end(vSign), stTsig.vRdata.begin() + nPos, stTsig.vRdata.begin() + min(nPos + nOtherLen, stTsig.vRdata.size()));
+
+        uint8_t caMac[EVP_MAX_MD_SIZE];
+        unsigned int nLen = 0;
+        HMAC(EVP_sha256(), m_vSecret.data(), static_cast<int>(m_vSecret.size()), vSign.data(), vSign.size(), caMac, &nLen);
+        return nLen == vMac.size() && memcmp(caMac, vMac.data(), nLen) == 0;
+    }
+
+private:
+    vector<uint8_t> m_vSecret;
+    int             m_fdSocket;
+    thread          m_thServer;
+    atomic<bool>    m_bStop;
+    atomic<uint32_t> m_nDrop;
+    atomic<uint32_t> m_nBadTsig;
+    atomic<uint32_t> m_nUnsigned;
+    mutex           m_mtxZone;
+    map<string, map<uint16_t, set<vector<uint8_t>>>> m_maZone;
+    vector<chrono::steady_clock::time_point> m_vReceived;
+};
+
+namespace
+{
+    int s_nErrors = 0;
+
+    void Check(bool bOk, const char* szWhat)
+    {
+        wcout << (bOk == true ? L"ok     " : L"FAILED ") << szWhat << endl;
+        if (bOk == false)
+            ++s_nErrors;
+    }
+
+    bool WaitDone(DdnsUpdater& Updater, int nSeconds)
+    {
+        for (int n = 0; n < nSeconds * 20 && Updater.GetPending() > 0; ++n)
+            this_thread::sleep_for(chrono::milliseconds(50));
+        return Updater.GetPending() == 0;
+    }
+}
+
+int main()
+{
+    StandIn Server(s_szSecret);
+    if (Server.Start() == false)
+    {
+        wcout << L"the stand-in could not bind 127.0.0.1:" << s_nPort << endl;
+        return 1;
+    }
+
+    const string strServer = "127.0.0.1:" + to_string(s_nPort);
+    const uint8_t caHwAddrA[6] = { 0x02, 0, 0, 0, 0, 0x0a };
+    const uint8_t caHwAddrB[6] = { 0x02, 0, 0, 0, 0, 0x0b };
+
+    {
+        DdnsUpdater Updater(strServer, 300, 24);
+        Updater.SetKey(s_szKeyName, "hmac-sha256", s_szSecret);
+        Updater.Start();
+
+        // the name is not in use: A, DHCID and PTR
+        Updater.Register("host.example.test", "192.168.1.10", string(), caHwAddrA);
+        Check(WaitDone(Updater, 10) == true, "register of a new name");
+        Check(Server.Get("host.example.test", TYPE_A) == set<vector<uint8_t>>({ Address("192.168.1.10") }), "A record added");
+        const set<vector<uint8_t>> setDhcidA = Server.Get("host.example.test", TYPE_DHCID);
+        Check(setDhcidA.size() == 1, "DHCID record added");
+        Check(Server.Get("10.1.168.192.in-addr.arpa", TYPE_PTR).size() == 1, "PTR record added");
+
+        // an other client with the same name: YXDOMAIN, then NXRRSET for its DHCID, the name stays
+        Updater.Register("host.example.test", "192.168.1.11", string(), caHwAddrB);
+        Check(WaitDone(Updater, 10) == true && Updater.GetConflicts() == 1, "the name of an other client is a conflict");
+        Check(Server.Get("host.example.test", TYPE_A) == set<vector<uint8_t>>({ Address("192.168.1.10") }), "A record of the other client kept");
+        Check(Server.Get("11.1.168.192.in-addr.arpa", TYPE_PTR).empty() == true, "no PTR record after a conflict");
+
+        // the same client with a new address: the DHCID matches, the A record is replaced
+        Updater.Register("host.example.test", "192.168.1.12", string(), caHwAddrA);
+        Check(WaitDone(Updater, 10) == true && Updater.GetConflicts() == 1, "new address of the same client");
+        Check(Server.Get("host.example.test", TYPE_A) == set<vector<uint8_t>>({ Address("192.168.1.12") }), "A record replaced");
+        Check(Server.Get("host.example.test", TYPE_DHCID) == setDhcidA, "DHCID unchanged");
+
+        // a remove by the other client is refused by the DHCID
+        Updater.Unregister("host.example.test", "192.168.1.12", string(), caHwAddrB);
+        Check(WaitDone(Updater, 10) == true && Server.Get("host.example.test", TYPE_A).size() == 1, "remove of an other client refused");
+
+        // the owner removes the name, the DHCID goes with the last address
+        Updater.Unregister("host.example.test", "192.168.1.12", string(), caHwAddrA);
+        Check(WaitDone(Updater, 10) == true && Server.Get("host.example.test", TYPE_A).empty() == true && Server.Get("host.example.test", TYPE_DHCID).empty() == true, "remove by the owner");
+        Check(Server.GetBadTsig() == 0 && Server.GetUnsigned() == 0, "every message had a valid TSIG");
+        Updater.Stop();
+    }
+
+    {
+        // the wrong key: the server answers NOTAUTH and changes nothing
+        DdnsUpdater Updater(strServer, 300, 0);
+        Updater.SetKey(s_szKeyName, "hmac-sha256", s_szWrongSecret);
+        Updater.Start();
+        Updater.Register("wrong.example.test", "192.168.1.20", string(), caHwAddrA);
+        this_thread::sleep_for(chrono::seconds(1));
+        Check(Server.GetBadTsig() >= 1 && Server.Get("wrong.example.test", TYPE_A).empty() == true, "wrong TSIG refused");
+        Updater.Stop();
+    }
+
+    {
+        // no answer to the first two messages: 2 s timeout each, then 2 s and 4 s delay
+        DdnsUpdater Updater(strServer, 300, 0);
+        Updater.SetKey(s_szKeyName, "hmac-sha256", s_szSecret);
+        Server.Drop(2);
+        const size_t nBefore = Server.GetReceived().size();
+        Updater.Start();
+        Updater.Register("late.example.test", "192.168.1.30", string(), caHwAddrA);
+        Check(WaitDone(Updater, 20) == true && Server.Get("late.example.test", TYPE_A).size() == 1, "update after two lost messages");
+
+        const vector<chrono::steady_clock::time_point> vReceived = Server.GetReceived();
+        const bool bCount = vReceived.size() >= nBefore + 3;
+        Check(bCount == true, "three messages for the name");
+        if (bCount == true)
+        {
+            const auto nFirstGap = chrono::duration_cast<chrono::milliseconds>(vReceived[nBefore + 1] - vReceived[nBefore]).count();
+            const auto nSecondGap = chrono::duration_cast<chrono::milliseconds>(vReceived[nBefore + 2] - vReceived[nBefore + 1]).count();
+            wcout << L"        repetitions after " << nFirstGap << L" ms and " << nSecondGap << L" ms" << endl;
+            Check(nFirstGap >= 3900 && nSecondGap >= 5900 && nSecondGap > nFirstGap, "the delay increases");
+        }
+        Updater.Stop();
+    }
+
+    wcout << (s_nErrors == 0 ? L"OK" : L"FAILED") << endl;
+    return s_nErrors == 0 ? 0 : 1;
+}
@@ -0,0 +1,310 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+// Load generator for a running server. It works as a relay agent: the requests have
+// the relay address as giaddr, the server answers to relay:67. Every client does
+// DHCPDISCOVER, DHCPOFFER, DHCPREQUEST, DHCPACK, or with rapid commit (RFC 4039)
+// DHCPDISCOVER and DHCPACK, and releases the lease afterwards. Up to window clients
+// are running at the same time. Shows the leases per second and the latency from
+// the DHCPDISCOVER to the DHCPACK. "both" runs the two modes one after the other
+// with different clients and compares them. The scope of the server needs
+// RapidCommit = 1, otherwise it answers with DHCPOFFER and the client goes on with
+// DHCPREQUEST (counted as fallback). Port 67 needs root or CAP_NET_BIND_SERVICE.
+//
+// g++ -std=c++14 -I.. DhcpLoad.cpp -o DhcpLoad
+// ./DhcpLoad server[:port] relay [clients] [window] [2step|rapid|both]
+// e.g. ./DhcpLoad 127.0.0.1 127.0.0.2 10000 64 both
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    enum : uint8_t
+    {
+        DHCPDISCOVER = 1,
+        DHCPOFFER,
+        DHCPREQUEST,
+        DHCPDECLINE,
+        DHCPACK,
+        DHCPNAK,
+        DHCPRELEASE
+    };
+
+    enum STATE : uint8_t
+    {
+        STATE_IDLE = 0,
+        STATE_DISCOVER,
+        STATE_REQUEST,
+        STATE_DONE,
+        STATE_FAILED
+    };
+
+    typedef struct
+    {
+        STATE    nState;
+        uint32_t nServerId;     // network byte order
+        uint32_t nYiAddr;
+        chrono::steady_clock::time_point tStart;
+    }CLIENT;
+
+    typedef struct
+    {
+        size_t nDone;
+        size_t nLost;
+        size_t nNak;
+        size_t nFallback;       // DHCPOFFER on a rapid commit DHCPDISCOVER
+        int64_t nMs;
+        vector<int64_t> vLatency;   // microseconds
+    }RESULT;
+
+    const auto s_tTimeout = chrono::seconds(2);
+    const size_t s_nHeaderSize = 240;   // with the magic cookie
+
+    vector<uint8_t> MakeMessage(uint8_t nType, uint32_t nXid, uint32_t nGiAddr, uint8_t nMode, uint32_t nClient, bool bRapidCommit, uint32_t nRequestIp, uint32_t nServerId)
+    {
+        vector<uint8_t> vMsg(s_nHeaderSize, 0);
+        vMsg[0] = 1;        // BOOTREQUEST
+        vMsg[1] = 1;        // ethernet
+        vMsg[2] = 6;
+        vMsg[3] = 1;        // hops, we are the relay
+        memcpy(&vMsg[4], &nXid, 4);
+        if (nType == DHCPRELEASE)
+            memcpy(&vMsg[12], &nRequestIp, 4);      // ciaddr
+        memcpy(&vMsg[24], &nGiAddr, 4);
+        const uint8_t caHwAddr[6] = { 0x02, nMode, static_cast<uint8_t>(nClient >> 24), static_cast<uint8_t>(nClient >> 16), static_cast<uint8_t>(nClient >> 8), static_cast<uint8_t>(nClient) };
+        memcpy(&vMsg[28], caHwAddr, sizeof(caHwAddr));
+        const uint8_t caCookie[4] = { 99, 130, 83, 99 };
+        memcpy(&vMsg[236], caCookie, sizeof(caCookie));
+
+        vMsg.insert(end(vMsg), { 53, 1, nType });
+        if (bRapidCommit == true)
+            vMsg.insert(end(vMsg), { 80, 0 });
+        if (nType == DHCPREQUEST)
+        {
+            vMsg.insert(end(vMsg), { 50, 4 });
+            vMsg.insert(end(vMsg), reinterpret_cast<const uint8_t*>(&nRequestIp), reinterpret_cast<const uint8_t*>(&nRequestIp) + 4);
+        }
+        if (nType == DHCPREQUEST || nType == DHCPRELEASE)
+        {
+            vMsg.insert(end(vMsg), { 54, 4 });
+            vMsg.insert(end(vMsg), reinterpret_cast<const uint8_t*>(&nServerId), reinterpret_cast<const uint8_t*>(&nServerId) + 4);
+        }
+        if (nType != DHCPRELEASE)
+            vMsg.insert(end(vMsg), { 55, 3, 1, 3, 6 });
+        vMsg.push_back(255);
+        if (vMsg.size() < 300)
+            vMsg.resize(300, 0);
+        return vMsg;
+    }
+
+    // message type, server identifier and whether option 80 is in the reply
+    bool ParseReply(const uint8_t* pMsg, size_t nLen, uint8_t& nType, uint32_t& nServerId, bool& bRapidCommit)
+    {
+        nType = 0;
+        nServerId = 0;
+        bRapidCommit = false;
+        if (nLen < s_nHeaderSize || pMsg[0] != 2)
+            return false;
+        for (size_t nPos = s_nHeaderSize; nPos < nLen && pMsg[nPos] != 255;)
+        {
+            if (pMsg[nPos] == 0)
+            {
+                ++nPos;
+                continue;
+            }
+            if (nPos + 2 > nLen || nPos + 2 + pMsg[nPos + 1] > nLen)
+                break;
+            if (pMsg[nPos] == 53 && pMsg[nPos + 1] == 1)
+                nType = pMsg[nPos + 2];
+            else if (pMsg[nPos] == 54 && pMsg[nPos + 1] == 4)
+                memcpy(&nServerId, &pMsg[nPos + 2], 4);
+            else if (pMsg[nPos] == 80)
+                bRapidCommit = true;
+            nPos += 2 + pMsg[nPos + 1];
+        }
+        return nType != 0;
+    }
+
+    bool ParseAddr(const string& strAddr, uint16_t nDefaultPort, struct sockaddr_in& addr)
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        const size_t nColon = strAddr.find(':');
+        addr.sin_port = htons(nColon != string::npos ? static_cast<uint16_t>(stoi(strAddr.substr(nColon + 1))) : nDefaultPort);
+        return ::inet_pton(AF_INET, strAddr.substr(0, nColon).c_str(), &addr.sin_addr) == 1;
+    }
+}
+
+RESULT Run(int fdSocket, const struct sockaddr_in& addrServer, uint32_t nGiAddr, uint32_t nClients, uint32_t nWindow, bool bRapidCommit)
+{
+    RESULT stResult = { 0, 0, 0, 0, 0, {} };
+    vector<CLIENT> vClients(nClients, CLIENT({ STATE_IDLE, 0, 0, chrono::steady_clock::time_point() }));
+    const uint8_t nMode = bRapidCommit == true ? 0x20 : 0x10;
+    const uint32_t nXidBase = static_cast<uint32_t>(chrono::steady_clock::now().time_since_epoch().count()) & 0xff000000;
+
+    auto fnSend = [&](const vector<uint8_t>& vMsg)
+    {
+        ::sendto(fdSocket, vMsg.data(), vMsg.size(), 0, reinterpret_cast<const struct sockaddr*>(&addrServer), sizeof(addrServer));
+    };
+
+    const auto tBegin = chrono::steady_clock::now();
+    uint32_t nNext = 0, nRunning = 0, nOldest = 0;
+    while (nNext < nClients || nRunning > 0)
+    {
+        for (; nNext < nClients && nRunning < nWindow; ++nNext, ++nRunning)
+        {
+            vClients[nNext].nState = STATE_DISCOVER;
+            vClients[nNext].tStart = chrono::steady_clock::now();
+            fnSend(MakeMessage(DHCPDISCOVER, htonl(nXidBase + nNext), nGiAddr, nMode, nNext, bRapidCommit, 0, 0));
+        }
+
+        struct pollfd pfd = { fdSocket, POLLIN, 0 };
+        if (::poll(&pfd, 1, 10) > 0)
+        {
+            uint8_t caReply[1500];
+            for (ssize_t nBytes; (nBytes = ::recv(fdSocket, caReply, sizeof(caReply), MSG_DONTWAIT)) > 0;)
+            {
+                uint8_t nType = 0;
+                uint32_t nServerId = 0, nXid = 0, nYiAddr = 0;
+                bool bReplyRapid = false;
+                if (ParseReply(caReply, static_cast<size_t>(nBytes), nType, nServerId, bReplyRapid) == false)
+                    continue;
+                memcpy(&nXid, &caReply[4], 4);
+                memcpy(&nYiAddr, &caReply[16], 4);
+                const uint32_t nClient = ntohl(nXid) - nXidBase;
+                if (nClient >= nClients || caReply[28] != 0x02 || caReply[29] != nMode)
+                    continue;   // an answer of an other run or a late answer
+                CLIENT& stClient = vClients[nClient];
+
+                if (nType == DHCPOFFER && stClient.nState == STATE_DISCOVER)
+                {
+                    if (bRapidCommit == true)
+                        ++stResult.nFallback;
+                    stClient.nState = STATE_REQUEST;
+                    stClient.nServerId = nServerId;
+                    stClient.nYiAddr = nYiAddr;
+                    fnSend(MakeMessage(DHCPREQUEST, nXid, nGiAddr, nMode, nClient, false, nYiAddr, nServerId));
+                }
+                else if (nType == DHCPACK && (stClient.nState == STATE_REQUEST || (stClient.nState == STATE_DISCOVER && bReplyRapid == true)))
+                {
+                    stResult.vLatency.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - stClient.tStart).count());
+                    stClient.nState = STATE_DONE;
+                    ++stResult.nDone;
+                    --nRunning;
+                    // the lease is not needed any more, the next run gets the address again
+                    fnSend(MakeMessage(DHCPRELEASE, htonl(nXidBase + nClients + nClient), nGiAddr, nMode, nClient, false, nYiAddr, nServerId != 0 ? nServerId : stClient.nServerId));
+                }
+                else if (nType == DHCPNAK && (stClient.nState == STATE_DISCOVER || stClient.nState == STATE_REQUEST))
+                {
+                    stClient.nState = STATE_FAILED;
+                    ++stResult.nNak;
+                    --nRunning;
+                }
+            }
+        }
+
+        // clients without an answer, there is no repetition
+        const auto tNow = chrono::steady_clock::now();
+        while (nOldest < nNext && (vClients[nOldest].nState == STATE_DONE || vClients[nOldest].nState == STATE_FAILED))
+            ++nOldest;
+        for (uint32_t n = nOldest; n < nNext; ++n)
+        {
+            CLIENT& stClient = vClients[n];
+            if ((stClient.nState == STATE_DISCOVER || stClient.nState == STATE_REQUEST) && tNow - stClient.tStart > s_tTimeout)
+            {
+                stClient.nState = STATE_FAILED;
+                ++stResult.nLost;
+                --nRunning;
+            }
+        }
+    }
+    stResult.nMs = max<int64_t>(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - tBegin).count(), 1);
+    sort(begin(stResult.vLatency), end(stResult.vLatency));
+    return stResult;
+}
+
+namespace
+{
+    int64_t Percentile(const vector<int64_t>& vSorted, size_t nPercent)
+    {
+        return vSorted.empty() == true ? 0 : vSorted[min(vSorted.size() - 1, vSorted.size() * nPercent / 100)];
+    }
+
+    void Print(const wchar_t* szMode, const RESULT& stResult)
+    {
+        wcout << szMode << L": " << stResult.nDone << L" leases in " << stResult.nMs << L" ms, " << stResult.nDone * 1000 / stResult.nMs << L" leases/s, lost: " << stResult.nLost
+            << L", NAK: " << stResult.nNak << L", fallback: " << stResult.nFallback << endl;
+        wcout << L"  latency us p50: " << Percentile(stResult.vLatency, 50) << L", p90: " << Percentile(stResult.vLatency, 90) << L", p99: " << Percentile(stResult.vLatency, 99)
+            << L", max: " << (stResult.vLatency.empty() == false ? stResult.vLatency.back() : 0) << endl;
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 3)
+    {
+        wcout << L"DhcpLoad server[:port] relay [clients] [window] [2step|rapid|both]" << endl;
+        return 1;
+    }
+    const uint32_t nClients = argc > 3 ? static_cast<uint32_t>(stoul(argv[3])) : 10000;
+    const uint32_t nWindow = max<uint32_t>(argc > 4 ? static_cast<uint32_t>(stoul(argv[4])) : 64, 1);
+    const string strMode = argc > 5 ? argv[5] : "both";
+
+    struct sockaddr_in addrServer, addrRelay;
+    if (ParseAddr(argv[1], 67, addrServer) == false || ParseAddr(argv[2], 67, addrRelay) == false)
+    {
+        wcout << L"invalid address" << endl;
+        return 1;
+    }
+
+    const int fdSocket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    const int nBufSize = 4 * 1024 * 1024;
+    if (fdSocket < 0 || ::setsockopt(fdSocket, SOL_SOCKET, SO_RCVBUF, &nBufSize, sizeof(nBufSize)) != 0
+        || ::bind(fdSocket, reinterpret_cast<struct sockaddr*>(&addrRelay), sizeof(addrRelay)) != 0)
+    {
+        wcout << L"the relay address " << argv[2] << L" could not be bound" << endl;
+        return 1;
+    }
+
+    RESULT stTwoStep = {}, stRapid = {};
+    if (strMode != "rapid")
+    {
+        stTwoStep = Run(fdSocket, addrServer, addrRelay.sin_addr.s_addr, nClients, nWindow, false);
+        Print(L"DISCOVER/OFFER/REQUEST/ACK", stTwoStep);
+    }
+    if (strMode != "2step")
+    {
+        stRapid = Run(fdSocket, addrServer, addrRelay.sin_addr.s_addr, nClients, nWindow, true);
+        Print(L"rapid commit DISCOVER/ACK ", stRapid);
+    }
+    if (strMode == "both" && stTwoStep.nDone > 0 && stRapid.nDone > 0)
+    {
+        const double dThroughput = static_cast<double>(stRapid.nDone * stTwoStep.nMs) / static_cast<double>(stTwoStep.nDone * stRapid.nMs);
+        const double dLatency = static_cast<double>(Percentile(stTwoStep.vLatency, 50)) / static_cast<double>(max<int64_t>(Percentile(stRapid.vLatency, 50), 1));
+        wcout << L"rapid commit: " << dThroughput << L" x leases/s, " << dLatency << L" x faster p50" << endl;
+    }
+
+    ::close(fdSocket);
+    return (stTwoStep.nLost + stRapid.nLost + stTwoStep.nNak + stRapid.nNak) == 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+// Two processes with a PeerLink each on the loopback interface. The primary sends
+// lease changes, the secondary applies them and checks the result. Shows how many
+// updates per second the pair replicates.
+//
+// g++ -std=c++14 -I.. PeerLoopback.cpp ../PeerLink.cpp ../Trace.cpp -L../socketlib -lsocketlib -lcrypto -lpthread -o PeerLoopback
+// ./PeerLoopback [updates] [key]
+
+#include <iostream>
+#include <map>
+
+#include "../PeerLink.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    const char* s_szPrimary = "127.0.0.1:47000";
+    const char* s_szSecondary = "127.0.0.1:47001";
+
+    array<uint8_t, 16> HwAddr(uint32_t nClient)
+    {
+        array<uint8_t, 16> arHwAddr = { { 0x02, 0, static_cast<uint8_t>(nClient >> 24), static_cast<uint8_t>(nClient >> 16), static_cast<uint8_t>(nClient >> 8), static_cast<uint8_t>(nClient) } };
+        return arHwAddr;
+    }
+
+    string IpAddr(uint32_t nClient)
+    {
+        return "10." + to_string((nClient >> 16) & 0xff) + "." + to_string((nClient >> 8) & 0xff) + "." + to_string(nClient & 0xff);
+    }
+
+    bool WaitForPeer(PeerLink& Peer)
+    {
+        for (int n = 0; n < 100 && Peer.IsPeerAlive() == false; ++n)
+            this_thread::sleep_for(chrono::milliseconds(50));
+        return Peer.IsPeerAlive();
+    }
+}
+
+int Secondary(uint32_t nUpdates, const string& strKey)
+{
+    mutex mtxLeases;
+    condition_variable cvDone;
+    map<array<uint8_t, 16>, PeerLink::LEASE_UPDATE> maLeases;
+    size_t nApplied = 0;
+    bool bDone = false;
+    chrono::steady_clock::time_point tFirst, tLast;
+    array<uint8_t, 16> arEnd;
+    arEnd.fill(0xff);
+
+    PeerLink Peer(false, s_szSecondary, s_szPrimary, 128, 3);
+    Peer.SetKey(strKey);
+    if (Peer.Start([&](const PeerLink::LEASE_UPDATE& stUpdate)
+    {
+        lock_guard<mutex> lock(mtxLeases);
+        if (nApplied++ == 0)
+            tFirst = chrono::steady_clock::now();
+        if (stUpdate.arHwAddr == arEnd)
+        {
+            tLast = chrono::steady_clock::now();
+            bDone = true;
+            cvDone.notify_all();
+        }
+        else if (stUpdate.nFlag == 0)
+            maLeases.erase(stUpdate.arHwAddr);
+        else
+            maLeases[stUpdate.arHwAddr] = stUpdate;
+    }, [](vector<PeerLink::LEASE_UPDATE>&) {}) == false || WaitForPeer(Peer) == false)
+    {
+        wcout << L"secondary: no connection to the primary" << endl;
+        return 1;
+    }
+
+    unique_lock<mutex> lock(mtxLeases);
+    if (cvDone.wait_for(lock, chrono::seconds(60), [&]() { return bDone; }) == false)
+    {
+        wcout << L"secondary: timeout, " << nApplied << L" updates applied" << endl;
+        return 1;
+    }
+
+    // every even client has its lease, the odd ones were removed
+    size_t nWrong = 0;
+    for (uint32_t n = 0; n < nUpdates; ++n)
+    {
+        const auto itLease = maLeases.find(HwAddr(n));
+        if ((n % 2 == 0) != (itLease != end(maLeases)) || (itLease != end(maLeases) && (itLease->second.strIP != IpAddr(n) || itLease->second.strHostName != "host" + to_string(n))))
+            ++nWrong;
+    }
+    const auto nMs = max<int64_t>(chrono::duration_cast<chrono::milliseconds>(tLast - tFirst).count(), 1);
+    wcout << L"secondary: " << nApplied << L" updates in " << nMs << L" ms, " << nApplied * 1000 / nMs << L" updates/s, wrong leases: " << nWrong << endl;
+    lock.unlock();
+    Peer.Stop();
+    return nWrong == 0 ? 0 : 1;
+}
+
+int Primary(uint32_t nUpdates, const string& strKey)
+{
+    PeerLink Peer(true, s_szPrimary, s_szSecondary, 128, 3);
+    Peer.SetKey(strKey);
+    if (Peer.Start([](const PeerLink::LEASE_UPDATE&) {}, [](vector<PeerLink::LEASE_UPDATE>&) {}) == false || WaitForPeer(Peer) == false)
+    {
+        wcout << L"primary: no connection to the secondary" << endl;
+        return 1;
+    }
+
+    const int64_t tNow = chrono::system_clock::to_time_t(chrono::system_clock::now());
+    for (uint32_t n = 0; n < nUpdates; ++n)
+        Peer.Queue(PeerLink::LEASE_UPDATE({ HwAddr(n), string(), IpAddr(n), 2, tNow, "host" + to_string(n), 3600, string(), string() }));
+    this_thread::sleep_for(chrono::milliseconds(100));    // the removes go in other batches than the adds
+    for (uint32_t n = 1; n < nUpdates; n += 2)
+        Peer.Queue(PeerLink::LEASE_UPDATE({ HwAddr(n), string(), IpAddr(n), 0, tNow, string(), 0, string(), string() }));
+    array<uint8_t, 16> arEnd;
+    arEnd.fill(0xff);
+    Peer.Queue(PeerLink::LEASE_UPDATE({ arEnd, string(), "0.0.0.0", 2, tNow, string(), 0, string(), string() }));
+
+    // the secondary ends when it has all updates, until then we repeat the batches without ack
+    int iStatus = 1;
+    ::wait(&iStatus);
+    Peer.Stop();
+    return WIFEXITED(iStatus) == true ? WEXITSTATUS(iStatus) : 1;
+}
+
+int main(int argc, const char* argv[])
+{
+    const uint32_t nUpdates = argc > 1 ? static_cast<uint32_t>(stoul(argv[1])) : 100000;
+    const string strKey = argc > 2 ? argv[2] : "";
+
+    const pid_t nPid = ::fork();
+    if (nPid < 0)
+        return 1;
+    if (nPid == 0)
+        return Secondary(nUpdates, strKey);
+
+    const int iResult = Primary(nUpdates, strKey);
+    wcout << (iResult == 0 ? L"OK" : L"FAILED") << endl;
+    return iResult;
+}
@@ -0,0 +1,101 @@
+/* Copyright (C) Hauck Software Solutions - All Rights Reserved
+* You may use, distribute and modify this code under the terms
+* that changes to the code must be reported back the original
+* author
+*
+* Company: Hauck Software Solutions
+* Author:  Thomas Hauck
+* Email:   Thomas@fam-hauck.de
+*
+*/
+
+// The ICMP probe against addresses with a known answer. The loopback address always
+// answers, an address of TEST-NET-1 (RFC 5737) never (behind a proxy that answers
+// every ping give an unused local address instead). Needs CAP_NET_RAW or a
+// ping_group_range with the group of the user. With a veth pair the address of the
+// other end can be given as the address in use and an unused address of the veth
+// network as the free one:
+//   ip link add vt0 type veth peer name vt1; ip netns add probe; ip link set vt1 netns probe
+//   ip addr add 10.99.0.1/24 dev vt0; ip link set vt0 up
+//   ip netns exec probe ip addr add 10.99.0.2/24 dev vt1; ip netns exec probe ip link set vt1 up
+//   ./ProbeLoopback 10.99.0.2 10.99.0.3
+//
+// g++ -std=c++14 -I.. ProbeLoopback.cpp ../IcmpProbe.cpp ../Trace.cpp -lpthread -o ProbeLoopback
+// ./ProbeLoopback [address in use] [free address]
+
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+#include "../IcmpProbe.h"
+
+using namespace std;
+
+namespace
+{
+    int s_nErrors = 0;
+
+    void Check(bool bOk, const string& strWhat)
+    {
+        wcout << (bOk == true ? L"ok     " : L"FAILED ") << strWhat.c_str() << endl;
+        if (bOk == false)
+            ++s_nErrors;
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    const string strInUse = argc > 1 ? argv[1] : "127.0.0.1";
+    const string strFree = argc > 2 ? argv[2] : "192.0.2.1";
+    const uint32_t nTimeoutMs = 500;
+
+    IcmpProbe Probe(nTimeoutMs, 60);
+    if (Probe.Start() == false)
+    {
+        wcout << L"no ICMP socket, CAP_NET_RAW or net.ipv4.ping_group_range is needed" << endl;
+        return 1;
+    }
+
+    mutex mtxResults;
+    condition_variable cvResults;
+    map<string, pair<int, bool>> maResults;     // address, number of callbacks, in use
+    auto fnDone = [&](const string& strIpAddr, bool bInUse)
+    {
+        lock_guard<mutex> lock(mtxResults);
+        ++maResults[strIpAddr].first;
+        maResults[strIpAddr].second = bInUse;
+        cvResults.notify_all();
+    };
+
+    // the second check of an address waits for the running probe or has the result already (loopback is fast),
+    // the free address may be unreachable (no route)
+    const auto tStart = chrono::steady_clock::now();
+    const IcmpProbe::RESULT nInUse1 = Probe.Check(strInUse, fnDone);
+    const IcmpProbe::RESULT nInUse2 = Probe.Check(strInUse, fnDone);
+    const IcmpProbe::RESULT nFree = Probe.Check(strFree, fnDone);
+    const int nInUseCalls = (nInUse1 == IcmpProbe::PROBE_PENDING ? 1 : 0) + (nInUse2 == IcmpProbe::PROBE_PENDING ? 1 : 0);
+    Check(nInUse1 == IcmpProbe::PROBE_PENDING && (nInUse2 == IcmpProbe::PROBE_PENDING || nInUse2 == IcmpProbe::PROBE_IN_USE), "the probe of " + strInUse + " is running");
+    Check(Probe.GetSent() == (nFree == IcmpProbe::PROBE_PENDING ? 2u : 1u), "one echo request per address");
+
+    unique_lock<mutex> lock(mtxResults);
+    const size_t nExpected = nFree == IcmpProbe::PROBE_PENDING ? 2 : 1;
+    cvResults.wait_for(lock, chrono::milliseconds(nTimeoutMs * 4), [&]() { return maResults.size() == nExpected && maResults[strInUse].first == nInUseCalls; });
+    const auto nMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - tStart).count();
+
+    Check(maResults[strInUse].first == nInUseCalls && maResults[strInUse].second == true, strInUse + " is in use, every waiting caller called back");
+    if (nFree == IcmpProbe::PROBE_PENDING)
+        Check(maResults[strFree].first == 1 && maResults[strFree].second == false && nMs >= nTimeoutMs, strFree + " is free after the timeout");
+    else
+        Check(nFree == IcmpProbe::PROBE_FREE, strFree + " is free, it can not be reached");
+    lock.unlock();
+
+    // the results are cached
+    Check(Probe.Check(strInUse, fnDone) == IcmpProbe::PROBE_IN_USE, strInUse + " in use from the cache");
+    Check(Probe.Check(strFree, fnDone) == IcmpProbe::PROBE_FREE, strFree + " free from the cache");
+    Check(Probe.GetCacheHits() >= 1 && Probe.GetInUse() == 1, "cache hits and one address in use");
+
+    Probe.Stop();
+    wcout << (s_nErrors == 0 ? L"OK" : L"FAILED") << endl;
+    return s_nErrors == 0 ? 0 : 1;
+}